@@ -0,0 +1,57 @@
+#include <cstdint>
+#include <cstring>
+
+#include "arena.h"
+
+
+Arena::Arena(Arena&& other) noexcept
+    : blocks(std::move(other.blocks)), cursor(other.cursor), end(other.end), blockSize(other.blockSize) {
+    other.cursor = nullptr;
+    other.end = nullptr;
+}
+
+
+Arena& Arena::operator=(Arena&& other) noexcept {
+    if (this != &other) {
+        blocks = std::move(other.blocks);
+        cursor = other.cursor;
+        end = other.end;
+        blockSize = other.blockSize;
+        other.cursor = nullptr;
+        other.end = nullptr;
+    }
+    return *this;
+}
+
+
+void* Arena::allocate(size_t size, size_t align) {
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(uintptr_t(align) - 1);
+    if (cursor == nullptr || aligned + size > reinterpret_cast<uintptr_t>(end)) {
+        // Oversized requests get a block of their own
+        size_t needed = size + align;
+        size_t capacity = needed > blockSize ? needed : blockSize;
+        blocks.emplace_back(new char[capacity]);
+        cursor = blocks.back().get();
+        end = cursor + capacity;
+        aligned = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(uintptr_t(align) - 1);
+    }
+    cursor = reinterpret_cast<char*>(aligned + size);
+    return reinterpret_cast<void*>(aligned);
+}
+
+
+std::string_view Arena::copy(std::string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+    char* data = static_cast<char*>(allocate(text.size(), 1));
+    std::memcpy(data, text.data(), text.size());
+    return std::string_view(data, text.size());
+}
+
+
+void Arena::reset() {
+    blocks.clear();
+    cursor = nullptr;
+    end = nullptr;
+}
@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+
+// Arena class: bump allocator that carves objects out of large blocks and
+// releases all of them at once. Only trivially destructible data goes here.
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 256 * 1024) : blockSize(blockSize) {}
+    Arena(Arena&& other) noexcept;
+    Arena& operator=(Arena&& other) noexcept;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    template <typename T>
+    T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    // Copy text into the arena, for strings that do not exist in the source
+    std::string_view copy(std::string_view text);
+
+    void reset();
+    size_t blockCount() const { return blocks.size(); }
+
+private:
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* cursor = nullptr;
+    char* end = nullptr;
+    size_t blockSize;
+};
+
+#endif // ARENA_H
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "compiler.h"
+#include "memstats.h"
+#include "source.h"
+
+
+// File name without directories and extension
+static std::string stem(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+
+static std::string joinPath(const std::string& dir, const std::string& name) {
+    if (dir.empty() || name.front() == '/') {
+        return name;
+    }
+    return dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+
+static std::vector<std::string> splitTabs(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (;;) {
+        size_t tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+        if (tab == std::string::npos) {
+            return fields;
+        }
+        start = tab + 1;
+    }
+}
+
+
+// Renders run concurrently, so two jobs writing one file would interleave
+static bool distinctOutputs(const std::string& listPath, const std::vector<BatchJob>& jobs) {
+    std::unordered_set<std::string> outputs;
+    for (const BatchJob& job : jobs) {
+        if (!outputs.insert(job.outputPath).second) {
+            std::cerr << listPath << ": more than one render writes " << job.outputPath << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool readBatchList(const std::string& listPath, const std::string& outDir, std::vector<BatchJob>& jobs) {
+    std::ifstream list(listPath);
+    if (!list) {
+        std::cerr << "Unable to open file: " << listPath << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(list, line)) {
+        std::istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.templatePath) || job.templatePath[0] == '#') {
+            continue;
+        }
+        if (!(fields >> job.outputPath)) {
+            job.outputPath = joinPath(outDir, stem(job.templatePath) + ".html");
+        }
+        jobs.push_back(std::move(job));
+    }
+    return distinctOutputs(listPath, jobs);
+}
+
+
+bool readBatchVariables(const std::string& templatePath, const std::string& tablePath,
+                        const std::string& outDir, std::vector<BatchJob>& jobs) {
+    std::ifstream table(tablePath);
+    if (!table) {
+        std::cerr << "Unable to open file: " << tablePath << std::endl;
+        return false;
+    }
+    std::string line;
+    if (!std::getline(table, line)) {
+        std::cerr << "Missing header row: " << tablePath << std::endl;
+        return false;
+    }
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    // Variable names carry the '$' like in the symbol table
+    std::vector<std::string> names = splitTabs(line);
+    size_t outputColumn = names.size();
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (names[i] == "_output") {
+            outputColumn = i;
+        } else if (names[i].empty() || names[i][0] != '$') {
+            names[i] = "$" + names[i];
+        }
+    }
+
+    size_t row = 0;
+    while (std::getline(table, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        row++;
+        std::vector<std::string> values = splitTabs(line);
+        if (values.size() != names.size()) {
+            std::cerr << tablePath << ": row " << row << " has " << values.size()
+                      << " fields, expected " << names.size() << std::endl;
+            return false;
+        }
+        BatchJob job;
+        job.templatePath = templatePath;
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (i == outputColumn) {
+                job.outputPath = joinPath(outDir, values[i]);
+            } else {
+                job.variables.emplace_back(names[i], Value{std::move(values[i])});
+            }
+        }
+        if (job.outputPath.empty()) {
+            job.outputPath = joinPath(outDir, stem(templatePath) + "-" + std::to_string(row) + ".html");
+        }
+        jobs.push_back(std::move(job));
+    }
+    return distinctOutputs(tablePath, jobs);
+}
+
+
+// Program and symbol table are read-only during renders, so every render
+// of a template shares them and only the interpreter is per job
+static Task<bool> renderJob(EventLoop& loop, const BatchJob& job, const Program& program,
+                            const BatchSettings& settings) {
+    int fd = open(job.outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Unable to write file: " << job.outputPath << std::endl;
+        co_return false;
+    }
+    bool written;
+    {
+        AsyncFdSink sink(loop, fd);
+        OutputBuffer output(sink, settings.flushThreshold);
+        Interpreter interpreter(program.symbols, output);
+        interpreter.setHttpBackend(settings.httpBackend);
+        interpreter.setHttpConcurrency(settings.httpConcurrency);
+        interpreter.setDatabase(*settings.database);
+        interpreter.setEventLoop(loop, &sink);
+        for (const auto& variable : job.variables) {
+            interpreter.setVariable(variable.first, variable.second);
+        }
+        MemStats::phase("execute");
+        co_await interpreter.render(program.view());
+        MemStats::phase("flush");
+        written = output.flush() && co_await sink.drain();
+        MemStats::phase(nullptr);
+    }
+    if (close(fd) != 0 || !written) {
+        std::cerr << "Unable to write file: " << job.outputPath << std::endl;
+        co_return false;
+    }
+    co_return true;
+}
+
+// One of a loop's render slots: takes the next job until none are left
+static Task<void> renderSlot(EventLoop& loop, const std::vector<const BatchJob*>& queue,
+                             std::atomic<size_t>& next, const std::vector<const Program*>& programs,
+                             const BatchSettings& settings, std::atomic<size_t>& failed) {
+    for (size_t index = next++; index < queue.size(); index = next++) {
+        if (!co_await renderJob(loop, *queue[index], *programs[index], settings)) {
+            failed++;
+        }
+    }
+}
+
+
+size_t renderBatch(const std::vector<BatchJob>& jobs, const BatchSettings& settings, ThreadPool& pool) {
+    auto started = std::chrono::steady_clock::now();
+
+    // All entries exist before the compile tasks start, so the map is not
+    // modified while they fill it in
+    std::unordered_map<std::string, std::unique_ptr<Program>> programs;
+    for (const BatchJob& job : jobs) {
+        programs[job.templatePath];
+    }
+    std::vector<std::future<void>> tasks;
+    for (auto& entry : programs) {
+        const std::string& path = entry.first;
+        std::unique_ptr<Program>& program = entry.second;
+        tasks.push_back(pool.submit([&path, &program]() {
+            // Copied, the program keeps its own text; see SourceFile
+            SourceFile source;
+            if (!source.open(path, true)) {
+                std::cerr << "Unable to open file: " << path << std::endl;
+                return;
+            }
+            program = std::make_unique<Program>(compileTemplate(source.text()));
+        }));
+    }
+    for (std::future<void>& task : tasks) {
+        task.get();
+    }
+
+    std::atomic<size_t> failed{0};
+    std::vector<const BatchJob*> queue;
+    std::vector<const Program*> queuePrograms;
+    for (const BatchJob& job : jobs) {
+        const Program* program = programs[job.templatePath].get();
+        if (!program) {
+            failed++;
+            continue;
+        }
+        queue.push_back(&job);
+        queuePrograms.push_back(program);
+    }
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> drivers;
+    for (size_t driver = 0; driver < pool.size(); ++driver) {
+        drivers.emplace_back([&]() {
+            EventLoop loop;
+            for (size_t slot = 0; slot < std::max<size_t>(1, settings.rendersPerLoop); ++slot) {
+                loop.spawn(renderSlot(loop, queue, next, queuePrograms, settings, failed));
+            }
+            loop.run();
+        });
+    }
+    for (std::thread& driver : drivers) {
+        driver.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cerr << "Batch: " << jobs.size() << " renders of " << programs.size() << " templates on "
+              << pool.size() << " threads, " << failed << " failed, " << seconds << " s, "
+              << (seconds > 0 ? jobs.size() / seconds : 0) << " pages/s" << std::endl;
+    return failed;
+}
@@ -0,0 +1,56 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "db.h"
+#include "interpret.h"
+#include "output.h"
+#include "threadpool.h"
+#include "value.h"
+
+
+// One render of a batch: template, output file and variables set before
+// the template runs
+struct BatchJob {
+    std::string templatePath;
+    std::string outputPath;
+    std::vector<std::pair<std::string, Value>> variables;
+};
+
+
+// Settings applied to every render of a batch
+struct BatchSettings {
+    DbPool* database = &DbPool::shared();
+    HttpBackend httpBackend = HTTP_NATIVE;
+    size_t httpConcurrency = Interpreter::DEFAULT_HTTP_CONCURRENCY;
+    size_t flushThreshold = OutputBuffer::DEFAULT_FLUSH_THRESHOLD;
+    // Renders in flight on each driver's event loop
+    size_t rendersPerLoop = 16;
+};
+
+
+// List file: one template per line, optionally followed by whitespace and
+// the output path; the default output is <outDir>/<stem>.html. Fails when
+// two jobs would write the same output file.
+bool readBatchList(const std::string& listPath, const std::string& outDir,
+                   std::vector<BatchJob>& jobs);
+
+// Tab-separated variables: the header row names the variables, each
+// further row is one render of `templatePath`. An _output column names
+// the output file, otherwise it is <outDir>/<stem>-<row>.html; outputs
+// must differ as in readBatchList()
+bool readBatchVariables(const std::string& templatePath, const std::string& tablePath,
+                        const std::string& outDir, std::vector<BatchJob>& jobs);
+
+// Compile every distinct template once on the pool, then render all jobs
+// on one event loop per pool thread, so that renders waiting for http()
+// or db results overlap. The loops run on threads of their own: their
+// blocking work goes to ThreadPool::shared(), which may be `pool`.
+// Returns the number of renders that failed.
+size_t renderBatch(const std::vector<BatchJob>& jobs, const BatchSettings& settings, ThreadPool& pool);
+
+#endif // BATCH_H
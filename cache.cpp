@@ -0,0 +1,390 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+
+// Bump the version whenever the instruction set or the file layout changes
+static const uint32_t CACHE_VERSION = 6;
+static const char CACHE_MAGIC[8] = {'P', 'H', 'P', 'C', 'A', 'C', 'H', 'E'};
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+
+// Cache file header; every section is addressed by its offset from the file start
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t instructionSize;
+    uint32_t constantSize;
+
+    int64_t mtime;
+    uint64_t size;
+    uint64_t hash;
+    uint64_t optimized;         // 1 if the optimizer ran before compiling
+
+    uint64_t pathOffset;
+    uint64_t pathLength;
+    uint64_t codeOffset;
+    uint64_t codeCount;
+    uint64_t constantsOffset;
+    uint64_t constantCount;
+    uint64_t symbolsOffset;     // Constant entries naming the frame slots
+    uint64_t symbolCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+
+    // FNV-1a of the header up to here and of everything after it, so that
+    // a flipped bit the validation cannot see still rejects the entry
+    uint64_t checksum;
+};
+
+
+// FNV-1a, 64 bit
+uint64_t hashBytes(const char* data, size_t size, uint64_t hash) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+// Everything after the header starts at sizeof(CacheHeader)
+static uint64_t entryChecksum(const CacheHeader& header, const char* entry, size_t size) {
+    uint64_t hash = hashBytes(reinterpret_cast<const char*>(&header), offsetof(CacheHeader, checksum));
+    return hashBytes(entry + sizeof(CacheHeader), size - sizeof(CacheHeader), hash);
+}
+
+
+CacheKey makeCacheKey(const std::string& path, std::string_view source, bool optimized) {
+    CacheKey key;
+    key.optimized = optimized;
+    char* resolved = realpath(path.c_str(), nullptr);
+    key.path = resolved ? resolved : path;
+    free(resolved);
+
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0) {
+        key.mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    }
+    key.size = source.size();
+    key.hash = hashBytes(source.data(), source.size());
+    return key;
+}
+
+
+MappedProgram::~MappedProgram() {
+    if (data) {
+        munmap(data, size);
+    }
+}
+
+
+std::string TemplateCache::entryPath(const CacheKey& key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx%s.phpc",
+                  static_cast<unsigned long long>(hashBytes(key.path.data(), key.path.size())),
+                  key.optimized ? "" : "-noopt");
+    return directory + "/" + name;
+}
+
+
+static bool inBounds(uint64_t offset, uint64_t length, uint64_t limit) {
+    return offset <= limit && length <= limit - offset;
+}
+
+
+static bool inBounds(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t limit) {
+    return count <= limit / elementSize && inBounds(offset, count * elementSize, limit);
+}
+
+
+// Query, target slot and argument count of a db statement
+static bool validQuery(const ProgramView& view, uint32_t first, size_t symbolCount) {
+    if (!inBounds(first, 3, view.constantCount) ||
+        view.constants[first].type != C_STRING ||
+        view.constants[first + 1].type != C_INT ||
+        view.constants[first + 2].type != C_INT) {
+        return false;
+    }
+    int64_t slot = view.constants[first + 1].integer;
+    return slot >= -1 && slot < static_cast<int64_t>(symbolCount) && view.constants[first + 2].integer >= 0;
+}
+
+
+// Every operand must stay inside its table and every instruction must find
+// its operands on the stack, which is empty again at OP_HALT. The code has
+// no jumps, so one pass tracks the depth exactly. A corrupt or foreign
+// entry is rejected instead of being executed.
+static bool validate(const ProgramView& view, size_t symbolCount) {
+    for (size_t i = 0; i < view.constantCount; ++i) {
+        const Constant& constant = view.constants[i];
+        if (constant.type > C_STRING) {
+            return false;
+        }
+        if (constant.type == C_STRING && !inBounds(constant.offset, constant.length, view.stringsSize)) {
+            return false;
+        }
+    }
+    if (view.codeSize == 0 || view.code[view.codeSize - 1].op != OP_HALT) {
+        return false;
+    }
+    uint64_t depth = 0;
+    for (size_t i = 0; i < view.codeSize; ++i) {
+        const Instruction& instruction = view.code[i];
+        uint64_t pops = 0;
+        uint64_t pushes = 0;
+        switch (instruction.op) {
+            case OP_TEXT:
+                if (instruction.arg >= view.constantCount || view.constants[instruction.arg].type != C_STRING) {
+                    return false;
+                }
+                break;
+            case OP_PUSH:
+                if (instruction.arg >= view.constantCount) {
+                    return false;
+                }
+                pushes = 1;
+                break;
+            case OP_LOAD:
+            case OP_STORE:
+            case OP_TAKE:
+                if (instruction.arg >= symbolCount) {
+                    return false;
+                }
+                pops = instruction.op == OP_STORE ? 1 : 0;
+                pushes = instruction.op == OP_STORE ? 0 : 1;
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+                pops = 2;
+                pushes = 1;
+                break;
+            case OP_CONCAT:
+                if (instruction.arg < 2) {
+                    return false;
+                }
+                pops = instruction.arg;
+                pushes = 1;
+                break;
+            case OP_ECHO:
+            case OP_WRITE:
+                pops = 1;
+                break;
+            case OP_DB:
+                if (!validQuery(view, instruction.arg, symbolCount)) {
+                    return false;
+                }
+                pops = static_cast<uint64_t>(view.constants[instruction.arg + 2].integer);
+                break;
+            case OP_DB_BATCH: {
+                if (instruction.arg >= view.constantCount || view.constants[instruction.arg].type != C_INT) {
+                    return false;
+                }
+                int64_t count = view.constants[instruction.arg].integer;
+                if (count < 1 || !inBounds(instruction.arg + 1, 3 * static_cast<uint64_t>(count), view.constantCount)) {
+                    return false;
+                }
+                for (int64_t i = 0; i < count; ++i) {
+                    uint32_t block = instruction.arg + 1 + 3 * static_cast<uint32_t>(i);
+                    if (!validQuery(view, block, symbolCount)) {
+                        return false;
+                    }
+                    // Each count is checked against the depth, so the sum cannot wrap
+                    uint64_t arguments = static_cast<uint64_t>(view.constants[block + 2].integer);
+                    if (arguments > depth - pops) {
+                        return false;
+                    }
+                    pops += arguments;
+                }
+                break;
+            }
+            case OP_HTTP:
+                if (!inBounds(instruction.arg, 5, view.constantCount) ||
+                    view.constants[instruction.arg].type != C_INT ||
+                    static_cast<uint64_t>(view.constants[instruction.arg].integer) >= symbolCount) {
+                    return false;
+                }
+                for (uint32_t argument = 1; argument < 5; ++argument) {
+                    if (view.constants[instruction.arg + argument].type != C_STRING) {
+                        return false;
+                    }
+                }
+                break;
+            case OP_HALT:
+                if (depth != 0) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+        if (pops > depth) {
+            return false;
+        }
+        depth = depth - pops + pushes;
+    }
+    return true;
+}
+
+
+bool TemplateCache::load(const CacheKey& key, MappedProgram& program) const {
+    int fd = open(entryPath(key).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    const char* base = static_cast<const char*>(data);
+    const CacheHeader* header = static_cast<const CacheHeader*>(data);
+    bool valid = std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+        && header->version == CACHE_VERSION
+        && header->byteOrder == BYTE_ORDER_MARK
+        && header->instructionSize == sizeof(Instruction)
+        && header->constantSize == sizeof(Constant)
+        && header->mtime == key.mtime
+        && header->size == key.size
+        && header->hash == key.hash
+        && header->optimized == (key.optimized ? 1 : 0)
+        && header->checksum == entryChecksum(*header, base, size)
+        && inBounds(header->pathOffset, header->pathLength, size)
+        && inBounds(header->codeOffset, header->codeCount, sizeof(Instruction), size)
+        && inBounds(header->constantsOffset, header->constantCount, sizeof(Constant), size)
+        && inBounds(header->symbolsOffset, header->symbolCount, sizeof(Constant), size)
+        && inBounds(header->stringsOffset, header->stringsSize, size)
+        && std::string_view(base + header->pathOffset, header->pathLength) == key.path;
+
+    ProgramView view;
+    if (valid) {
+        view.code = reinterpret_cast<const Instruction*>(base + header->codeOffset);
+        view.codeSize = header->codeCount;
+        view.constants = reinterpret_cast<const Constant*>(base + header->constantsOffset);
+        view.constantCount = header->constantCount;
+        view.strings = base + header->stringsOffset;
+        view.stringsSize = header->stringsSize;
+        valid = validate(view, header->symbolCount);
+    }
+
+    SymbolTable symbols;
+    const Constant* names = reinterpret_cast<const Constant*>(base + header->symbolsOffset);
+    for (uint64_t i = 0; valid && i < header->symbolCount; ++i) {
+        if (names[i].type != C_STRING || !inBounds(names[i].offset, names[i].length, view.stringsSize)) {
+            valid = false;
+            break;
+        }
+        symbols.slotFor(std::string(view.strings + names[i].offset, names[i].length));
+    }
+    if (!valid || symbols.names.size() != header->symbolCount) {
+        munmap(data, size);
+        return false;
+    }
+
+    program.data = data;
+    program.size = size;
+    program.programView = view;
+    program.symbolTable = std::move(symbols);
+    return true;
+}
+
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+
+bool TemplateCache::store(const CacheKey& key, const Program& program) const {
+    // Text referenced in the source is not in the program
+    if (program.source) {
+        return false;
+    }
+    // Slot names are appended to the program's string pool
+    std::string strings = program.strings;
+    std::vector<Constant> names;
+    for (const std::string& name : program.symbols.names) {
+        Constant constant{};
+        constant.type = C_STRING;
+        constant.offset = strings.size();
+        constant.length = static_cast<uint32_t>(name.size());
+        strings += name;
+        names.push_back(constant);
+    }
+
+    CacheHeader header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.instructionSize = sizeof(Instruction);
+    header.constantSize = sizeof(Constant);
+    header.mtime = key.mtime;
+    header.size = key.size;
+    header.hash = key.hash;
+    header.optimized = key.optimized ? 1 : 0;
+
+    uint64_t offset = align8(sizeof(CacheHeader));
+    header.codeOffset = offset;
+    header.codeCount = program.code.size();
+    offset = align8(offset + header.codeCount * sizeof(Instruction));
+    header.constantsOffset = offset;
+    header.constantCount = program.constants.size();
+    offset = align8(offset + header.constantCount * sizeof(Constant));
+    header.symbolsOffset = offset;
+    header.symbolCount = names.size();
+    offset = align8(offset + header.symbolCount * sizeof(Constant));
+    header.pathOffset = offset;
+    header.pathLength = key.path.size();
+    offset = align8(offset + header.pathLength);
+    header.stringsOffset = offset;
+    header.stringsSize = strings.size();
+
+    std::string image(offset + strings.size(), '\0');
+    std::memcpy(&image[header.codeOffset], program.code.data(), header.codeCount * sizeof(Instruction));
+    std::memcpy(&image[header.constantsOffset], program.constants.data(), header.constantCount * sizeof(Constant));
+    std::memcpy(&image[header.symbolsOffset], names.data(), header.symbolCount * sizeof(Constant));
+    std::memcpy(&image[header.pathOffset], key.path.data(), header.pathLength);
+    std::memcpy(&image[header.stringsOffset], strings.data(), strings.size());
+    header.checksum = entryChecksum(header, image.data(), image.size());
+    std::memcpy(&image[0], &header, sizeof(header));
+
+    // Write to a private file and rename it over the entry, so readers
+    // never see a partially written entry
+    mkdir(directory.c_str(), 0755);
+    std::string path = entryPath(key);
+    std::string temporary = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.write(image.data(), image.size())) {
+            std::cerr << "Unable to write cache entry: " << temporary << std::endl;
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "Unable to write cache entry: " << path << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
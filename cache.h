@@ -0,0 +1,64 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "compiler.h"
+#include "resolver.h"
+
+
+// Identity of a cached template: where it lives, what it contains and how
+// it was compiled
+struct CacheKey {
+    std::string path;
+    int64_t mtime = 0;
+    uint64_t size = 0;
+    uint64_t hash = 0;
+    bool optimized = true;
+};
+
+CacheKey makeCacheKey(const std::string& path, std::string_view source, bool optimized);
+// FNV-1a; pass the previous result as `hash` to continue it over more bytes
+uint64_t hashBytes(const char* data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL);
+
+
+// Compiled template mapped from a cache file; the view points into the mapping
+class MappedProgram {
+public:
+    MappedProgram() = default;
+    ~MappedProgram();
+    MappedProgram(const MappedProgram&) = delete;
+    MappedProgram& operator=(const MappedProgram&) = delete;
+
+    const ProgramView& view() const { return programView; }
+    const SymbolTable& symbols() const { return symbolTable; }
+
+private:
+    friend class TemplateCache;
+
+    void* data = nullptr;
+    size_t size = 0;
+    ProgramView programView;
+    SymbolTable symbolTable;
+};
+
+
+// TemplateCache class: directory with one compiled program per source path
+// and optimizer setting.
+// Entries are versioned, contain no pointers and are used in place via mmap.
+class TemplateCache {
+public:
+    explicit TemplateCache(const std::string& directory) : directory(directory) {}
+
+    bool load(const CacheKey& key, MappedProgram& program) const;
+    bool store(const CacheKey& key, const Program& program) const;
+
+private:
+    std::string entryPath(const CacheKey& key) const;
+
+    std::string directory;
+};
+
+#endif // CACHE_H
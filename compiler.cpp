@@ -0,0 +1,328 @@
+#include <functional>
+#include <iostream>
+
+#include "compiler.h"
+#include "memstats.h"
+#include "optimizer.h"
+
+
+Value ProgramView::value(uint32_t index) const {
+    const Constant& constant = constants[index];
+    switch (constant.type) {
+        case C_INT:
+            return constant.integer;
+        case C_FLOAT:
+            return constant.real;
+        case C_STRING:
+        case C_SOURCE:
+            return std::string(string(index));
+        default:
+            return Value{};
+    }
+}
+
+
+ProgramView Program::view() const {
+    ProgramView view;
+    view.code = code.data();
+    view.codeSize = code.size();
+    view.constants = constants.data();
+    view.constantCount = constants.size();
+    view.strings = strings.data();
+    view.stringsSize = strings.size();
+    view.source = source;
+    return view;
+}
+
+
+Program Compiler::compile(const Ast& ast, const SymbolTable& symbols) {
+    program = Program{};
+    program.symbols = symbols;
+    program.source = source.data();
+    constantIndex.clear();
+    for (size_t i = 0; i < ast.statements.size(); ++i) {
+        if (profiling) {
+            emit(OP_PROFILE, static_cast<uint32_t>(i));
+        }
+        // The profiler times statements one by one, so they are not batched
+        size_t batch = ast[ast.statements[i]].kind == N_DB && !profiling ? dbBatchLength(ast, i) : 1;
+        if (batch > 1) {
+            compileDatabaseBatch(ast, i, batch);
+            i += batch - 1;
+        } else {
+            compileStatement(ast, ast.statements[i]);
+        }
+    }
+    emit(OP_HALT);
+    return std::move(program);
+}
+
+
+void Compiler::compileStatement(const Ast& ast, NodeId id) {
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case N_TEXT:
+            compileText(node.text);
+            break;
+        case N_PRINT: {
+            // The operands of an echoed concatenation are written one by one
+            // and never joined; string literals go out as static text
+            std::vector<NodeId> operands;
+            concatOperands(ast, node.left, operands);
+            if (operands.size() < 2) {
+                compileExpression(ast, node.left);
+                emit(OP_ECHO);
+                break;
+            }
+            for (NodeId operand : operands) {
+                if (operand != NO_NODE && ast[operand].kind == N_STRING) {
+                    compileText(ast[operand].text);
+                } else {
+                    compileExpression(ast, operand);
+                    emit(OP_WRITE);
+                }
+            }
+            compileText("\n");
+            break;
+        }
+        case N_DB: {
+            int64_t count = 0;
+            for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+                compileExpression(ast, ast[argument].left);
+                count++;
+            }
+            emit(OP_DB, appendDatabaseQuery(ast, node, count));
+            break;
+        }
+        case N_HTTP: {
+            // Operands are read as a block, so they bypass constant deduplication
+            uint32_t first = appendConstant(static_cast<int64_t>(ast[node.left].slot));
+            for (NodeId argument = node.right; argument < node.right + 4; ++argument) {
+                appendConstant(std::string(ast[argument].text));
+            }
+            emit(OP_HTTP, first);
+            break;
+        }
+        case N_ASSIGNMENT: {
+            std::vector<NodeId> operands;
+            concatOperands(ast, node.right, operands);
+            if (isSelfAppend(ast, node, operands)) {
+                emit(OP_TAKE, ast[node.left].slot);
+                for (size_t i = 1; i < operands.size(); ++i) {
+                    compileExpression(ast, operands[i]);
+                }
+                emit(OP_CONCAT, static_cast<uint32_t>(operands.size()));
+            } else {
+                compileExpression(ast, node.right);
+            }
+            emit(OP_STORE, ast[node.left].slot);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+
+// Arguments of every statement first, then one instruction for the batch
+void Compiler::compileDatabaseBatch(const Ast& ast, size_t first, size_t count) {
+    std::vector<int64_t> argumentCounts(count, 0);
+    for (size_t i = 0; i < count; ++i) {
+        const Node& node = ast[ast.statements[first + i]];
+        for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+            compileExpression(ast, ast[argument].left);
+            argumentCounts[i]++;
+        }
+    }
+    uint32_t batch = appendConstant(static_cast<int64_t>(count));
+    for (size_t i = 0; i < count; ++i) {
+        appendDatabaseQuery(ast, ast[ast.statements[first + i]], argumentCounts[i]);
+    }
+    emit(OP_DB_BATCH, batch);
+}
+
+// Operands are read as a block, so they bypass constant deduplication
+uint32_t Compiler::appendDatabaseQuery(const Ast& ast, const Node& node, int64_t argumentCount) {
+    uint32_t first = appendConstant(std::string(node.text));
+    appendConstant(node.left != NO_NODE ? static_cast<int64_t>(ast[node.left].slot) : int64_t{-1});
+    appendConstant(argumentCount);
+    return first;
+}
+
+
+void Compiler::compileExpression(const Ast& ast, NodeId id) {
+    if (id == NO_NODE) {
+        emit(OP_PUSH, addConstant(std::monostate{}));
+        return;
+    }
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case N_TEXT:
+        case N_STRING:
+            emit(OP_PUSH, addConstant(std::string(node.text)));
+            break;
+        case N_VARIABLE:
+            emit(OP_LOAD, node.slot);
+            break;
+        case N_EXPRESSION: {
+            OpCode op;
+            switch (node.op) {
+                case '+': op = OP_ADD; break;
+                case '-': op = OP_SUB; break;
+                case '*': op = OP_MUL; break;
+                case '/': op = OP_DIV; break;
+                case '.': {
+                    std::vector<NodeId> operands;
+                    concatOperands(ast, id, operands);
+                    for (NodeId operand : operands) {
+                        compileExpression(ast, operand);
+                    }
+                    emit(OP_CONCAT, static_cast<uint32_t>(operands.size()));
+                    return;
+                }
+                default:
+                    emit(OP_PUSH, addConstant(std::monostate{}));
+                    return;
+            }
+            compileExpression(ast, node.left);
+            compileExpression(ast, node.right);
+            emit(op);
+            break;
+        }
+        case N_NUMBER:
+            emit(OP_PUSH, addConstant(numberValue(node)));
+            break;
+        default:
+            emit(OP_PUSH, addConstant(std::monostate{}));
+            break;
+    }
+}
+
+
+uint32_t Compiler::addConstant(Value value) {
+    auto it = constantIndex.find(value);
+    if (it != constantIndex.end()) {
+        return it->second;
+    }
+    uint32_t index = appendConstant(value);
+    constantIndex.emplace(std::move(value), index);
+    return index;
+}
+
+
+uint32_t Compiler::appendConstant(const Value& value) {
+    Constant constant{};
+    switch (value.index()) {
+        case 1:
+            constant.type = C_INT;
+            constant.integer = std::get<int64_t>(value);
+            break;
+        case 2:
+            constant.type = C_FLOAT;
+            constant.real = std::get<double>(value);
+            break;
+        case 3: {
+            const std::string& text = std::get<std::string>(value);
+            constant.type = C_STRING;
+            constant.offset = program.strings.size();
+            constant.length = static_cast<uint32_t>(text.size());
+            program.strings += text;
+            break;
+        }
+        default:
+            constant.type = C_NULL;
+            break;
+    }
+    program.constants.push_back(constant);
+    return static_cast<uint32_t>(program.constants.size() - 1);
+}
+
+
+// Static text referenced in the source when possible
+void Compiler::compileText(std::string_view text) {
+    emit(OP_TEXT, isSource(text) ? sourceConstant(text) : addConstant(std::string(text)));
+}
+
+
+bool Compiler::isSource(std::string_view text) const {
+    std::less_equal<const char*> notAfter;
+    return !source.empty() && notAfter(source.data(), text.data()) &&
+           notAfter(text.data() + text.size(), source.data() + source.size());
+}
+
+
+uint32_t Compiler::sourceConstant(std::string_view text) {
+    Constant constant{};
+    constant.type = C_SOURCE;
+    constant.offset = static_cast<uint64_t>(text.data() - source.data());
+    constant.length = static_cast<uint32_t>(text.size());
+    program.constants.push_back(constant);
+    return static_cast<uint32_t>(program.constants.size() - 1);
+}
+
+
+void Compiler::emit(OpCode op, uint32_t arg) {
+    program.code.push_back({op, arg});
+}
+
+
+Program compileTemplate(std::string_view source) {
+    MemStats::phase("tokenize");
+    Tokenizer tokenizer{source};
+    std::vector<Token> tokens = tokenizer.tokenize();
+    MemStats::phase("parse");
+    Parser parser(tokens, source);
+    Ast ast = parser.parse();
+    MemStats::phase("resolve");
+    Resolver resolver;
+    SymbolTable symbols = resolver.resolve(ast);
+    MemStats::phase("optimize");
+    Optimizer optimizer;
+    optimizer.optimize(ast, symbols);
+    MemStats::phase("compile");
+    Compiler compiler;
+    Program program = compiler.compile(ast, symbols);
+    MemStats::phase(nullptr);
+    return program;
+}
+
+
+// Функция для печати байткода
+void Compiler::printProgram(const ProgramView& program, const SymbolTable& symbols) {
+    static const char* names[] = {
+        "TEXT", "PUSH", "LOAD", "STORE", "TAKE", "ADD", "SUB", "MUL", "DIV", "CONCAT",
+        "ECHO", "WRITE", "DB", "DB_BATCH", "HTTP", "HALT", "PROFILE"
+    };
+    for (size_t i = 0; i < program.codeSize; ++i) {
+        const Instruction& instruction = program.code[i];
+        std::cout << i << ": " << names[instruction.op];
+        switch (instruction.op) {
+            case OP_PROFILE:
+            case OP_CONCAT:
+                std::cout << " " << instruction.arg;
+                break;
+            case OP_DB_BATCH: {
+                std::cout << " " << instruction.arg;
+                int64_t count = program.constants[instruction.arg].integer;
+                for (int64_t i = 0; i < count; ++i) {
+                    std::cout << " (" << toString(program.value(instruction.arg + 1 + 3 * static_cast<uint32_t>(i))) << ")";
+                }
+                break;
+            }
+            case OP_LOAD:
+            case OP_STORE:
+            case OP_TAKE:
+                std::cout << " " << instruction.arg << " (" << symbols.names[instruction.arg] << ")";
+                break;
+            case OP_TEXT:
+            case OP_PUSH:
+            case OP_DB:
+            case OP_HTTP:
+                std::cout << " " << instruction.arg << " (" << toString(program.value(instruction.arg)) << ")";
+                break;
+            default:
+                break;
+        }
+        std::cout << std::endl;
+    }
+}
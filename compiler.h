@@ -0,0 +1,139 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "parser.h"
+#include "resolver.h"
+#include "value.h"
+
+
+// Instruction set of the stack VM
+enum OpCode : uint8_t {
+    OP_TEXT,     // write constants[arg]
+    OP_PUSH,     // push constants[arg]
+    OP_LOAD,     // push the variable in frame slot arg
+    OP_STORE,    // pop into frame slot arg
+    OP_TAKE,     // like OP_LOAD, but moves the value out; an OP_STORE to the slot follows
+
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_CONCAT,   // pop arg operands, push their concatenation
+
+    OP_ECHO,     // pop and write with a newline
+    OP_WRITE,    // pop and write
+    OP_DB,       // constants[arg .. arg + 3]: query, target slot or -1 to print, argument count;
+                 // the arguments are on the stack
+    OP_DB_BATCH, // constants[arg]: statement count n, then an OP_DB block of three
+                 // constants for each; the arguments of all n are on the stack,
+                 // in order, and the queries go to the database in one batch
+    OP_HTTP,     // constants[arg .. arg + 4]: variable slot, url, data, header, type
+    OP_HALT,
+
+    OP_PROFILE   // statement arg starts; only in programs compiled for profiling,
+                 // which are never cached
+};
+
+
+struct Instruction {
+    OpCode op;
+    uint32_t arg;
+};
+
+
+enum ConstantType : uint8_t {
+    C_NULL,
+    C_INT,
+    C_FLOAT,
+    C_STRING,
+    C_SOURCE     // static text at offset in the template source; never cached
+};
+
+
+// Constant pool entry. Strings live in the string pool and are referenced
+// by offset, so a compiled program contains no pointers and can be stored
+// on disk and mapped back as is.
+struct Constant {
+    ConstantType type;
+    uint32_t length;
+    union {
+        int64_t integer;
+        double real;
+        uint64_t offset;
+    };
+};
+
+
+// Read-only view of a compiled program, over a Program or a mapped cache file
+struct ProgramView {
+    const Instruction* code = nullptr;
+    const Constant* constants = nullptr;
+    const char* strings = nullptr;
+    const char* source = nullptr;
+    size_t codeSize = 0;
+    size_t constantCount = 0;
+    size_t stringsSize = 0;
+
+    std::string_view string(uint32_t index) const {
+        const Constant& constant = constants[index];
+        return std::string_view((constant.type == C_SOURCE ? source : strings) + constant.offset, constant.length);
+    }
+    Value value(uint32_t index) const;
+};
+
+
+// Compiled program: flat code array, its constant pool and frame layout
+struct Program {
+    std::vector<Instruction> code;
+    std::vector<Constant> constants;
+    std::string strings;
+    SymbolTable symbols;
+    // Template source of C_SOURCE constants, see Compiler::setSource()
+    const char* source = nullptr;
+
+    ProgramView view() const;
+};
+
+
+// Compiler class: translates the output of Parser::parse() to bytecode
+class Compiler {
+public:
+    // Mark the start of every statement for the profiler
+    void setProfiling(bool enabled) { profiling = enabled; }
+    // Static text inside `text` is referenced rather than copied into the
+    // string pool; the source must outlive the program, which cannot be
+    // cached then
+    void setSource(std::string_view text) { source = text; }
+
+    Program compile(const Ast& ast, const SymbolTable& symbols);
+    static void printProgram(const ProgramView& program, const SymbolTable& symbols);
+
+private:
+    void compileStatement(const Ast& ast, NodeId id);
+    void compileDatabaseBatch(const Ast& ast, size_t first, size_t count);
+    uint32_t appendDatabaseQuery(const Ast& ast, const Node& node, int64_t argumentCount);
+    void compileExpression(const Ast& ast, NodeId id);
+    void compileText(std::string_view text);
+    uint32_t addConstant(Value value);
+    uint32_t appendConstant(const Value& value);
+    bool isSource(std::string_view text) const;
+    uint32_t sourceConstant(std::string_view text);
+    void emit(OpCode op, uint32_t arg = 0);
+
+    Program program;
+    std::unordered_map<Value, uint32_t> constantIndex;
+    bool profiling = false;
+    std::string_view source;
+};
+
+
+// Full pipeline for a template source: tokenize, parse, resolve, optimize and compile
+Program compileTemplate(std::string_view source);
+
+#endif // COMPILER_H
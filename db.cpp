@@ -0,0 +1,450 @@
+#include <chrono>
+#include <cctype>
+#include <iostream>
+
+#include "db.h"
+#include "memdb.h"
+
+
+std::string normalizeQuery(const std::string& query) {
+    std::string text;
+    text.reserve(query.size());
+    char quote = 0;
+    for (char c : query) {
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (!text.empty() && text.back() != ' ') {
+                text += ' ';
+            }
+            continue;
+        }
+        text += c;
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == ';')) {
+        text.pop_back();
+    }
+    return text;
+}
+
+bool isReadOnlyQuery(const std::string& query) {
+    size_t start = query.find_first_not_of(" \t\r\n(");
+    if (start == std::string::npos || query.size() - start < 6) {
+        return false;
+    }
+    static const char select[] = "select";
+    for (size_t i = 0; i < 6; ++i) {
+        if (std::tolower(static_cast<unsigned char>(query[start + i])) != select[i]) {
+            return false;
+        }
+    }
+    return query.size() == start + 6 || !std::isalnum(static_cast<unsigned char>(query[start + 6]));
+}
+
+
+DbStatement* DbConnection::prepareCached(const std::string& query, std::string& error) {
+    auto it = statements.find(query);
+    if (it != statements.end()) {
+        hits++;
+        return it->second.get();
+    }
+    misses++;
+    std::unique_ptr<DbStatement> statement = prepare(query, error);
+    if (!statement) {
+        return nullptr;
+    }
+    // Templates use a fixed set of queries; a flood of distinct ones
+    // only means the cache is useless, so start over
+    if (statements.size() >= MAX_CACHED_STATEMENTS) {
+        statements.clear();
+    }
+    return statements.emplace(query, std::move(statement)).first->second.get();
+}
+
+
+void DbConnection::executeBatch(const std::vector<DbQuery*>& queries) {
+    for (DbQuery* query : queries) {
+        DbStatement* statement = prepareCached(query->query, query->error);
+        query->ok = statement && statement->execute(query->params, query->result, query->error);
+    }
+}
+
+
+// The query text as the old shell `echo` printed it, trailing newline included
+class EchoStatement : public DbStatement {
+public:
+    explicit EchoStatement(const std::string& query) : text("Database query: " + query + "\n") {}
+
+    bool execute(const std::vector<Value>&, DbResult& result, std::string&) override {
+        result = DbResult{};
+        result.columns.push_back("query");
+        result.rows.push_back({text});
+        return true;
+    }
+
+private:
+    std::string text;
+};
+
+
+class EchoConnection : public DbConnection {
+protected:
+    std::unique_ptr<DbStatement> prepare(const std::string& query, std::string&) override {
+        return std::make_unique<EchoStatement>(query);
+    }
+};
+
+
+class EchoDriver : public DbDriver {
+public:
+    std::unique_ptr<DbConnection> connect(std::string&) override {
+        return std::make_unique<EchoConnection>();
+    }
+};
+
+
+// Statement of another connection, run through the tracing one. It is
+// looked up by query text on every run: the two statement caches are
+// cleared independently, so a pointer into the other one could dangle.
+class ForwardStatement : public DbStatement {
+public:
+    ForwardStatement(DbConnection& target, const std::string& query) : target(target), query(query) {}
+
+    bool execute(const std::vector<Value>& params, DbResult& result, std::string& error) override {
+        DbStatement* statement = target.prepareCached(query, error);
+        return statement && statement->execute(params, result, error);
+    }
+
+private:
+    DbConnection& target;
+    std::string query;
+};
+
+
+// Memory store that reports each round trip, to see batching at work
+class TraceConnection : public DbConnection {
+public:
+    explicit TraceConnection(std::unique_ptr<DbConnection> inner) : inner(std::move(inner)) {}
+
+    void executeBatch(const std::vector<DbQuery*>& queries) override {
+        std::cerr << "Database round trip: " << queries.size() << (queries.size() == 1 ? " query" : " queries") << std::endl;
+        DbConnection::executeBatch(queries);
+    }
+
+protected:
+    std::unique_ptr<DbStatement> prepare(const std::string& query, std::string& error) override {
+        // Prepared here so that errors surface at prepare time
+        return inner->prepareCached(query, error) ? std::make_unique<ForwardStatement>(*inner, query) : nullptr;
+    }
+
+private:
+    std::unique_ptr<DbConnection> inner;
+};
+
+
+class TraceDriver : public DbDriver {
+public:
+    std::unique_ptr<DbConnection> connect(std::string& error) override {
+        std::unique_ptr<DbConnection> inner = memory.connect(error);
+        return inner ? std::make_unique<TraceConnection>(std::move(inner)) : nullptr;
+    }
+
+private:
+    MemoryDriver memory;
+};
+
+
+static std::unordered_map<std::string, DbDriverFactory>& drivers() {
+    static std::unordered_map<std::string, DbDriverFactory> registry = {
+        {"memory", []() { return std::unique_ptr<DbDriver>(new MemoryDriver()); }},
+        {"echo", []() { return std::unique_ptr<DbDriver>(new EchoDriver()); }},
+        {"trace", []() { return std::unique_ptr<DbDriver>(new TraceDriver()); }}
+    };
+    return registry;
+}
+
+
+void registerDbDriver(const std::string& name, DbDriverFactory factory) {
+    drivers()[name] = std::move(factory);
+}
+
+
+std::unique_ptr<DbDriver> makeDbDriver(const std::string& name) {
+    auto it = drivers().find(name);
+    return it != drivers().end() ? it->second() : nullptr;
+}
+
+
+DbPool& DbPool::shared() {
+    static DbPool pool(makeDbDriver("memory"));
+    return pool;
+}
+
+
+DbPool::Lease::~Lease() {
+    if (pool && connection) {
+        pool->release(std::move(connection));
+    }
+}
+
+
+DbPool::Lease DbPool::acquire(std::string& error) {
+    std::unique_lock<std::mutex> lock(mutex);
+    available.wait(lock, [this]() { return !idle.empty() || open < maxConnections; });
+    if (!idle.empty()) {
+        std::unique_ptr<DbConnection> connection = std::move(idle.back());
+        idle.pop_back();
+        return Lease(this, std::move(connection));
+    }
+    open++;
+    lock.unlock();
+    std::unique_ptr<DbConnection> connection = driver->connect(error);
+    if (!connection) {
+        lock.lock();
+        open--;
+        available.notify_one();
+        return Lease();
+    }
+    return Lease(this, std::move(connection));
+}
+
+
+void DbPool::release(std::unique_ptr<DbConnection> connection) {
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(std::move(connection));
+    available.notify_one();
+}
+
+
+bool DbPool::execute(const std::string& query, const std::vector<Value>& params,
+                     DbResult& result, std::string& error) {
+    std::vector<DbQuery> queries(1);
+    queries[0].query = query;
+    queries[0].params = params;
+    executeBatch(queries);
+    result = std::move(queries[0].result);
+    error = std::move(queries[0].error);
+    return queries[0].ok;
+}
+
+
+// Parameters are part of the cache key, typed so that 1 and "1" differ
+static std::string cacheKey(const std::string& normalized, const std::vector<Value>& params) {
+    std::string key = normalized;
+    for (const Value& param : params) {
+        key += '\0';
+        key += static_cast<char>('0' + param.index());
+        appendTo(key, param);
+    }
+    return key;
+}
+
+
+// Called with cacheMutex held. Past the limit, new query texts share one
+// entry, so that a worker seeing endless distinct queries stays bounded
+DbPool::QueryStats& DbPool::statsFor(const std::string& name) {
+    auto it = perQuery.find(name);
+    if (it != perQuery.end()) {
+        return it->second;
+    }
+    return perQuery[perQuery.size() < MAX_QUERY_STATS ? name : OTHER_QUERIES];
+}
+
+
+// Reads before the first write of the batch may come from the cache; a
+// write clears it, and nothing read in a batch with a write is stored
+void DbPool::executeBatch(std::vector<DbQuery>& queries) {
+    std::vector<std::string> names(queries.size());
+    std::vector<std::string> keys(queries.size());
+    std::vector<bool> cached(queries.size(), false);
+    std::vector<DbQuery*> remote;
+    bool writes = false;
+    size_t startGeneration;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        startGeneration = generation;
+        for (size_t i = 0; i < queries.size(); ++i) {
+            DbQuery& query = queries[i];
+            names[i] = normalizeQuery(query.query);
+            QueryStats& stats = statsFor(names[i]);
+            stats.calls++;
+            counters.queries++;
+            if (!isReadOnlyQuery(names[i])) {
+                writes = true;
+            } else if (cache.getCapacity() > 0) {
+                keys[i] = cacheKey(names[i], query.params);
+                const DbResult* result = writes ? nullptr : cache.find(keys[i]);
+                if (result) {
+                    query.result = *result;
+                    query.ok = true;
+                    cached[i] = true;
+                    stats.cacheHits++;
+                    counters.cacheHits++;
+                    continue;
+                }
+                stats.cacheMisses++;
+                counters.cacheMisses++;
+            }
+            remote.push_back(&query);
+        }
+    }
+    if (remote.empty()) {
+        return;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    std::string error;
+    Lease connection = acquire(error);
+    if (connection) {
+        connection->executeBatch(remote);
+    } else {
+        for (DbQuery* query : remote) {
+            query->error = error;
+            query->ok = false;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    counters.roundTrips++;
+    if (writes) {
+        cache.clear();
+        generation++;
+    }
+    for (size_t i = 0; i < queries.size(); ++i) {
+        if (cached[i]) {
+            continue;
+        }
+        QueryStats& stats = statsFor(names[i]);
+        stats.seconds += seconds;
+        stats.maxSeconds = std::max(stats.maxSeconds, seconds);
+        if (!queries[i].ok) {
+            stats.errors++;
+        } else if (!keys[i].empty() && !writes && generation == startGeneration) {
+            cache.store(keys[i], queries[i].result);
+        }
+    }
+}
+
+
+void DbPool::setCacheCapacity(size_t bytes) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cache.setCapacity(bytes);
+}
+
+void DbPool::invalidateCache() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cache.clear();
+    generation++;
+}
+
+
+DbPool::Stats DbPool::stats() const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    Stats current = counters;
+    current.evictions = cache.evictions();
+    current.cachedResults = cache.size();
+    current.cachedBytes = cache.bytes();
+    return current;
+}
+
+std::vector<std::pair<std::string, DbPool::QueryStats>> DbPool::queryStats() const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return std::vector<std::pair<std::string, QueryStats>>(perQuery.begin(), perQuery.end());
+}
+
+
+// Rough heap size of a result, for the cache capacity
+static size_t resultBytes(const DbResult& result) {
+    size_t bytes = sizeof(DbResult);
+    for (const std::string& column : result.columns) {
+        bytes += sizeof(std::string) + column.size();
+    }
+    for (const std::vector<Value>& row : result.rows) {
+        bytes += sizeof(row);
+        for (const Value& value : row) {
+            bytes += sizeof(Value);
+            if (const std::string* text = std::get_if<std::string>(&value)) {
+                bytes += text->size();
+            }
+        }
+    }
+    return bytes;
+}
+
+
+void DbResultCache::setCapacity(size_t bytes) {
+    capacity = bytes;
+    evict();
+}
+
+const DbResult* DbResultCache::find(const std::string& key) {
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return nullptr;
+    }
+    order.splice(order.begin(), order, it->second.recent);
+    return &it->second.result;
+}
+
+void DbResultCache::store(const std::string& key, const DbResult& result) {
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        used -= it->second.bytes;
+        order.erase(it->second.recent);
+        entries.erase(it);
+    }
+    order.push_front(key);
+    Entry entry{result, key.size() + resultBytes(result), order.begin()};
+    used += entry.bytes;
+    entries.emplace(key, std::move(entry));
+    evict();
+}
+
+void DbResultCache::clear() {
+    entries.clear();
+    order.clear();
+    used = 0;
+}
+
+void DbResultCache::evict() {
+    while (used > capacity && !order.empty()) {
+        auto it = entries.find(order.back());
+        used -= it->second.bytes;
+        entries.erase(it);
+        order.pop_back();
+        evicted++;
+    }
+}
+
+
+// Statements are separated by ';' outside of quoted strings
+bool DbPool::executeScript(const std::string& script, std::string& error) {
+    std::string statement;
+    char quote = 0;
+    for (size_t i = 0; i <= script.size(); ++i) {
+        char c = i < script.size() ? script[i] : ';';
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == ';') {
+            if (statement.find_first_not_of(" \t\r\n") != std::string::npos) {
+                DbResult result;
+                if (!execute(statement, {}, result, error)) {
+                    return false;
+                }
+            }
+            statement.clear();
+            continue;
+        }
+        statement += c;
+    }
+    return true;
+}
@@ -0,0 +1,222 @@
+#ifndef DB_H
+#define DB_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "value.h"
+
+
+// Rows returned by a query; statements without rows only set affected
+struct DbResult {
+    std::vector<std::string> columns;
+    std::vector<std::vector<Value>> rows;
+    size_t affected = 0;
+};
+
+
+// One query of a batch with its outcome
+struct DbQuery {
+    std::string query;
+    std::vector<Value> params;
+    DbResult result;
+    std::string error;
+    bool ok = false;
+};
+
+
+// Query text with runs of whitespace outside quotes collapsed to one space
+// and no trailing ';', the key of cached results and query statistics
+std::string normalizeQuery(const std::string& query);
+// SELECT statements only read; everything else may write
+bool isReadOnlyQuery(const std::string& query);
+
+
+// Prepared statement; '?' placeholders are bound positionally on every run
+class DbStatement {
+public:
+    virtual ~DbStatement() = default;
+    virtual bool execute(const std::vector<Value>& params, DbResult& result, std::string& error) = 0;
+};
+
+
+// Connection to a backend. Statements are prepared once per query text
+// and kept for the lifetime of the connection.
+class DbConnection {
+public:
+    static const size_t MAX_CACHED_STATEMENTS = 256;
+
+    virtual ~DbConnection() = default;
+
+    DbStatement* prepareCached(const std::string& query, std::string& error);
+    // Run the queries in order as one round trip. A backend behind a
+    // network pipelines them; the default runs them one by one.
+    virtual void executeBatch(const std::vector<DbQuery*>& queries);
+    size_t cacheHits() const { return hits; }
+    size_t cacheMisses() const { return misses; }
+
+protected:
+    virtual std::unique_ptr<DbStatement> prepare(const std::string& query, std::string& error) = 0;
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<DbStatement>> statements;
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+
+// Backend that opens connections
+class DbDriver {
+public:
+    virtual ~DbDriver() = default;
+    virtual std::unique_ptr<DbConnection> connect(std::string& error) = 0;
+};
+
+using DbDriverFactory = std::function<std::unique_ptr<DbDriver>()>;
+
+// Drivers by name: "memory" (built-in table store, the default), "echo"
+// (prints the query text, the old behaviour) and "trace" (the memory store,
+// reporting every round trip on stderr). Others can be added.
+void registerDbDriver(const std::string& name, DbDriverFactory factory);
+std::unique_ptr<DbDriver> makeDbDriver(const std::string& name);
+
+
+// Results of read-only queries by normalized query text and parameters,
+// least recently used first out once the size estimate exceeds the
+// capacity. Not synchronized; DbPool guards it.
+class DbResultCache {
+public:
+    explicit DbResultCache(size_t capacity = 0) : capacity(capacity) {}
+
+    void setCapacity(size_t bytes);
+    size_t getCapacity() const { return capacity; }
+    const DbResult* find(const std::string& key);
+    void store(const std::string& key, const DbResult& result);
+    void clear();
+
+    size_t size() const { return order.size(); }
+    size_t bytes() const { return used; }
+    size_t evictions() const { return evicted; }
+
+private:
+    struct Entry {
+        DbResult result;
+        size_t bytes;
+        std::list<std::string>::iterator recent;
+    };
+
+    void evict();
+
+    size_t capacity;
+    size_t used = 0;
+    size_t evicted = 0;
+    std::unordered_map<std::string, Entry> entries;
+    // Keys, most recently used first
+    std::list<std::string> order;
+};
+
+
+// DbPool class: connections shared by all renders of a process. At most
+// maxConnections are open; acquire() waits for one to be returned.
+// Results of read-only queries are cached when a cache capacity is set;
+// any other statement run through the pool clears the cache.
+class DbPool {
+public:
+    static const size_t DEFAULT_MAX_CONNECTIONS = 8;
+    // Distinct query texts with statistics of their own; the rest are
+    // counted together under OTHER_QUERIES
+    static const size_t MAX_QUERY_STATS = 256;
+    static constexpr const char* OTHER_QUERIES = "(other queries)";
+
+    // Per normalized query text
+    struct QueryStats {
+        size_t calls = 0;
+        size_t cacheHits = 0;
+        size_t cacheMisses = 0;
+        size_t errors = 0;
+        double seconds = 0;       // waited for round trips, cache hits count as 0
+        double maxSeconds = 0;
+    };
+
+    struct Stats {
+        size_t roundTrips = 0;
+        size_t queries = 0;
+        size_t cacheHits = 0;
+        size_t cacheMisses = 0;
+        size_t evictions = 0;
+        size_t cachedResults = 0;
+        size_t cachedBytes = 0;
+    };
+
+    explicit DbPool(std::unique_ptr<DbDriver> driver, size_t maxConnections = DEFAULT_MAX_CONNECTIONS)
+        : driver(std::move(driver)), maxConnections(maxConnections) {}
+
+    // Pool over the default driver, used when no other pool is given
+    static DbPool& shared();
+
+    // Connection borrowed from the pool, returned when the lease goes away
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(DbPool* pool, std::unique_ptr<DbConnection> connection)
+            : pool(pool), connection(std::move(connection)) {}
+        Lease(Lease&& other) = default;
+        Lease& operator=(Lease&& other) = delete;
+        ~Lease();
+
+        DbConnection* operator->() const { return connection.get(); }
+        explicit operator bool() const { return connection != nullptr; }
+
+    private:
+        DbPool* pool = nullptr;
+        std::unique_ptr<DbConnection> connection;
+    };
+
+    Lease acquire(std::string& error);
+
+    // Run a query on a pooled connection
+    bool execute(const std::string& query, const std::vector<Value>& params,
+                 DbResult& result, std::string& error);
+    // Run queries in order; those not answered from the cache go to one
+    // connection as a single round trip
+    void executeBatch(std::vector<DbQuery>& queries);
+    // Run every statement of a script, for loading fixtures
+    bool executeScript(const std::string& script, std::string& error);
+
+    // 0, the default, turns the result cache off
+    void setCacheCapacity(size_t bytes);
+    // Drop every cached result, for data changed behind the pool's back
+    void invalidateCache();
+
+    Stats stats() const;
+    std::vector<std::pair<std::string, QueryStats>> queryStats() const;
+
+private:
+    void release(std::unique_ptr<DbConnection> connection);
+    QueryStats& statsFor(const std::string& name);
+
+    std::unique_ptr<DbDriver> driver;
+    size_t maxConnections;
+    size_t open = 0;
+    std::vector<std::unique_ptr<DbConnection>> idle;
+    std::mutex mutex;
+    std::condition_variable available;
+
+    // Cache and statistics have their own lock, held only briefly
+    mutable std::mutex cacheMutex;
+    DbResultCache cache;
+    // Bumped by every invalidation; results read across one are not stored
+    size_t generation = 0;
+    Stats counters;
+    std::unordered_map<std::string, QueryStats> perQuery;
+};
+
+#endif // DB_H
@@ -0,0 +1,337 @@
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "emitter.h"
+
+
+// C++ string literal for arbitrary bytes, split into lines after each
+// newline and every 96 bytes. Other than printable ASCII, bytes are
+// written as three-digit octal escapes, which cannot run into the next
+// character.
+static std::string stringLiteral(std::string_view text) {
+    std::string literal = "\"";
+    size_t lineLength = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c == '\n') {
+            literal += "\\n";
+        } else if (c == '"' || c == '\\') {
+            literal += '\\';
+            literal += static_cast<char>(c);
+        } else if (c >= 0x20 && c < 0x7f) {
+            literal += static_cast<char>(c);
+        } else {
+            literal += '\\';
+            literal += static_cast<char>('0' + (c >> 6));
+            literal += static_cast<char>('0' + ((c >> 3) & 7));
+            literal += static_cast<char>('0' + (c & 7));
+        }
+        if ((c == '\n' || ++lineLength >= 96) && i + 1 < text.size()) {
+            literal += "\"\n    \"";
+            lineLength = 0;
+        }
+    }
+    literal += '"';
+    return literal;
+}
+
+// Exact C++ literal of an int or float constant
+static std::string numberLiteral(const Node& node) {
+    if (!node.isFloat) {
+        return node.integer == INT64_MIN ? "INT64_MIN" : "int64_t{" + std::to_string(node.integer) + "}";
+    }
+    double value = node.real;
+    std::string sign = std::signbit(value) ? "-" : "";
+    if (std::isnan(value)) {
+        return "std::numeric_limits<double>::quiet_NaN()";
+    }
+    if (std::isinf(value)) {
+        return sign + "std::numeric_limits<double>::infinity()";
+    }
+    char buffer[32];
+    std::to_chars_result written = std::to_chars(buffer, buffer + sizeof(buffer), std::fabs(value), std::chars_format::hex);
+    return sign + "0x" + std::string(buffer, written.ptr);
+}
+
+
+void CppEmitter::emit(const Ast& ast, const SymbolTable& symbols, const std::string& sourceName, std::ostream& out) {
+    size_t slots = symbols.names.size();
+    inFrame.assign(slots, false);
+    assigned.assign(slots, false);
+    types.assign(slots, T_UNKNOWN);
+    // The runtime binds db and http results to frame slots
+    for (NodeId id : ast.statements) {
+        const Node& node = ast[id];
+        if ((node.kind == N_DB || node.kind == N_HTTP) && node.left != NO_NODE) {
+            inFrame[ast[node.left].slot] = true;
+        }
+    }
+
+    for (size_t i = 0; i < ast.statements.size(); ++i) {
+        size_t batch = ast[ast.statements[i]].kind == N_DB ? dbBatchLength(ast, i) : 1;
+        if (batch > 1) {
+            emitDatabaseBatch(ast, i, batch);
+            i += batch - 1;
+        } else {
+            emitStatement(ast, ast.statements[i]);
+        }
+    }
+
+    out << "// Generated by php --emit-cpp from " << sourceName << "; do not edit\n"
+        << "#include <cstdint>\n#include <limits>\n#include <string>\n\n#include \"native.h\"\n\n\n"
+        << "namespace {\n\n" << declarations << "const char* const NAMES[] = {";
+    for (const std::string& name : symbols.names) {
+        out << stringLiteral(name) << ", ";
+    }
+    out << "nullptr};\n\n\nvoid render(Runtime& runtime) {\n    OutputBuffer& out = runtime.output();\n";
+    for (uint32_t slot = 0; slot < slots; ++slot) {
+        if (!inFrame[slot]) {
+            out << "    Value local_" << slot << ";    // " << symbols.names[slot] << "\n";
+        }
+    }
+    out << "\n" << body;
+    // Locals end up in the frame, for --dump-vars
+    for (uint32_t slot = 0; slot < slots; ++slot) {
+        if (!inFrame[slot] && assigned[slot]) {
+            out << "    runtime.storeVariable(" << slot << ", std::move(local_" << slot << "));\n";
+        }
+    }
+    out << "    (void)out;\n}\n\n}  // namespace\n\n\n"
+        << "int main(int argc, char* argv[]) {\n"
+        << "    return runNativeTemplate({NAMES, " << slots << ", render}, argc, argv);\n}\n";
+}
+
+
+void CppEmitter::emitStatement(const Ast& ast, NodeId id) {
+    const Node& node = ast[id];
+    statement.clear();
+    switch (node.kind) {
+        case N_TEXT:
+            if (!node.text.empty()) {
+                std::string text = staticText(node.text);
+                line("out.writeStatic(std::string_view(" + text + ", sizeof(" + text + ") - 1));");
+            }
+            break;
+        case N_PRINT: {
+            // Operands of an echoed concatenation are written without joining them
+            std::vector<NodeId> operands;
+            concatOperands(ast, node.left, operands);
+            for (NodeId operand : operands) {
+                if (operand != NO_NODE && ast[operand].kind == N_STRING) {
+                    if (!ast[operand].text.empty()) {
+                        std::string text = staticText(ast[operand].text);
+                        line("out.writeStatic(std::string_view(" + text + ", sizeof(" + text + ") - 1));");
+                    }
+                } else {
+                    line("runtime.writeValue(" + emitExpression(ast, operand).text + ");");
+                }
+            }
+            line("out.write(\"\\n\");");
+            break;
+        }
+        case N_DB: {
+            std::string params;
+            for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+                params += (params.empty() ? "" : ", ") + emitExpression(ast, ast[argument].left).text;
+            }
+            std::string slot = node.left != NO_NODE ? std::to_string(ast[node.left].slot) : "Runtime::NO_SLOT";
+            line("runtime.databaseQuery(" + slot + ", " + stringConstant(node.text) + ", {" + params + "});");
+            break;
+        }
+        case N_HTTP: {
+            std::string arguments = std::to_string(ast[node.left].slot);
+            for (NodeId argument = node.right; argument < node.right + 4; ++argument) {
+                arguments += ", " + stringConstant(ast[argument].text);
+            }
+            line("runtime.httpRequest(" + arguments + ");");
+            break;
+        }
+        case N_ASSIGNMENT: {
+            uint32_t slot = ast[node.left].slot;
+            std::vector<NodeId> operands;
+            concatOperands(ast, node.right, operands);
+            std::string value;
+            Type type = T_STRING;
+            if (isSelfAppend(ast, node, operands)) {
+                // The string is moved out, appended to and stored back
+                Code first;
+                if (inFrame[slot]) {
+                    first = {hoist("Value", "runtime.takeVariable(" + std::to_string(slot) + ")"), T_UNKNOWN, true, ""};
+                } else if (!assigned[slot]) {
+                    first = emitLoad(slot);
+                } else {
+                    first = {"local_" + std::to_string(slot), types[slot], true, ""};
+                }
+                value = "concat(" + moved(first);
+                for (size_t i = 1; i < operands.size(); ++i) {
+                    value += ", " + moved(emitExpression(ast, operands[i]));
+                }
+                value += ")";
+            } else {
+                Code code = emitExpression(ast, node.right);
+                value = moved(code);
+                type = code.type;
+            }
+            if (inFrame[slot]) {
+                line("runtime.storeVariable(" + std::to_string(slot) + ", " + value + ");");
+            } else {
+                line("local_" + std::to_string(slot) + " = " + value + ";");
+                assigned[slot] = true;
+                types[slot] = type;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (statement.size() == 1) {
+        body += "    " + statement[0] + "\n";
+    } else if (!statement.empty()) {
+        body += "    {\n";
+        for (const std::string& text : statement) {
+            body += "        " + text + "\n";
+        }
+        body += "    }\n";
+    }
+}
+
+
+// Consecutive independent db statements share one round trip
+void CppEmitter::emitDatabaseBatch(const Ast& ast, size_t first, size_t count) {
+    statement.clear();
+    std::vector<std::string> queries(count);
+    std::string slots;
+    for (size_t i = 0; i < count; ++i) {
+        const Node& node = ast[ast.statements[first + i]];
+        std::string params;
+        for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+            params += (params.empty() ? "" : ", ") + emitExpression(ast, ast[argument].left).text;
+        }
+        std::string index = "queries[" + std::to_string(i) + "]";
+        queries[i] = index + ".query = " + stringConstant(node.text) + "; " + index + ".params = {" + params + "};";
+        slots += (i ? ", " : "") + (node.left != NO_NODE ? std::to_string(ast[node.left].slot) : "Runtime::NO_SLOT");
+    }
+    line("std::vector<DbQuery> queries(" + std::to_string(count) + ");");
+    for (const std::string& query : queries) {
+        line(query);
+    }
+    line("const uint32_t slots[] = {" + slots + "};");
+    line("runtime.databaseQueries(queries, slots);");
+
+    body += "    {\n";
+    for (const std::string& text : statement) {
+        body += "        " + text + "\n";
+    }
+    body += "    }\n";
+}
+
+
+// Every intermediate result gets a named temporary, so side effects
+// (warnings, waiting for http results) happen in the interpreter's order
+CppEmitter::Code CppEmitter::emitExpression(const Ast& ast, NodeId id) {
+    if (id == NO_NODE) {
+        return {"Value{}", T_NULL, false, ""};
+    }
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case N_TEXT:
+        case N_STRING:
+            return {constant(node), T_STRING, false, ""};
+        case N_NUMBER:
+            return {constant(node), node.isFloat ? T_FLOAT : T_INT, false, numberLiteral(node)};
+        case N_VARIABLE:
+            return emitLoad(node.slot);
+        case N_EXPRESSION: {
+            if (node.op == '.') {
+                std::vector<NodeId> operands;
+                concatOperands(ast, id, operands);
+                std::string parts;
+                for (NodeId operand : operands) {
+                    parts += (parts.empty() ? "" : ", ") + moved(emitExpression(ast, operand));
+                }
+                return {hoist("Value", "concat(" + parts + ")"), T_STRING, true, ""};
+            }
+            Code left = emitExpression(ast, node.left);
+            Code right = emitExpression(ast, node.right);
+            return emitArithmetic(node.op, left, right);
+        }
+        default:
+            return {"Value{}", T_NULL, false, ""};
+    }
+}
+
+CppEmitter::Code CppEmitter::emitLoad(uint32_t slot) {
+    if (inFrame[slot] || !assigned[slot]) {
+        // An unset local is read through the frame too, which warns and gives null
+        return {hoist("const Value&", "runtime.loadVariable(" + std::to_string(slot) + ")"),
+                inFrame[slot] ? T_UNKNOWN : T_NULL, false, ""};
+    }
+    return {"local_" + std::to_string(slot), types[slot], false, ""};
+}
+
+// Ints stay exact until they overflow, so int arithmetic only knows that
+// the result is a number; anything with a float operand is a float
+CppEmitter::Code CppEmitter::emitArithmetic(char op, const Code& left, const Code& right) {
+    std::string quoted = std::string("'") + op + "'";
+    bool numbers = (left.type == T_INT || left.type == T_FLOAT) && (right.type == T_INT || right.type == T_FLOAT);
+    if (numbers && left.type == T_INT && right.type == T_INT) {
+        return {hoist("Value", "integerOperation(" + quoted + ", " + native(left, T_INT) + ", " + native(right, T_INT) + ")"),
+                T_UNKNOWN, true, ""};
+    }
+    if (numbers) {
+        return {hoist("Value", "floatOperation(" + quoted + ", " + native(left, T_FLOAT) + ", " + native(right, T_FLOAT) + ")"),
+                T_FLOAT, true, ""};
+    }
+    return {hoist("Value", "binaryOperation(" + quoted + ", " + left.text + ", " + right.text + ")"), T_UNKNOWN, true, ""};
+}
+
+std::string CppEmitter::hoist(const char* type, const std::string& text) {
+    std::string name = "t" + std::to_string(temporaryCount++);
+    statement.push_back(std::string(type) + " " + name + " = " + text + ";");
+    return name;
+}
+
+std::string CppEmitter::staticText(std::string_view text) {
+    std::string name = "TEXT_" + std::to_string(textCount++);
+    declarations += "const char " + name + "[] =\n    " + stringLiteral(text) + ";\n";
+    return name;
+}
+
+std::string CppEmitter::constant(const Node& node) {
+    std::string name = "CONSTANT_" + std::to_string(constantCount++);
+    if (node.kind == N_NUMBER) {
+        declarations += "const Value " + name + " = " + numberLiteral(node) + ";\n";
+    } else {
+        declarations += "const Value " + name + " = std::string(" + stringLiteral(node.text) + ", " +
+                        std::to_string(node.text.size()) + ");\n";
+    }
+    return name;
+}
+
+std::string CppEmitter::stringConstant(std::string_view text) {
+    std::string name = "CONSTANT_" + std::to_string(constantCount++);
+    declarations += "const std::string " + name + "(" + stringLiteral(text) + ", " + std::to_string(text.size()) + ");\n";
+    return name;
+}
+
+// The value of a numeric operand as an int64_t or double expression
+std::string CppEmitter::native(const Code& code, Type as) {
+    std::string value;
+    if (!code.literal.empty()) {
+        value = code.literal;
+    } else {
+        value = code.type == T_INT ? "std::get<int64_t>(" + code.text + ")" : "std::get<double>(" + code.text + ")";
+    }
+    return as == T_FLOAT && code.type == T_INT ? "static_cast<double>(" + value + ")" : value;
+}
+
+std::string CppEmitter::moved(const Code& code) {
+    return code.temporary ? "std::move(" + code.text + ")" : code.text;
+}
+
+void CppEmitter::line(const std::string& text) {
+    statement.push_back(text);
+}
@@ -0,0 +1,72 @@
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parser.h"
+#include "resolver.h"
+
+
+// CppEmitter class: translates the output of Parser::parse() to a C++
+// translation unit that renders the template when linked against the
+// runtime library (make native). Static text becomes constant byte
+// arrays, variables become locals, and expressions on operands of a known
+// type call the arithmetic for that type directly. Variables bound by db
+// and http statements stay in the runtime frame, which resolves them.
+class CppEmitter {
+public:
+    void emit(const Ast& ast, const SymbolTable& symbols, const std::string& sourceName, std::ostream& out);
+
+private:
+    // What is statically known about a value
+    enum Type : uint8_t {
+        T_UNKNOWN,
+        T_NULL,
+        T_INT,
+        T_FLOAT,
+        T_STRING
+    };
+
+    // A C++ expression of type Value; a temporary may be moved from, as it
+    // is used once
+    struct Code {
+        std::string text;
+        Type type = T_UNKNOWN;
+        bool temporary = false;
+        // int64_t or double literal for a numeric constant
+        std::string literal;
+    };
+
+    void emitStatement(const Ast& ast, NodeId id);
+    void emitDatabaseBatch(const Ast& ast, size_t first, size_t count);
+    Code emitExpression(const Ast& ast, NodeId id);
+    Code emitLoad(uint32_t slot);
+    Code emitArithmetic(char op, const Code& left, const Code& right);
+    std::string hoist(const char* type, const std::string& text);
+    std::string staticText(std::string_view text);
+    std::string constant(const Node& node);
+    std::string stringConstant(std::string_view text);
+    static std::string native(const Code& code, Type as);
+    static std::string moved(const Code& code);
+    void line(const std::string& text);
+
+    // Declarations at namespace scope, and the body of render()
+    std::string declarations;
+    std::string body;
+    std::vector<std::string> statement;
+    uint32_t textCount = 0;
+    uint32_t constantCount = 0;
+    uint32_t temporaryCount = 0;
+
+    // Per slot: kept in the runtime frame, assigned yet, type after the
+    // statements emitted so far
+    std::vector<bool> inFrame;
+    std::vector<bool> assigned;
+    std::vector<Type> types;
+};
+
+#endif // EMITTER_H
@@ -0,0 +1,188 @@
+#include <array>
+#include <vector>
+
+#include "fcgi.h"
+
+
+bool parseRecord(std::string_view data, FcgiRecord& record, size_t& size) {
+    size = 0;
+    if (data.empty() || static_cast<unsigned char>(data[0]) != FCGI_VERSION_1) {
+        return data.empty();
+    }
+    if (data.size() < 8) {
+        return true;
+    }
+    const unsigned char* header = reinterpret_cast<const unsigned char*>(data.data());
+    size_t contentLength = (static_cast<size_t>(header[4]) << 8) | header[5];
+    size_t total = 8 + contentLength + header[6];
+    if (data.size() < total) {
+        return true;
+    }
+    record.type = header[1];
+    record.requestId = static_cast<uint16_t>((header[2] << 8) | header[3]);
+    record.content.assign(data.data() + 8, contentLength);
+    size = total;
+    return true;
+}
+
+
+bool readRecord(int fd, FcgiRecord& record) {
+    unsigned char header[8];
+    if (!readFully(fd, reinterpret_cast<char*>(header), sizeof(header)) || header[0] != FCGI_VERSION_1) {
+        return false;
+    }
+    record.type = header[1];
+    record.requestId = static_cast<uint16_t>((header[2] << 8) | header[3]);
+    size_t contentLength = (static_cast<size_t>(header[4]) << 8) | header[5];
+    size_t paddingLength = header[6];
+    record.content.resize(contentLength);
+    if (contentLength > 0 && !readFully(fd, &record.content[0], contentLength)) {
+        return false;
+    }
+    char padding[256];
+    return paddingLength == 0 || readFully(fd, padding, paddingLength);
+}
+
+
+void appendRecord(std::string& out, uint8_t type, uint16_t requestId, std::string_view content) {
+    do {
+        size_t length = content.size() < FCGI_MAX_CONTENT ? content.size() : FCGI_MAX_CONTENT;
+        size_t padding = (8 - length % 8) % 8;
+        char header[8] = {
+            static_cast<char>(FCGI_VERSION_1), static_cast<char>(type),
+            static_cast<char>(requestId >> 8), static_cast<char>(requestId & 0xff),
+            static_cast<char>(length >> 8), static_cast<char>(length & 0xff),
+            static_cast<char>(padding), 0
+        };
+        out.append(header, sizeof(header));
+        out.append(content.data(), length);
+        out.append(padding, '\0');
+        content.remove_prefix(length);
+    } while (!content.empty());
+}
+
+
+bool writeRecord(int fd, uint8_t type, uint16_t requestId, const char* data, size_t size) {
+    std::string out;
+    appendRecord(out, type, requestId, std::string_view(data, size));
+    return writeFully(fd, out.data(), out.size());
+}
+
+
+void appendEndRequest(std::string& out, uint16_t requestId, uint32_t appStatus, uint8_t protocolStatus) {
+    char body[8] = {
+        static_cast<char>(appStatus >> 24), static_cast<char>((appStatus >> 16) & 0xff),
+        static_cast<char>((appStatus >> 8) & 0xff), static_cast<char>(appStatus & 0xff),
+        static_cast<char>(protocolStatus), 0, 0, 0
+    };
+    appendRecord(out, FCGI_END_REQUEST, requestId, std::string_view(body, sizeof(body)));
+}
+
+
+bool writeEndRequest(int fd, uint16_t requestId, uint32_t appStatus, uint8_t protocolStatus) {
+    std::string out;
+    appendEndRequest(out, requestId, appStatus, protocolStatus);
+    return writeFully(fd, out.data(), out.size());
+}
+
+
+static void encodeLength(std::string& out, size_t length) {
+    if (length < 128) {
+        out += static_cast<char>(length);
+    } else {
+        out += static_cast<char>(((length >> 24) & 0x7f) | 0x80);
+        out += static_cast<char>((length >> 16) & 0xff);
+        out += static_cast<char>((length >> 8) & 0xff);
+        out += static_cast<char>(length & 0xff);
+    }
+}
+
+
+void encodeParam(std::string& out, std::string_view name, std::string_view value) {
+    encodeLength(out, name.size());
+    encodeLength(out, value.size());
+    out.append(name.data(), name.size());
+    out.append(value.data(), value.size());
+}
+
+
+static bool decodeLength(std::string_view& data, size_t& length) {
+    if (data.empty()) {
+        return false;
+    }
+    unsigned char first = static_cast<unsigned char>(data[0]);
+    if (first < 128) {
+        length = first;
+        data.remove_prefix(1);
+        return true;
+    }
+    if (data.size() < 4) {
+        return false;
+    }
+    length = (static_cast<size_t>(first & 0x7f) << 24)
+        | (static_cast<size_t>(static_cast<unsigned char>(data[1])) << 16)
+        | (static_cast<size_t>(static_cast<unsigned char>(data[2])) << 8)
+        | static_cast<size_t>(static_cast<unsigned char>(data[3]));
+    data.remove_prefix(4);
+    return true;
+}
+
+
+bool decodeParams(std::string_view data, FcgiParams& params) {
+    while (!data.empty()) {
+        size_t nameLength, valueLength;
+        if (!decodeLength(data, nameLength) || !decodeLength(data, valueLength) ||
+            nameLength + valueLength > data.size()) {
+            return false;
+        }
+        std::string name(data.substr(0, nameLength));
+        params[name] = std::string(data.substr(nameLength, valueLength));
+        data.remove_prefix(nameLength + valueLength);
+    }
+    return true;
+}
+
+
+bool FcgiSink::write(const iovec* pieces, size_t count) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += pieces[i].iov_len;
+    }
+    // Every record holds at most FCGI_MAX_CONTENT bytes, possibly from several pieces
+    static const char padding[8] = {};
+    std::vector<std::array<char, 8>> headers;
+    headers.reserve(total / FCGI_MAX_CONTENT + 1);
+    std::vector<iovec> out;
+    out.reserve(count + 2 * (total / FCGI_MAX_CONTENT + 1));
+
+    size_t piece = 0, offset = 0;
+    while (total > 0) {
+        size_t length = total < FCGI_MAX_CONTENT ? total : FCGI_MAX_CONTENT;
+        size_t paddingLength = (8 - length % 8) % 8;
+        headers.push_back({
+            static_cast<char>(FCGI_VERSION_1), static_cast<char>(FCGI_STDOUT),
+            static_cast<char>(requestId >> 8), static_cast<char>(requestId & 0xff),
+            static_cast<char>(length >> 8), static_cast<char>(length & 0xff),
+            static_cast<char>(paddingLength), 0
+        });
+        out.push_back({headers.back().data(), 8});
+        total -= length;
+        while (length > 0) {
+            size_t take = pieces[piece].iov_len - offset;
+            if (take > length) {
+                take = length;
+            }
+            out.push_back({static_cast<char*>(pieces[piece].iov_base) + offset, take});
+            length -= take;
+            offset += take;
+            if (offset == pieces[piece].iov_len) {
+                piece++;
+                offset = 0;
+            }
+        }
+        if (paddingLength > 0) {
+            out.push_back({const_cast<char*>(padding), paddingLength});
+        }
+    }
+    return out.empty() || target.write(out.data(), out.size());
+}
@@ -0,0 +1,75 @@
+#ifndef FCGI_H
+#define FCGI_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "net.h"
+#include "output.h"
+
+
+// FastCGI 1.0 record types
+enum FcgiRecordType : uint8_t {
+    FCGI_BEGIN_REQUEST = 1,
+    FCGI_ABORT_REQUEST = 2,
+    FCGI_END_REQUEST = 3,
+    FCGI_PARAMS = 4,
+    FCGI_STDIN = 5,
+    FCGI_STDOUT = 6,
+    FCGI_STDERR = 7,
+    FCGI_DATA = 8,
+    FCGI_GET_VALUES = 9,
+    FCGI_GET_VALUES_RESULT = 10,
+    FCGI_UNKNOWN_TYPE = 11
+};
+
+const uint8_t FCGI_VERSION_1 = 1;
+const uint16_t FCGI_RESPONDER = 1;
+const uint8_t FCGI_KEEP_CONN = 1;
+const uint8_t FCGI_REQUEST_COMPLETE = 0;
+const uint8_t FCGI_CANT_MPX_CONN = 1;
+const uint8_t FCGI_UNKNOWN_ROLE = 3;
+const size_t FCGI_MAX_CONTENT = 65535;
+
+
+struct FcgiRecord {
+    uint8_t type = 0;
+    uint16_t requestId = 0;
+    std::string content;
+};
+
+using FcgiParams = std::unordered_map<std::string, std::string>;
+
+
+// Records longer than FCGI_MAX_CONTENT are split; an empty one is sent as is
+bool readRecord(int fd, FcgiRecord& record);
+bool writeRecord(int fd, uint8_t type, uint16_t requestId, const char* data, size_t size);
+void appendRecord(std::string& out, uint8_t type, uint16_t requestId, std::string_view content);
+void appendEndRequest(std::string& out, uint16_t requestId, uint32_t appStatus, uint8_t protocolStatus);
+bool writeEndRequest(int fd, uint16_t requestId, uint32_t appStatus, uint8_t protocolStatus);
+// Record at the start of bytes read from a non-blocking connection: size
+// is what it takes with padding, 0 while it is incomplete. False when the
+// data is not a FastCGI record.
+bool parseRecord(std::string_view data, FcgiRecord& record, size_t& size);
+
+// Name-value pairs of FCGI_PARAMS and FCGI_GET_VALUES
+void encodeParam(std::string& out, std::string_view name, std::string_view value);
+bool decodeParams(std::string_view data, FcgiParams& params);
+
+
+// Sink that sends output as FCGI_STDOUT records to another sink, headers
+// and padding interleaved with the data in a single batch
+class FcgiSink : public OutputSink {
+public:
+    FcgiSink(OutputSink& target, uint16_t requestId) : target(target), requestId(requestId) {}
+
+    bool write(const iovec* pieces, size_t count) override;
+
+private:
+    OutputSink& target;
+    uint16_t requestId;
+};
+
+#endif // FCGI_H
@@ -0,0 +1,154 @@
+// Load generator for the FastCGI mode: keeps a number of connections busy
+// with requests for one script and reports throughput and latency.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "fcgi.h"
+
+
+struct WorkerResult {
+    std::vector<double> latencies;
+    size_t failures = 0;
+    size_t bytes = 0;
+};
+
+
+// Send one request over an open connection and read the response to END_REQUEST
+static bool request(int fd, const std::string& script, uint16_t requestId, size_t& bytes) {
+    std::string out;
+    char begin[8] = {0, static_cast<char>(FCGI_RESPONDER), static_cast<char>(FCGI_KEEP_CONN), 0, 0, 0, 0, 0};
+    appendRecord(out, FCGI_BEGIN_REQUEST, requestId, std::string_view(begin, sizeof(begin)));
+    std::string params;
+    encodeParam(params, "SCRIPT_FILENAME", script);
+    encodeParam(params, "REQUEST_METHOD", "GET");
+    encodeParam(params, "SERVER_PROTOCOL", "HTTP/1.1");
+    appendRecord(out, FCGI_PARAMS, requestId, params);
+    appendRecord(out, FCGI_PARAMS, requestId, {});
+    appendRecord(out, FCGI_STDIN, requestId, {});
+    if (!writeFully(fd, out.data(), out.size())) {
+        return false;
+    }
+
+    FcgiRecord record;
+    while (readRecord(fd, record)) {
+        if (record.type == FCGI_STDOUT) {
+            bytes += record.content.size();
+        } else if (record.type == FCGI_END_REQUEST) {
+            return record.requestId == requestId;
+        }
+    }
+    return false;
+}
+
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <socket|host:port> <script_filename>"
+                  << " [-c connections] [-n requests] [-w warmup]" << std::endl;
+        return 1;
+    }
+    std::string address = argv[1];
+    std::string script = argv[2];
+    int connections = 8;
+    long requests = 10000;
+    long warmup = 100;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "-c") {
+            connections = std::max(1, std::atoi(argv[i + 1]));
+        } else if (flag == "-n") {
+            requests = std::max(1L, std::atol(argv[i + 1]));
+        } else if (flag == "-w") {
+            warmup = std::max(0L, std::atol(argv[i + 1]));
+        }
+    }
+
+    // Warm the workers' template caches before measuring
+    int fd = connectSocket(address);
+    if (fd < 0) {
+        std::cerr << "Unable to connect to " << address << std::endl;
+        return 1;
+    }
+    for (long i = 0; i < warmup; ++i) {
+        size_t bytes = 0;
+        if (!request(fd, script, 1, bytes)) {
+            std::cerr << "Warmup request failed" << std::endl;
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+
+    std::atomic<long> remaining{requests};
+    std::vector<WorkerResult> results(connections);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < connections; ++c) {
+        threads.emplace_back([&, c]() {
+            WorkerResult& result = results[c];
+            int connection = connectSocket(address);
+            uint16_t requestId = 1;
+            while (remaining.fetch_sub(1) > 0) {
+                if (connection < 0) {
+                    connection = connectSocket(address);
+                }
+                auto begin = std::chrono::steady_clock::now();
+                if (connection >= 0 && request(connection, script, requestId, result.bytes)) {
+                    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+                    result.latencies.push_back(elapsed.count());
+                } else {
+                    result.failures++;
+                    if (connection >= 0) {
+                        close(connection);
+                    }
+                    connection = -1;
+                }
+                requestId = static_cast<uint16_t>(requestId % 65535 + 1);
+            }
+            if (connection >= 0) {
+                close(connection);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> latencies;
+    size_t failures = 0, bytes = 0;
+    for (const WorkerResult& result : results) {
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        failures += result.failures;
+        bytes += result.bytes;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::printf("requests:    %zu ok, %zu failed, %d connections\n", latencies.size(), failures, connections);
+    std::printf("time:        %.3f s\n", elapsed.count());
+    std::printf("throughput:  %.1f req/s, %.2f MB/s\n", latencies.size() / elapsed.count(),
+                bytes / elapsed.count() / 1e6);
+    std::printf("latency ms:  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+                percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+                latencies.empty() ? 0.0 : latencies.back());
+    return failures == 0 ? 0 : 1;
+}
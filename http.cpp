@@ -0,0 +1,681 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "http.h"
+#include "net.h"
+
+
+struct HttpUrl {
+    std::string host;
+    std::string port = "80";
+    std::string target = "/";
+};
+
+
+// http://host[:port][/path][?query]; a missing scheme means http
+static bool parseUrl(const std::string& url, HttpUrl& parsed, std::string& error) {
+    std::string rest = url;
+    size_t scheme = rest.find("://");
+    if (scheme != std::string::npos) {
+        std::string name = rest.substr(0, scheme);
+        for (char& c : name) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        if (name != "http") {
+            error = "unsupported scheme " + name;
+            return false;
+        }
+        rest = rest.substr(scheme + 3);
+    }
+    size_t fragment = rest.find('#');
+    if (fragment != std::string::npos) {
+        rest.resize(fragment);
+    }
+    size_t slash = rest.find_first_of("/?");
+    std::string authority = rest.substr(0, slash);
+    if (slash != std::string::npos) {
+        parsed.target = rest.substr(slash);
+        if (parsed.target[0] == '?') {
+            parsed.target.insert(0, "/");
+        }
+    }
+    size_t colon = authority.rfind(':');
+    if (colon != std::string::npos) {
+        parsed.port = authority.substr(colon + 1);
+        authority.resize(colon);
+    }
+    parsed.host = authority;
+    if (parsed.host.empty() || parsed.port.empty()) {
+        error = "malformed URL";
+        return false;
+    }
+    return true;
+}
+
+
+static bool equalsIgnoreCase(const std::string& a, const char* b) {
+    return strcasecmp(a.c_str(), b) == 0;
+}
+
+
+// Reads a response from a connection; everything lands in one buffer
+// that later becomes the body, so content is copied at most once. It can
+// also parse a response already received in full from a non-blocking
+// connection.
+class ResponseReader {
+public:
+    explicit ResponseReader(int fd) : fd(fd) {}
+    explicit ResponseReader(std::string data) : fd(-1), buffer(std::move(data)), total(buffer.size()) {}
+
+    bool read(bool head, HttpResponse& response, bool& keepAlive, std::string& error);
+    bool received() const { return total > 0; }
+
+private:
+    bool fill();
+    bool readLine(std::string& line);
+    bool readHeaders(int& status, bool& http10, std::vector<std::pair<std::string, std::string>>& headers);
+    bool readExact(size_t size, std::string& out);
+
+    int fd;
+    std::string buffer;
+    size_t position = 0;
+    size_t total = 0;
+};
+
+
+bool ResponseReader::fill() {
+    static const size_t CHUNK = 16 * 1024;
+    if (fd < 0) {
+        return false;
+    }
+    if (position > 0 && position == buffer.size()) {
+        buffer.clear();
+        position = 0;
+    }
+    size_t size = buffer.size();
+    buffer.resize(size + CHUNK);
+    // Servers that write headers and body separately would otherwise
+    // wait for our delayed ACK before sending the body
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    ssize_t count;
+    do {
+        count = ::read(fd, &buffer[size], CHUNK);
+    } while (count < 0 && errno == EINTR);
+    buffer.resize(size + (count > 0 ? static_cast<size_t>(count) : 0));
+    if (count > 0) {
+        total += static_cast<size_t>(count);
+    }
+    return count > 0;
+}
+
+
+bool ResponseReader::readLine(std::string& line) {
+    for (;;) {
+        size_t end = buffer.find("\r\n", position);
+        if (end != std::string::npos) {
+            line.assign(buffer, position, end - position);
+            position = end + 2;
+            return true;
+        }
+        if (!fill()) {
+            return false;
+        }
+    }
+}
+
+
+bool ResponseReader::readHeaders(int& status, bool& http10,
+                                 std::vector<std::pair<std::string, std::string>>& headers) {
+    std::string line;
+    if (!readLine(line) || line.compare(0, 5, "HTTP/") != 0 || line.size() < 12) {
+        return false;
+    }
+    http10 = line.compare(0, 8, "HTTP/1.0") == 0;
+    status = std::atoi(line.c_str() + 9);
+    headers.clear();
+    while (readLine(line)) {
+        if (line.empty()) {
+            return true;
+        }
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        size_t value = line.find_first_not_of(" \t", colon + 1);
+        headers.emplace_back(line.substr(0, colon), value == std::string::npos ? "" : line.substr(value));
+    }
+    return false;
+}
+
+
+// Append exactly size bytes: what is buffered first, the rest straight from the socket
+bool ResponseReader::readExact(size_t size, std::string& out) {
+    size_t buffered = std::min(size, buffer.size() - position);
+    out.append(buffer, position, buffered);
+    position += buffered;
+    size_t rest = size - buffered;
+    if (rest == 0) {
+        return true;
+    }
+    if (fd < 0) {
+        return false;
+    }
+    size_t offset = out.size();
+    out.resize(offset + rest);
+    if (!readFully(fd, &out[offset], rest)) {
+        return false;
+    }
+    total += rest;
+    return true;
+}
+
+
+// Finds where a response ends in bytes arriving on a non-blocking
+// connection. Every call scans only what arrived since the last one, so
+// the response is parsed once, when all of it is there. Anything it does
+// not understand counts as complete and is left to ResponseReader.
+class ResponseFraming {
+public:
+    explicit ResponseFraming(bool head) : head(head) {}
+
+    bool complete(const std::string& data, bool closed);
+
+private:
+    enum State { HEADERS, LENGTH, CHUNK_SIZE, CHUNK_DATA, TRAILERS, UNTIL_CLOSE, DONE };
+
+    bool readHeaders(const std::string& data, size_t end);
+    bool findLine(const std::string& data, size_t& end);
+
+    bool head;
+    State state = HEADERS;
+    size_t position = 0;     // start of what has not been framed yet
+    size_t searched = 0;     // where the next line end search starts
+    size_t remaining = 0;    // body or chunk bytes still to come
+};
+
+
+bool ResponseFraming::findLine(const std::string& data, size_t& end) {
+    end = data.find("\r\n", std::max(position, searched));
+    if (end == std::string::npos) {
+        searched = data.size() > 0 ? data.size() - 1 : 0;
+        return false;
+    }
+    searched = 0;
+    return true;
+}
+
+
+// The header block ends at end; the status and framing headers decide what follows
+bool ResponseFraming::readHeaders(const std::string& data, size_t end) {
+    if (data.compare(position, 5, "HTTP/") != 0 || end - position < 12) {
+        return false;
+    }
+    int status = std::atoi(data.c_str() + position + 9);
+    bool chunked = false;
+    bool hasLength = false;
+    size_t length = 0;
+    for (size_t line = data.find("\r\n", position) + 2; line < end;) {
+        size_t lineEnd = data.find("\r\n", line);
+        std::string header = data.substr(line, lineEnd - line);
+        if (strncasecmp(header.c_str(), "Content-Length:", 15) == 0) {
+            hasLength = true;
+            length = std::strtoull(header.c_str() + 15, nullptr, 10);
+        } else if (strncasecmp(header.c_str(), "Transfer-Encoding:", 18) == 0) {
+            chunked = strcasestr(header.c_str(), "chunked") != nullptr;
+        }
+        line = lineEnd + 2;
+    }
+    position = end + 4;
+    if (status >= 100 && status < 200) {
+        // Interim response; the real one follows
+    } else if (head || status == 204 || status == 304) {
+        state = DONE;
+    } else if (chunked) {
+        state = CHUNK_SIZE;
+    } else if (hasLength) {
+        state = LENGTH;
+        remaining = length;
+    } else {
+        state = UNTIL_CLOSE;
+    }
+    return true;
+}
+
+
+bool ResponseFraming::complete(const std::string& data, bool closed) {
+    size_t end;
+    for (;;) {
+        switch (state) {
+            case HEADERS:
+                end = data.find("\r\n\r\n", std::max(position, searched));
+                if (end == std::string::npos) {
+                    searched = data.size() > 3 ? data.size() - 3 : 0;
+                    return closed;
+                }
+                searched = 0;
+                if (!readHeaders(data, end)) {
+                    return true;
+                }
+                break;
+            case LENGTH:
+                return closed || data.size() - position >= remaining;
+            case CHUNK_SIZE:
+                if (!findLine(data, end)) {
+                    return closed;
+                }
+                remaining = std::strtoull(data.c_str() + position, nullptr, 16);
+                position = end + 2;
+                if (remaining == 0) {
+                    state = TRAILERS;
+                } else {
+                    remaining += 2;
+                    state = CHUNK_DATA;
+                }
+                break;
+            case CHUNK_DATA:
+                if (data.size() - position < remaining) {
+                    return closed;
+                }
+                position += remaining;
+                state = CHUNK_SIZE;
+                break;
+            case TRAILERS:
+                if (!findLine(data, end)) {
+                    return closed;
+                }
+                state = end == position ? DONE : TRAILERS;
+                position = end + 2;
+                break;
+            case UNTIL_CLOSE:
+                return closed;
+            case DONE:
+                return true;
+        }
+    }
+}
+
+
+// Directives that decide whether and for how long a response may be reused
+static void readCacheControl(const std::string& value, HttpResponse& response) {
+    const char* text = value.c_str();
+    if (strcasestr(text, "no-store") || strcasestr(text, "no-cache") || strcasestr(text, "private")) {
+        response.noStore = true;
+    }
+    const char* stale = strcasestr(text, "stale-while-revalidate=");
+    if (stale) {
+        response.staleWhileRevalidate = std::strtol(stale + std::strlen("stale-while-revalidate="), nullptr, 10);
+    }
+    const char* age = strcasestr(text, "max-age=");
+    if (age) {
+        response.maxAge = std::strtol(age + std::strlen("max-age="), nullptr, 10);
+    }
+}
+
+
+bool ResponseReader::read(bool head, HttpResponse& response, bool& keepAlive, std::string& error) {
+    int status = 0;
+    bool http10 = false;
+    std::vector<std::pair<std::string, std::string>> headers;
+    response.maxAge = -1;
+    response.staleWhileRevalidate = -1;
+    response.noStore = false;
+    // Interim 1xx responses are skipped
+    do {
+        if (!readHeaders(status, http10, headers)) {
+            error = received() ? "malformed response" : "connection closed";
+            return false;
+        }
+    } while (status >= 100 && status < 200);
+
+    bool chunked = false;
+    bool hasLength = false;
+    size_t length = 0;
+    keepAlive = !http10;
+    for (const auto& header : headers) {
+        if (equalsIgnoreCase(header.first, "Content-Length")) {
+            hasLength = true;
+            length = std::strtoull(header.second.c_str(), nullptr, 10);
+        } else if (equalsIgnoreCase(header.first, "Transfer-Encoding")) {
+            chunked = strcasestr(header.second.c_str(), "chunked") != nullptr;
+        } else if (equalsIgnoreCase(header.first, "Connection")) {
+            if (strcasestr(header.second.c_str(), "close")) {
+                keepAlive = false;
+            } else if (strcasestr(header.second.c_str(), "keep-alive")) {
+                keepAlive = true;
+            }
+        } else if (equalsIgnoreCase(header.first, "Cache-Control")) {
+            readCacheControl(header.second, response);
+        }
+    }
+
+    response.status = status;
+    response.body.clear();
+    if (head || status == 204 || status == 304) {
+        // No body
+    } else if (chunked) {
+        std::string line;
+        for (;;) {
+            if (!readLine(line)) {
+                error = "truncated chunked body";
+                return false;
+            }
+            size_t size = std::strtoull(line.c_str(), nullptr, 16);
+            if (size == 0) {
+                break;
+            }
+            if (!readExact(size, response.body) || !readLine(line)) {
+                error = "truncated chunked body";
+                return false;
+            }
+        }
+        // Trailer fields up to the empty line
+        while (readLine(line) && !line.empty()) {
+        }
+    } else if (hasLength) {
+        if (!readExact(length, response.body)) {
+            error = "truncated body";
+            return false;
+        }
+    } else {
+        // Body delimited by the end of the connection
+        response.body.assign(buffer, position, std::string::npos);
+        position = buffer.size();
+        while (fill()) {
+            response.body.append(buffer, position, std::string::npos);
+            position = buffer.size();
+        }
+        keepAlive = false;
+    }
+    // Bytes past the response mean the connection is out of sync
+    if (position != buffer.size()) {
+        keepAlive = false;
+    }
+    return true;
+}
+
+
+HttpClient::~HttpClient() {
+    for (auto& entry : idle) {
+        for (int fd : entry.second) {
+            close(fd);
+        }
+    }
+}
+
+
+HttpClient& HttpClient::shared() {
+    static HttpClient client;
+    return client;
+}
+
+
+// An idle pooled connection to address, or -1
+int HttpClient::takeIdle(const std::string& address) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = idle.find(address);
+    if (it == idle.end() || it->second.empty()) {
+        return -1;
+    }
+    int fd = it->second.back();
+    it->second.pop_back();
+    return fd;
+}
+
+
+int HttpClient::acquire(const std::string& address, bool& reused, std::string& error) {
+    int fd = takeIdle(address);
+    reused = fd >= 0;
+    if (reused) {
+        return fd;
+    }
+    std::vector<SocketAddress> resolved;
+    if (!resolveAddress(address, resolved)) {
+        error = "unable to resolve " + address;
+        return -1;
+    }
+    size_t next = 0;
+    return openConnection(resolved, false, next, error);
+}
+
+
+// A new connection, counted in connectionsOpened()
+int HttpClient::openConnection(const std::vector<SocketAddress>& resolved, bool nonBlocking, size_t& next,
+                               std::string& error) {
+    int fd = connectSocket(resolved, nonBlocking, next);
+    if (fd < 0) {
+        error = std::string("unable to connect: ") + std::strerror(errno);
+        return -1;
+    }
+    timeval timeout{TIMEOUT_SECONDS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    opened++;
+    return fd;
+}
+
+
+// Pooled connections are blocking, whichever kind of request used them
+void HttpClient::release(const std::string& address, int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int>& pool = idle[address];
+    if (pool.size() < MAX_IDLE_PER_HOST) {
+        pool.push_back(fd);
+    } else {
+        close(fd);
+    }
+}
+
+
+static std::string requestMessage(const std::string& method, const HttpUrl& parsed, const std::string& body,
+                                  const std::string& header) {
+    std::string message = method + " " + parsed.target + " HTTP/1.1\r\nHost: " + parsed.host;
+    if (parsed.port != "80") {
+        message += ":" + parsed.port;
+    }
+    message += "\r\nUser-Agent: php-template\r\nAccept: */*\r\n";
+    if (header.find(':') != std::string::npos) {
+        message += header + "\r\n";
+    }
+    if (!body.empty()) {
+        // Same defaults as curl --data
+        if (strcasestr(header.c_str(), "content-type:") == nullptr) {
+            message += "Content-Type: application/x-www-form-urlencoded\r\n";
+        }
+        message += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    }
+    message += "\r\n";
+    message += body;
+    return message;
+}
+
+
+bool HttpClient::request(const std::string& method, const std::string& url, const std::string& body,
+                         const std::string& header, HttpResponse& response, std::string& error) {
+    HttpUrl parsed;
+    if (!parseUrl(url, parsed, error)) {
+        return false;
+    }
+    std::string address = parsed.host + ":" + parsed.port;
+    std::string message = requestMessage(method, parsed, body, header);
+
+    // A pooled connection may have been closed by the server meanwhile;
+    // if nothing came back on it, the request is sent once more on a new one
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool reused = false;
+        int fd = acquire(address, reused, error);
+        if (fd < 0) {
+            return false;
+        }
+        ResponseReader reader(fd);
+        bool keepAlive = false;
+        if (writeFully(fd, message.data(), message.size()) &&
+            reader.read(method == "HEAD", response, keepAlive, error)) {
+            if (keepAlive) {
+                release(address, fd);
+            } else {
+                close(fd);
+            }
+            return true;
+        }
+        close(fd);
+        if (!reused || reader.received()) {
+            if (error.empty()) {
+                error = std::strerror(errno);
+            }
+            return false;
+        }
+        error.clear();
+    }
+    return false;
+}
+
+
+// Wait for a non-blocking connect to finish
+static Task<bool> connectAsync(EventLoop& loop, int fd, std::string& error) {
+    if (!co_await loop.writable(fd, HttpClient::TIMEOUT_SECONDS)) {
+        error = "connect timed out";
+        co_return false;
+    }
+    int failure = 0;
+    socklen_t length = sizeof(failure);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &failure, &length) != 0 || failure != 0) {
+        error = std::string("unable to connect: ") + std::strerror(failure ? failure : errno);
+        co_return false;
+    }
+    co_return true;
+}
+
+
+// One exchange on a non-blocking connection. Reads go into one growing
+// buffer; once the framing says the response is all there, it is parsed.
+static Task<bool> exchangeAsync(EventLoop& loop, int fd, const std::string& message, bool head,
+                                HttpResponse& response, bool& keepAlive, bool& received, std::string& error) {
+    static const size_t CHUNK = 64 * 1024;
+    const double timeout = HttpClient::TIMEOUT_SECONDS;
+
+    for (size_t sent = 0; sent < message.size();) {
+        ssize_t count = send(fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+        if (count > 0) {
+            sent += static_cast<size_t>(count);
+        } else if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!co_await loop.writable(fd, timeout)) {
+                error = "send timed out";
+                co_return false;
+            }
+        } else {
+            co_return false;
+        }
+    }
+
+    std::string data;
+    bool closed = false;
+    ResponseFraming framing(head);
+    for (;;) {
+        size_t size = data.size();
+        data.resize(size + CHUNK);
+        ssize_t count = ::read(fd, &data[size], CHUNK);
+        data.resize(size + (count > 0 ? static_cast<size_t>(count) : 0));
+        if (count > 0) {
+            received = true;
+        } else if (count == 0) {
+            closed = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!co_await loop.readable(fd, timeout)) {
+                error = "response timed out";
+                co_return false;
+            }
+            continue;
+        } else {
+            co_return false;
+        }
+        if (framing.complete(data, closed)) {
+            ResponseReader reader(std::move(data));
+            co_return reader.read(head, response, keepAlive, error);
+        }
+    }
+}
+
+
+Task<bool> HttpClient::requestAsync(EventLoop& loop, const std::string& method, const std::string& url,
+                                    const std::string& body, const std::string& header,
+                                    HttpResponse& response, std::string& error) {
+    HttpUrl parsed;
+    if (!parseUrl(url, parsed, error)) {
+        co_return false;
+    }
+    std::string address = parsed.host + ":" + parsed.port;
+    std::string message = requestMessage(method, parsed, body, header);
+
+    std::vector<SocketAddress> resolved;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int fd = takeIdle(address);
+        bool reused = fd >= 0;
+        if (reused) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        } else {
+            // The lookup blocks, so it runs off the loop thread
+            bool found = !resolved.empty();
+            if (!found) {
+                co_await loop.blocking([&]() { found = resolveAddress(address, resolved); });
+            }
+            if (!found) {
+                error = "unable to resolve " + address;
+                co_return false;
+            }
+            // A connect refused once it completes goes on with the
+            // remaining addresses, as the blocking connect does
+            size_t next = 0;
+            while (fd < 0) {
+                if (next == resolved.size()) {
+                    co_return false;
+                }
+                fd = openConnection(resolved, true, next, error);
+                if (fd < 0) {
+                    co_return false;
+                }
+                if (!co_await connectAsync(loop, fd, error)) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+            error.clear();
+        }
+        bool keepAlive = false;
+        bool received = false;
+        if (co_await exchangeAsync(loop, fd, message, method == "HEAD", response, keepAlive, received, error)) {
+            if (keepAlive) {
+                release(address, fd);
+            } else {
+                close(fd);
+            }
+            co_return true;
+        }
+        close(fd);
+        if (!reused || received) {
+            if (error.empty()) {
+                error = std::strerror(errno);
+            }
+            co_return false;
+        }
+        error.clear();
+    }
+    co_return false;
+}
@@ -0,0 +1,67 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "net.h"
+#include "scheduler.h"
+
+
+struct HttpResponse {
+    int status = 0;
+    std::string body;
+    // From Cache-Control, in seconds; -1 when absent
+    long maxAge = -1;
+    long staleWhileRevalidate = -1;
+    bool noStore = false;    // no-store, no-cache or private
+};
+
+
+// HttpClient class: HTTP/1.1 over plain TCP. Connections that the server
+// keeps open go back to a per host:port pool and are reused by the next
+// request to the same host; a pooled connection that turns out to be
+// closed is replaced once. Safe to share between threads.
+class HttpClient {
+public:
+    static const size_t MAX_IDLE_PER_HOST = 8;
+    static const int TIMEOUT_SECONDS = 30;
+
+    HttpClient() = default;
+    ~HttpClient();
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    // Process-wide client, so that pooled connections outlive a render
+    static HttpClient& shared();
+
+    // header is a single "Name: value" line or empty. Returns false and
+    // sets error when no complete response was received.
+    bool request(const std::string& method, const std::string& url, const std::string& body,
+                 const std::string& header, HttpResponse& response, std::string& error);
+
+    // Same contract as request(), on a non-blocking connection driven by
+    // the event loop: the awaiting task is suspended while it waits. The
+    // arguments must stay valid until the task has finished.
+    Task<bool> requestAsync(EventLoop& loop, const std::string& method, const std::string& url,
+                            const std::string& body, const std::string& header,
+                            HttpResponse& response, std::string& error);
+
+    size_t connectionsOpened() const { return opened; }
+
+private:
+    int takeIdle(const std::string& address);
+    int acquire(const std::string& address, bool& reused, std::string& error);
+    int openConnection(const std::vector<SocketAddress>& resolved, bool nonBlocking, size_t& next, std::string& error);
+    void release(const std::string& address, int fd);
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::vector<int>> idle;
+    std::atomic<size_t> opened{0};
+};
+
+#endif // HTTP_H
@@ -0,0 +1,383 @@
+// Checks of the http() client against a local stand-in server: keep-alive
+// reuse, methods, chunked and closed responses, large bodies and stale
+// pooled connections, on the blocking and the event loop paths; background
+// requests; and the response cache: TTL, stale-while-revalidate,
+// Cache-Control, coalescing and eviction. Prints one
+// line per check and exits with 1 if any failed. Groups of checks can be
+// named on the command line; all of them run by default.
+//
+// --bench instead times sequential http() calls of a template with the
+// native client and with the curl command.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "http.h"
+#include "httpcache.h"
+#include "interpret.h"
+#include "loopback.h"
+#include "output.h"
+#include "scheduler.h"
+
+
+// Collects the rendered output
+class StringSink : public OutputSink {
+public:
+    bool write(const iovec* pieces, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            text.append(static_cast<const char*>(pieces[i].iov_base), pieces[i].iov_len);
+        }
+        return true;
+    }
+
+    std::string text;
+};
+
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& name, const std::string& detail = "") {
+    if (ok) {
+        std::printf("ok    %s\n", name.c_str());
+    } else {
+        std::printf("FAIL  %s%s%s\n", name.c_str(), detail.empty() ? "" : ": ", detail.c_str());
+        failures++;
+    }
+}
+
+static std::string get(HttpClient& client, const std::string& method, const std::string& url,
+                       const std::string& body = "") {
+    HttpResponse response;
+    std::string error;
+    if (!client.request(method, url, body, "", response, error)) {
+        return "error: " + error;
+    }
+    return response.body;
+}
+
+
+static void checkClient(LoopbackServer& server) {
+    HttpClient client;
+
+    bool ordered = true;
+    for (int i = 1; i <= 5; ++i) {
+        ordered = ordered && get(client, "GET", server.url("/keep-alive")) == "GET " + std::to_string(i);
+    }
+    check(ordered, "sequential requests answered in order");
+    check(client.connectionsOpened() == 1 && server.connections() == 1, "keep-alive reuses one connection",
+          std::to_string(client.connectionsOpened()) + " opened");
+
+    std::string posted = get(client, "POST", server.url("/form"), "name=ann");
+    check(posted == "POST 6 name=ann", "POST sends its body", posted);
+    HttpResponse head;
+    std::string error;
+    bool headOk = client.request("HEAD", server.url("/head"), "", "", head, error);
+    check(headOk && head.status == 200 && head.body.empty(), "HEAD has no body", error);
+    check(get(client, "GET", server.url("/after-head")) == "GET 8", "connection usable after HEAD");
+    check(client.connectionsOpened() == 1, "methods share the connection");
+
+    std::string chunked = get(client, "GET", server.url("/chunked?chunked&size=20000"));
+    check(chunked.size() == 20000 && chunked.compare(0, 6, "GET 9.") == 0, "chunked body",
+          std::to_string(chunked.size()) + " bytes");
+
+    size_t opened = client.connectionsOpened();
+    check(get(client, "GET", server.url("/close?close")) == "GET 10", "Connection: close response");
+    get(client, "GET", server.url("/after-close"));
+    check(client.connectionsOpened() == opened + 1, "closed connection is not pooled");
+
+    std::string large = get(client, "GET", server.url("/large?size=1048576"));
+    check(large.size() == 1048576 && large.find_first_not_of('.', 6) == std::string::npos, "1 MB body",
+          std::to_string(large.size()) + " bytes");
+
+    // The pooled connection is closed by the server while idle
+    opened = client.connectionsOpened();
+    server.dropConnections();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::string retried = get(client, "GET", server.url("/stale"));
+    check(retried.compare(0, 4, "GET ") == 0 && client.connectionsOpened() == opened + 1,
+          "stale pooled connection is replaced", retried);
+}
+
+
+static Task<void> requestsOnLoop(EventLoop& loop, HttpClient& client, LoopbackServer& server,
+                                 std::string& bodies) {
+    for (const char* target : {"/async", "/async?chunked", "/async?size=300000", "/async?chunked&size=300000"}) {
+        HttpResponse response;
+        std::string error;
+        if (co_await client.requestAsync(loop, "GET", server.url(target), "", "", response, error)) {
+            bodies += response.body.size() > 16 ? std::to_string(response.body.size()) : response.body;
+            bodies += "|";
+        } else {
+            bodies += "error: " + error + "|";
+        }
+    }
+    loop.stop();
+}
+
+static void checkAsyncClient(LoopbackServer& server) {
+    HttpClient client;
+    EventLoop loop;
+    std::string bodies;
+    size_t before = server.requests();
+    loop.spawn(requestsOnLoop(loop, client, server, bodies));
+    loop.run();
+    std::string expected = "GET " + std::to_string(before + 1) + "|GET " + std::to_string(before + 2) + "|300000|300000|";
+    check(bodies == expected, "requestAsync bodies", bodies);
+    check(client.connectionsOpened() == 1, "requestAsync reuses one connection",
+          std::to_string(client.connectionsOpened()) + " opened");
+}
+
+
+static Task<void> renderOnLoop(EventLoop& loop, Interpreter& interpreter, const Program& program) {
+    co_await interpreter.render(program.view());
+    loop.stop();
+}
+
+// Renders a template, on an event loop when one is given; returns the
+// elapsed seconds
+static double render(const std::string& source, size_t concurrency, bool onLoop, std::string& text) {
+    Program program = compileTemplate(source);
+    StringSink sink;
+    OutputBuffer output(sink);
+    Interpreter interpreter(program.symbols, output);
+    interpreter.setHttpConcurrency(concurrency);
+    auto start = std::chrono::steady_clock::now();
+    if (onLoop) {
+        EventLoop loop;
+        interpreter.setEventLoop(loop);
+        loop.spawn(renderOnLoop(loop, interpreter, program));
+        loop.run();
+    } else {
+        interpreter.run(program.view());
+    }
+    output.flush();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    text = sink.text;
+    return elapsed.count();
+}
+
+// Request numbers depend on arrival order; the rest of the output must not
+static std::string withoutNumbers(const std::string& text) {
+    std::string result;
+    for (size_t i = 0; i < text.size(); ++i) {
+        bool digit = text[i] >= '0' && text[i] <= '9';
+        if (!digit) {
+            result += text[i];
+        } else if (i == 0 || text[i - 1] < '0' || text[i - 1] > '9') {
+            result += '#';
+        }
+    }
+    return result;
+}
+
+// Three http() calls of 300 ms each run in the background: they overlap up
+// to the concurrency limit, and a variable waits for its own request only
+static void checkBackground(LoopbackServer& server) {
+    std::string source = "<?php\n";
+    for (const char* name : {"$a", "$b", "$c"}) {
+        source += "http(" + std::string(name) + ", \"" + server.url("/slow?delay=300") + "\", \"\", \"\", \"GET\");\n";
+    }
+    source += "?>\n<p><?php echo $a . \", \" . $b . \", \" . $c; ?></p>\n";
+
+    std::string parallel;
+    std::string serial;
+    std::string looped;
+    double parallelTime = render(source, Runtime::DEFAULT_HTTP_CONCURRENCY, false, parallel);
+    double serialTime = render(source, 1, false, serial);
+    double loopTime = render(source, Runtime::DEFAULT_HTTP_CONCURRENCY, true, looped);
+    char times[64];
+    std::snprintf(times, sizeof(times), "%.3f s", parallelTime);
+    check(parallelTime < 0.6, "background requests overlap", times);
+    std::snprintf(times, sizeof(times), "%.3f s", serialTime);
+    check(serialTime >= 0.9, "concurrency 1 runs them one at a time", times);
+    std::snprintf(times, sizeof(times), "%.3f s", loopTime);
+    check(loopTime < 0.6, "requests overlap on the event loop", times);
+    check(withoutNumbers(parallel).find("<p>GET #, GET #, GET #") != std::string::npos, "rendered results", parallel);
+    check(withoutNumbers(serial) == withoutNumbers(parallel) && withoutNumbers(looped) == withoutNumbers(parallel),
+          "same output at every concurrency and on the loop", serial + looped);
+}
+
+
+static std::string cached(HttpCache& cache, const std::string& method, const std::string& url) {
+    HttpResponse response;
+    std::string error;
+    if (!cache.request(method, url, "", "", response, error)) {
+        return "error: " + error;
+    }
+    return response.body;
+}
+
+static void pause(double seconds) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+// Each check runs on a cache of its own, so that the counters start at zero
+static void checkCache(LoopbackServer& server) {
+    HttpClient client;
+    {
+        HttpCache cache(client);
+        cache.configure(0.3, 0);
+        std::string first = cached(cache, "GET", server.url("/ttl"));
+        std::string again = cached(cache, "GET", server.url("/ttl"));
+        check(again == first && cache.stats().hits == 1 && cache.stats().misses == 1, "fresh within the TTL", again);
+        pause(0.4);
+        std::string expired = cached(cache, "GET", server.url("/ttl"));
+        check(expired != first && cache.stats().misses == 2, "refetched after the TTL", expired);
+    }
+    {
+        HttpCache cache(client);
+        cache.configure(0.2, 5);
+        std::string first = cached(cache, "GET", server.url("/swr"));
+        pause(0.3);
+        size_t before = server.requests();
+        std::string stale = cached(cache, "GET", server.url("/swr"));
+        check(stale == first && cache.stats().staleHits == 1 && cache.stats().revalidations == 1,
+              "stale response served while revalidating", stale);
+        std::string refreshed = stale;
+        for (int i = 0; i < 100 && refreshed == first; ++i) {
+            pause(0.01);
+            refreshed = cached(cache, "GET", server.url("/swr"));
+        }
+        check(refreshed != first && server.requests() == before + 1 && cache.stats().revalidations == 1,
+              "refreshed once in the background", refreshed);
+    }
+    {
+        HttpCache cache(client);
+        cache.configure(0.2, 0);
+        std::string first = cached(cache, "GET", server.url("/max-age?max-age=2"));
+        pause(0.3);
+        check(cached(cache, "GET", server.url("/max-age?max-age=2")) == first, "max-age outlasts the TTL");
+        first = cached(cache, "GET", server.url("/no-store?no-store"));
+        check(cached(cache, "GET", server.url("/no-store?no-store")) != first, "no-store is not cached");
+        first = cached(cache, "POST", server.url("/post"));
+        check(cached(cache, "POST", server.url("/post")) != first, "POST is not cached");
+    }
+    {
+        HttpCache cache(client);
+        cache.configure(10, 0);
+        size_t before = server.requests();
+        std::vector<std::string> bodies(4);
+        std::vector<std::thread> threads;
+        for (std::string& body : bodies) {
+            threads.emplace_back([&cache, &server, &body]() {
+                body = cached(cache, "GET", server.url("/coalesce?delay=200"));
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        bool same = std::all_of(bodies.begin(), bodies.end(), [&bodies](const std::string& body) {
+            return body == bodies[0] && body.compare(0, 4, "GET ") == 0;
+        });
+        check(same && server.requests() == before + 1 && cache.stats().coalesced == 3,
+              "concurrent misses share one request", std::to_string(server.requests() - before) + " sent");
+    }
+    {
+        // Room for two 1000-byte responses
+        HttpCache cache(client);
+        cache.configure(10, 0, 2500);
+        std::string first = cached(cache, "GET", server.url("/lru1?size=1000"));
+        std::string second = cached(cache, "GET", server.url("/lru2?size=1000"));
+        cached(cache, "GET", server.url("/lru1?size=1000"));
+        cached(cache, "GET", server.url("/lru3?size=1000"));
+        check(cache.stats().evictions == 1 && cache.stats().entries == 2, "evicted over capacity");
+        check(cached(cache, "GET", server.url("/lru1?size=1000")) == first &&
+              cached(cache, "GET", server.url("/lru2?size=1000")) != second,
+              "least recently used evicted first");
+    }
+}
+
+
+// Sequential http() calls: each result is echoed before the next request
+static double timeCalls(LoopbackServer& server, HttpBackend backend, int calls) {
+    std::string source = "<?php\n";
+    for (int i = 0; i < calls; ++i) {
+        source += "http($r, \"" + server.url("/bench") + "\", \"\", \"\", \"GET\");\necho $r;\n";
+    }
+    source += "?>\n";
+    Program program = compileTemplate(source);
+    StringSink sink;
+    OutputBuffer output(sink);
+    Interpreter interpreter(program.symbols, output);
+    interpreter.setHttpBackend(backend);
+    auto start = std::chrono::steady_clock::now();
+    interpreter.run(program.view());
+    output.flush();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (sink.text.find("GET") == std::string::npos) {
+        std::cerr << "No responses received" << std::endl;
+        failures++;
+    }
+    return elapsed.count() * 1000 / calls;
+}
+
+
+int main(int argc, char* argv[]) {
+    static const std::vector<std::string> GROUPS = {"client", "background", "cache"};
+    bool bench = false;
+    int calls = 200;
+    std::vector<std::string> groups;
+    for (int i = 1; i < argc; ++i) {
+        std::string flag = argv[i];
+        if (flag == "--bench") {
+            bench = true;
+        } else if (i + 1 < argc && flag == "-n") {
+            calls = std::max(1, std::atoi(argv[++i]));
+        } else if (std::find(GROUPS.begin(), GROUPS.end(), flag) != GROUPS.end()) {
+            groups.push_back(flag);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [client] [background] [cache] | --bench [-n calls]" << std::endl;
+            return 1;
+        }
+    }
+    if (groups.empty()) {
+        groups = GROUPS;
+    }
+    auto selected = [&groups](const char* name) {
+        return std::find(groups.begin(), groups.end(), name) != groups.end();
+    };
+
+    LoopbackServer server;
+    if (!server.start()) {
+        std::cerr << "Unable to start the local server" << std::endl;
+        return 1;
+    }
+
+    if (bench) {
+        double native = timeCalls(server, HTTP_NATIVE, calls);
+        // curl prints a progress meter per call on stderr
+        int savedStderr = dup(STDERR_FILENO);
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        dup2(null, STDERR_FILENO);
+        double curl = timeCalls(server, HTTP_CURL, calls);
+        dup2(savedStderr, STDERR_FILENO);
+        close(savedStderr);
+        close(null);
+        std::printf("native:  %.3f ms per http() call\n", native);
+        std::printf("curl:    %.3f ms per http() call\n", curl);
+        std::printf("speedup: %.1fx over %d sequential calls\n", curl / native, calls);
+        return failures ? 1 : 0;
+    }
+
+    if (selected("client")) {
+        checkClient(server);
+        checkAsyncClient(server);
+    }
+    if (selected("background")) {
+        checkBackground(server);
+    }
+    if (selected("cache")) {
+        checkCache(server);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+#include <utility>
+
+#include "httpcache.h"
+
+
+HttpCache::~HttpCache() {
+    std::vector<std::future<void>> running;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running.swap(refreshes);
+    }
+    for (std::future<void>& refresh : running) {
+        refresh.wait();
+    }
+}
+
+
+HttpCache& HttpCache::shared() {
+    static HttpCache cache(HttpClient::shared());
+    return cache;
+}
+
+
+void HttpCache::configure(double ttlSeconds, double staleSeconds, size_t capacityBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ttl = std::chrono::duration<double>(ttlSeconds > 0 ? ttlSeconds : 0);
+    stale = std::chrono::duration<double>(staleSeconds > 0 ? staleSeconds : 0);
+    capacity = capacityBytes;
+    evict();
+}
+
+bool HttpCache::enabled() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ttl.count() > 0;
+}
+
+
+bool HttpCache::request(const std::string& method, const std::string& url, const std::string& body,
+                        const std::string& header, HttpResponse& response, std::string& error) {
+    std::string key = method + '\0' + url + '\0' + header + '\0' + body;
+    std::shared_future<Outcome> waiting;
+    std::promise<Outcome> promise;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (ttl.count() <= 0 || (method != "GET" && method != "HEAD")) {
+            lock.unlock();
+            return client.request(method, url, body, header, response, error);
+        }
+        Clock::time_point now = Clock::now();
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.stored && now < it->second.staleUntil) {
+            Entry& entry = it->second;
+            recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, entry.recent);
+            response = entry.response;
+            if (now < entry.freshUntil) {
+                counters.hits++;
+                return true;
+            }
+            counters.staleHits++;
+            if (!entry.refreshing) {
+                entry.refreshing = true;
+                counters.revalidations++;
+                for (size_t i = refreshes.size(); i-- > 0;) {
+                    if (refreshes[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                        refreshes.erase(refreshes.begin() + i);
+                    }
+                }
+                refreshes.push_back(std::async(std::launch::async, &HttpCache::refresh, this, key,
+                                               method, url, body, header));
+            }
+            return true;
+        }
+        if (it != entries.end() && it->second.inFlight.valid()) {
+            counters.coalesced++;
+            waiting = it->second.inFlight;
+        } else {
+            counters.misses++;
+            entries[key].inFlight = promise.get_future().share();
+        }
+    }
+
+    if (waiting.valid()) {
+        const Outcome& outcome = waiting.get();
+        response = outcome.response;
+        error = outcome.error;
+        return outcome.ok;
+    }
+    Outcome outcome = fetch(method, url, body, header);
+    store(key, outcome, false);
+    response = outcome.response;
+    error = outcome.error;
+    bool ok = outcome.ok;
+    promise.set_value(std::move(outcome));
+    return ok;
+}
+
+
+HttpCache::Stats HttpCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats current = counters;
+    current.entries = recentlyUsed.size();
+    return current;
+}
+
+
+HttpCache::Outcome HttpCache::fetch(const std::string& method, const std::string& url, const std::string& body,
+                                    const std::string& header) {
+    Outcome outcome;
+    outcome.ok = client.request(method, url, body, header, outcome.response, outcome.error);
+    return outcome;
+}
+
+// Runs in the background while the stale response is served
+void HttpCache::refresh(const std::string& key, const std::string& method, const std::string& url,
+                        const std::string& body, const std::string& header) {
+    Outcome outcome = fetch(method, url, body, header);
+    store(key, outcome, true);
+}
+
+
+// A failed refresh leaves the stale response in place until its window ends
+void HttpCache::store(const std::string& key, const Outcome& outcome, bool refreshed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const HttpResponse& response = outcome.response;
+    std::chrono::duration<double> fresh = response.maxAge >= 0 ? std::chrono::duration<double>(response.maxAge) : ttl;
+    std::chrono::duration<double> window = response.staleWhileRevalidate >= 0
+        ? std::chrono::duration<double>(response.staleWhileRevalidate) : stale;
+    bool keep = outcome.ok && response.status >= 200 && response.status < 300 && !response.noStore &&
+                fresh.count() > 0 && ttl.count() > 0;
+
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        // Evicted while the request ran
+        if (!keep) {
+            return;
+        }
+        it = entries.emplace(key, Entry()).first;
+    }
+    Entry& entry = it->second;
+    if (refreshed) {
+        entry.refreshing = false;
+    } else {
+        entry.inFlight = std::shared_future<Outcome>();
+    }
+    if (!keep) {
+        if (!entry.stored && !entry.inFlight.valid() && !entry.refreshing) {
+            entries.erase(it);
+        }
+        return;
+    }
+
+    if (entry.stored) {
+        counters.bytes -= entry.bytes;
+        recentlyUsed.erase(entry.recent);
+    }
+    Clock::time_point now = Clock::now();
+    entry.stored = true;
+    entry.response = response;
+    entry.bytes = key.size() + response.body.size();
+    entry.freshUntil = now + std::chrono::duration_cast<Clock::duration>(fresh);
+    entry.staleUntil = entry.freshUntil + std::chrono::duration_cast<Clock::duration>(window);
+    recentlyUsed.push_front(key);
+    entry.recent = recentlyUsed.begin();
+    counters.bytes += entry.bytes;
+    evict();
+}
+
+
+// Called with the mutex held. Entries with a request in flight keep their
+// slot in the map so the request can complete into it.
+void HttpCache::evict() {
+    while (counters.bytes > capacity && !recentlyUsed.empty()) {
+        auto it = entries.find(recentlyUsed.back());
+        recentlyUsed.pop_back();
+        Entry& entry = it->second;
+        counters.bytes -= entry.bytes;
+        counters.evictions++;
+        if (entry.inFlight.valid() || entry.refreshing) {
+            entry.stored = false;
+            entry.response = HttpResponse();
+            entry.bytes = 0;
+        } else {
+            entries.erase(it);
+        }
+    }
+}
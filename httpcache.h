@@ -0,0 +1,98 @@
+#ifndef HTTPCACHE_H
+#define HTTPCACHE_H
+
+#include <chrono>
+#include <cstddef>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "http.h"
+
+
+// HttpCache class: responses of http() shared between renders, keyed on
+// method, URL, body and header. A response is fresh for its Cache-Control
+// max-age or the configured TTL; after that it is served stale for the
+// stale-while-revalidate window while one background request refreshes
+// it. Concurrent misses on the same key wait for a single upstream
+// request. Entries are evicted least recently used first once the cached
+// bytes exceed the capacity. Only successful GET and HEAD responses are
+// stored. Safe to share between threads.
+class HttpCache {
+public:
+    static const size_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+
+    struct Stats {
+        size_t hits = 0;
+        size_t staleHits = 0;       // served stale while a refresh ran
+        size_t misses = 0;          // sent upstream
+        size_t coalesced = 0;       // waited for an identical request in flight
+        size_t revalidations = 0;
+        size_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+    explicit HttpCache(HttpClient& client) : client(client) {}
+    ~HttpCache();
+    HttpCache(const HttpCache&) = delete;
+    HttpCache& operator=(const HttpCache&) = delete;
+
+    // Process-wide cache over HttpClient::shared(), off until configured
+    static HttpCache& shared();
+
+    // A TTL of 0 turns the cache off; requests then go straight to the client
+    void configure(double ttlSeconds, double staleSeconds, size_t capacity = DEFAULT_CAPACITY);
+    bool enabled() const;
+
+    // Same contract as HttpClient::request()
+    bool request(const std::string& method, const std::string& url, const std::string& body,
+                 const std::string& header, HttpResponse& response, std::string& error);
+
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Outcome {
+        bool ok = false;
+        HttpResponse response;
+        std::string error;
+    };
+
+    struct Entry {
+        bool stored = false;
+        HttpResponse response;
+        Clock::time_point freshUntil;
+        Clock::time_point staleUntil;
+        size_t bytes = 0;
+        std::list<std::string>::iterator recent;
+        // Request for a missing entry, shared with the requests coalesced into it
+        std::shared_future<Outcome> inFlight;
+        bool refreshing = false;
+    };
+
+    Outcome fetch(const std::string& method, const std::string& url, const std::string& body,
+                  const std::string& header);
+    void store(const std::string& key, const Outcome& outcome, bool refreshed);
+    void refresh(const std::string& key, const std::string& method, const std::string& url,
+                 const std::string& body, const std::string& header);
+    void evict();
+
+    HttpClient& client;
+    mutable std::mutex mutex;
+    std::chrono::duration<double> ttl{0};
+    std::chrono::duration<double> stale{0};
+    size_t capacity = DEFAULT_CAPACITY;
+    std::unordered_map<std::string, Entry> entries;
+    // Stored keys, most recently used first
+    std::list<std::string> recentlyUsed;
+    std::vector<std::future<void>> refreshes;
+    Stats counters;
+};
+
+#endif // HTTPCACHE_H
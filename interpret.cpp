@@ -1,97 +1,141 @@
-#include <stdexcept>
-#include <array>
-#include <memory>
-#include <cstdio>
-#include <cstdlib>
-
 #include "interpret.h"
 
 
-void Interpreter::interpret(const std::vector<std::unique_ptr<ASTNode>>& nodes) {
-    for (const auto& node : nodes) {
-        if (auto textNode = dynamic_cast<TextNode*>(node.get())) {
-            std::cout << textNode->text;
-        } else if (auto printNode = dynamic_cast<PrintNode*>(node.get())) {
-            std::cout << evaluateExpression(printNode->expr.get()) << std::endl;
-        } else if (auto queryNode = dynamic_cast<DatabaseQueryNode*>(node.get())) {
-            std::string result = exec(("echo \"Database query: " + queryNode->query + "\"").c_str());
-            std::cout << result << std::endl;
-        } else if (auto httpRequestNode = dynamic_cast<HttpRequestAssignmentNode*>(node.get())) {
-            std::string url = httpRequestNode->url;
-            std::string data = httpRequestNode->data;
-            std::string header = httpRequestNode->header;
+Interpreter::Interpreter(const SymbolTable& symbols, OutputBuffer& output) : Runtime(symbols, output) {}
 
-            std::string command = "curl -X GET ";
-            command += "--data \"" + data + "\" ";
-            command += "-H \"" + header + "\" ";
-            command += url;
 
-            std::string result = exec(command.c_str());
-            variables[httpRequestNode->variable] = result;
-        } else if (auto assignmentNode = dynamic_cast<AssignmentNode*>(node.get())) {
-            std::string varName = assignmentNode->variable->name;
-            std::string valueStr = evaluateExpression(assignmentNode->expr.get());
-            try {
-                double value = std::stod(valueStr);
-                variables[varName] = value;
-            } catch (const std::invalid_argument&) {
-                variables[varName] = valueStr;
-            } catch (const std::out_of_range&) {
-                std::cerr << "Number out of range for variable assignment: " << valueStr << std::endl;
-            }
+void Interpreter::interpret(const Ast& ast) {
+    for (size_t i = 0; i < ast.statements.size(); ++i) {
+        if (profiler) {
+            profiler->statement(static_cast<uint32_t>(i));
+        }
+        const Node& node = ast[ast.statements[i]];
+        size_t batch = node.kind == N_DB && !profiler ? dbBatchLength(ast, i) : 1;
+        if (node.kind == N_TEXT) {
+            out.writeStatic(node.text);
+        } else if (batch > 1) {
+            executeDatabaseBatch(ast, i, batch);
+            i += batch - 1;
+        } else {
+            executeStatement(ast, node);
         }
     }
-}
-
-std::string Interpreter::exec(const char* cmd) {
-    std::array<char, 128> buffer;
-    std::string result;
-    std::shared_ptr<FILE> pipe(popen(cmd, "r"), pclose);
-    if (!pipe) throw std::runtime_error("popen() failed!");
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
+    if (profiler) {
+        profiler->endStatements();
     }
-    return result;
+    resolveAll();
 }
 
-std::string Interpreter::evaluateExpression(ASTNode* node) {
-    if (auto textNode = dynamic_cast<TextNode*>(node)) {
-        return textNode->text;
-    } else if (auto variableNode = dynamic_cast<VariableNode*>(node)) {
-        auto it = variables.find(variableNode->name);
-        if (it != variables.end()) {
-            if (auto value = std::get_if<double>(&it->second)) {
-                return std::to_string(*value);
-            } else if (auto value = std::get_if<std::string>(&it->second)) {
-                return *value;
-            }
+void Interpreter::execute(const Ast& ast) {
+    for (size_t i = 0; i < ast.statements.size(); ++i) {
+        const Node& node = ast[ast.statements[i]];
+        size_t batch = node.kind == N_DB ? dbBatchLength(ast, i) : 1;
+        if (node.kind == N_TEXT) {
+            out.write(node.text);
+        } else if (batch > 1) {
+            executeDatabaseBatch(ast, i, batch);
+            i += batch - 1;
         } else {
-            std::cerr << "Undefined variable: " << variableNode->name << std::endl;
-            return "0";
-        }
-    } else if (auto expressionNode = dynamic_cast<ExpressionNode*>(node)) {
-        std::string leftValue = evaluateExpression(expressionNode->left.get());
-        std::string rightValue = evaluateExpression(expressionNode->right.get());
-        if (expressionNode->op == "+") {
-            return std::to_string(std::stod(leftValue) + std::stod(rightValue));
+            executeStatement(ast, node);
         }
-        if (expressionNode->op == "-") {
-            return std::to_string(std::stod(leftValue) - std::stod(rightValue));
+    }
+}
+
+// Consecutive independent db statements: all arguments are evaluated first,
+// then the queries go to the database in one round trip
+void Interpreter::executeDatabaseBatch(const Ast& ast, size_t first, size_t count) {
+    std::vector<DbQuery> queries(count);
+    std::vector<uint32_t> slots(count);
+    for (size_t i = 0; i < count; ++i) {
+        const Node& node = ast[ast.statements[first + i]];
+        for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+            queries[i].params.push_back(evaluateExpression(ast, ast[argument].left));
         }
-        if (expressionNode->op == "*") {
-            return std::to_string(std::stod(leftValue) * std::stod(rightValue));
+        queries[i].query = std::string(node.text);
+        slots[i] = node.left != NO_NODE ? ast[node.left].slot : NO_SLOT;
+    }
+    databaseQueries(queries, slots.data());
+}
+
+void Interpreter::executeStatement(const Ast& ast, const Node& node) {
+    switch (node.kind) {
+        case N_PRINT: {
+            // Operands of an echoed concatenation are written without joining them
+            std::vector<NodeId> operands;
+            concatOperands(ast, node.left, operands);
+            for (NodeId operand : operands) {
+                if (operand != NO_NODE && ast[operand].kind == N_STRING) {
+                    out.write(ast[operand].text);
+                } else {
+                    writeValue(evaluateExpression(ast, operand));
+                }
+            }
+            out.write("\n");
+            break;
         }
-        if (expressionNode->op == "/") {
-            return std::to_string(std::stod(leftValue) / std::stod(rightValue));
+        case N_DB: {
+            std::vector<Value> params;
+            for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+                params.push_back(evaluateExpression(ast, ast[argument].left));
+            }
+            databaseQuery(node.left != NO_NODE ? ast[node.left].slot : NO_SLOT, std::string(node.text), params);
+            break;
         }
-        if (expressionNode->op == ".") {
-            return leftValue + rightValue;
+        case N_HTTP:
+            httpRequest(ast[node.left].slot, std::string(ast[node.right].text),
+                        std::string(ast[node.right + 1].text), std::string(ast[node.right + 2].text),
+                        std::string(ast[node.right + 3].text));
+            break;
+        case N_ASSIGNMENT: {
+            std::vector<NodeId> operands;
+            concatOperands(ast, node.right, operands);
+            if (isSelfAppend(ast, node, operands)) {
+                std::vector<Value> parts;
+                parts.reserve(operands.size());
+                parts.push_back(takeVariable(ast[node.left].slot));
+                for (size_t i = 1; i < operands.size(); ++i) {
+                    parts.push_back(evaluateExpression(ast, operands[i]));
+                }
+                storeVariable(ast[node.left].slot, concatenate(parts.data(), parts.size()));
+            } else {
+                storeVariable(ast[node.left].slot, evaluateExpression(ast, node.right));
+            }
+            break;
         }
-    } else if (auto stringNode = dynamic_cast<StringNode*>(node)) {
-        return stringNode->value.substr(1, stringNode->value.length() - 2); // Remove quotes
-    } else if (auto numberNode = dynamic_cast<NumberNode*>(node)) {
-        return numberNode->value;
+        default:
+            break;
     }
-    return "0";
 }
 
+Value Interpreter::evaluateExpression(const Ast& ast, NodeId id) {
+    if (id == NO_NODE) {
+        return Value{};
+    }
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case N_TEXT:
+        case N_STRING:
+            return std::string(node.text);
+        case N_VARIABLE:
+            return loadVariable(node.slot);
+        case N_EXPRESSION: {
+            if (node.op == '.') {
+                std::vector<NodeId> operands;
+                concatOperands(ast, id, operands);
+                std::vector<Value> parts;
+                parts.reserve(operands.size());
+                for (NodeId operand : operands) {
+                    parts.push_back(evaluateExpression(ast, operand));
+                }
+                return concatenate(parts.data(), parts.size());
+            }
+            Value leftValue = evaluateExpression(ast, node.left);
+            Value rightValue = evaluateExpression(ast, node.right);
+            return binaryOperation(node.op, leftValue, rightValue);
+        }
+        case N_NUMBER:
+            return numberValue(node);
+        default:
+            return Value{};
+    }
+}
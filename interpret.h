@@ -2,26 +2,40 @@
 #define INTERPRET_H
 
 #include <vector>
-#include <memory>
-#include <unordered_map>
 #include <string>
-#include <variant>
-#include <iostream>
 
 #include "lexer.h"
 #include "parser.h"
+#include "compiler.h"
+#include "resolver.h"
+#include "runtime.h"
 
 
-// Interpreter class
-class Interpreter {
+// Interpreter class: runs a program over the render state
+class Interpreter : public Runtime {
 public:
-    void interpret(const std::vector<std::unique_ptr<ASTNode>>& nodes);
+    // The interpreter is the per-render state over a shared, read-only
+    // program; the symbol table must outlive it
+    Interpreter(const SymbolTable& symbols, OutputBuffer& output);
+
+    // Tree-walking interpreter over the AST
+    void interpret(const Ast& ast);
+    // Stack VM over compiled bytecode
+    void run(const ProgramView& program);
+    // The VM as a coroutine. With an event loop set it suspends at http()
+    // results, db statements and full output, and is spawned on or awaited
+    // from the loop; run() drives it without a loop, where it never suspends.
+    Task<void> render(ProgramView program);
+
+    // Streaming: statements are executed batch by batch as they are parsed.
+    // declare() switches to the grown symbol table, execute() copies text out
+    // of the AST since its source buffer is reused, finish() ends the render.
+    void execute(const Ast& ast);
 
 private:
-    std::string exec(const char* cmd);
-    std::string evaluateExpression(ASTNode* node);
-
-    std::unordered_map<std::string, VariableValue> variables;
+    void executeStatement(const Ast& ast, const Node& node);
+    void executeDatabaseBatch(const Ast& ast, size_t first, size_t count);
+    Value evaluateExpression(const Ast& ast, NodeId id);
 };
 
 #endif // INTERPRET_H
@@ -1,84 +1,409 @@
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+
 #include "lexer.h"
 
 
+// Character classes used by the scanner
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline bool isIdentStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool isIdentChar(char c) {
+    return isIdentStart(c) || isDigit(c);
+}
+
+
+// Single pass over the source: every branch inspects only the characters at
+// the current position, so tokenizing is linear in the file size.
 std::vector<Token> Tokenizer::tokenize() {
     std::vector<Token> tokens;
-    while (position < source.length()) {
-        if (match("<\\?php\\b")) {
-        	first = "";
-            if (insidePHP) {
-                std::cerr << "Unexpected <?php tag without closing ?>" << std::endl;
-                return tokens;
+    if (!scan(tokens)) {
+        return tokens;
+    }
+
+    tokens.push_back({T_EOF, "", source.length()});
+    locate(tokens.back());
+    return tokens;
+}
+
+
+// Tokens up to the end of the range; false after a misplaced tag
+bool Tokenizer::scan(std::vector<Token>& tokens) {
+    while (position < end) {
+        if (!step(tokens)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+std::vector<Token> Tokenizer::tokenize(ThreadPool& pool) {
+    size_t rangeSize = std::max(source.length() / (pool.size() * 4) + 1, size_t{MIN_PARALLEL_RANGE});
+    std::vector<size_t> cuts;
+    if (pool.size() > 1 && position == 0 && !input) {
+        cuts = findCuts(rangeSize);
+    }
+    if (cuts.empty()) {
+        return tokenize();
+    }
+
+    struct Range {
+        size_t begin;
+        size_t end;
+        std::vector<Token> tokens;
+        bool complete = false;
+        uint32_t newlines = 0;
+        size_t lastLineStart = 0;
+    };
+    std::vector<Range> ranges(cuts.size() + 1);
+    std::vector<std::future<void>> done;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        Range& range = ranges[i];
+        range.begin = i > 0 ? cuts[i - 1] : 0;
+        range.end = i < cuts.size() ? cuts[i] : source.length();
+        done.push_back(pool.submit([this, &range]() {
+            Tokenizer tokenizer(source, range.begin, range.end);
+            range.complete = tokenizer.scan(range.tokens);
+            Token last{T_EOF, "", range.end};
+            tokenizer.locate(last);
+            range.newlines = last.line - 1;
+            range.lastLineStart = tokenizer.lineStart;
+        }));
+    }
+    for (std::future<void>& task : done) {
+        task.get();
+    }
+
+    // Lines of a range are counted from its start; shift them in order
+    size_t count = 1;
+    for (const Range& range : ranges) {
+        count += range.tokens.size();
+    }
+    std::vector<Token> tokens;
+    tokens.reserve(count);
+    uint32_t lines = 0;
+    size_t lineStart = 0;
+    for (Range& range : ranges) {
+        for (Token& token : range.tokens) {
+            if (token.line == 1) {
+                token.column += static_cast<uint32_t>(range.begin - lineStart);
             }
-            if (position > 0 && source[position - 1] == '<') {
-                tokens.push_back({T_TEXT, "<"});
+            token.line += lines;
+            tokens.push_back(std::move(token));
+        }
+        if (!range.complete) {
+            return tokens;
+        }
+        lines += range.newlines;
+        if (range.newlines > 0) {
+            lineStart = range.lastLineStart;
+        }
+    }
+    tokens.push_back({T_EOF, "", source.length(), lines + 1,
+                      static_cast<uint32_t>(source.length() - lineStart + 1)});
+    return tokens;
+}
+
+
+// Quick pass over the tag structure that yields the offsets just after
+// closing tags where ranges of at least rangeSize bytes can be cut. Text
+// is searched for '<'; in code only strings, comments and tags are
+// followed, which is enough to end every island exactly where step()
+// does. The pass stops at a misplaced tag, so the tokenizer of the last
+// range reports it.
+std::vector<size_t> Tokenizer::findCuts(size_t rangeSize) const {
+    std::vector<size_t> cuts;
+    const size_t length = source.length();
+    auto at = [&](size_t pos, const char* literal) {
+        return source.compare(pos, std::strlen(literal), literal) == 0;
+    };
+    size_t pos = 0;
+    size_t last = 0;
+    bool php = false;
+    while (pos < length) {
+        if (!php) {
+            // Tags are checked where a text run starts and at every '<'
+            if (at(pos, "?>")) {
+                break;
             }
-            insidePHP = true;
-        } else if (match("\\?>")) {
-            if (!insidePHP) {
-                std::cerr << "Unexpected ?> tag without opening <?php" << std::endl;
-                return tokens;
+            size_t open = source.find('<', pos);
+            if (open == std::string_view::npos) {
+                break;
             }
-            insidePHP = false;
-        } else if (insidePHP) {
-            if (match("//")) { 
-                skipComment();
-            } else if (match("\\/\\*")) {
-              position += 2;
-              skipCommentMultilene();
-            } else if (match("echo")) {
-                tokens.push_back({T_ECHO, "echo"});
-            } else if (match("db")) {
-                tokens.push_back({T_DB, "db"});
-            } else if (match("http")) { // Добавляем обработку токена http
-                tokens.push_back({T_HTTP, "http"});
-            } else if (match("\\$[a-zA-Z_][a-zA-Z0-9_]*")) {
-                tokens.push_back({T_VARIABLE, lastMatch});
-            } else if (match("\\d+(\\.\\d+)?")) {
-                tokens.push_back({T_NUMBER, lastMatch});
-            } else if (match("[\\+\\-\\*/\\.]")) {
-                tokens.push_back({T_OPERATOR, lastMatch});
-            } else if (match("=")) {
-                tokens.push_back({T_ASSIGN, "="});
-            } else if (match("\"[^\"]*\"")) {
-                tokens.push_back({T_STRING, lastMatch});
-            } else if (match(";")) {
-                tokens.push_back({T_SEMICOLON, ";"});
-            } else if (match(",")) {
-                tokens.push_back({T_COMMA, ","});
-            } else if (match("\\(")) { // Match left parenthesis
-                tokens.push_back({T_LPAREN, "("});
-            } else if (match("\\)")) { // Match right parenthesis
-                tokens.push_back({T_RPAREN, ")"});
+            if (at(open, "<?php") && !isWordChar(open + 5)) {
+                php = true;
+                pos = open + 5;
             } else {
-                position++;
+                pos = open + 1;
+            }
+            continue;
+        }
+
+        char c = source[pos];
+        if (c == '<' && at(pos, "<?php") && !isWordChar(pos + 5)) {
+            break;
+        } else if (c == '?' && at(pos, "?>")) {
+            pos += 2;
+            php = false;
+            if (pos - last >= rangeSize && pos < length) {
+                cuts.push_back(pos);
+                last = pos;
+            }
+        } else if (c == '"') {
+            size_t close = source.find('"', pos + 1);
+            pos = close != std::string_view::npos ? close + 1 : pos + 1;
+        } else if (at(pos, "//")) {
+            pos += 2;
+            while (pos < length && source[pos] != '\n' && !at(pos, "?>")) {
+                pos++;
+            }
+            if (pos < length && source[pos] == '\n') {
+                pos++;
+            }
+        } else if (at(pos, "/*")) {
+            pos += 4;
+            while (pos < length && !at(pos, "*/") && !at(pos, "?>")) {
+                pos++;
+            }
+            if (pos < length && at(pos, "*/")) {
+                pos += 2;
             }
         } else {
-            if (match("<")) {
-                first = "<";
-            } else if (match("[^<]+")) {
-                tokens.push_back({T_TEXT, first + lastMatch});
-            } else {
-                position++;
+            pos++;
+        }
+    }
+    return cuts;
+}
+
+
+// Tokens of whole statements covering at least BATCH_SIZE bytes of input:
+// text tokens and PHP tokens up to a ';'. The buffer is reused on the next
+// call, so the tokens are only valid until then.
+bool Tokenizer::nextStatements(std::vector<Token>& tokens) {
+    tokens.clear();
+    if (position >= CHUNK_SIZE) {
+        owned.erase(0, position);
+        source = owned;
+        end = owned.size();
+        base += position;
+        scanned -= position;
+        position = 0;
+    }
+    size_t batchStart = position;
+    while (!stopped) {
+        if (position >= source.length() && !fill()) {
+            break;
+        }
+        size_t count = tokens.size();
+        if (!step(tokens)) {
+            stopped = true;
+            break;
+        }
+        if (tokens.size() > count && (tokens.back().type == T_TEXT || tokens.back().type == T_SEMICOLON) &&
+            position - batchStart >= BATCH_SIZE) {
+            break;
+        }
+    }
+    // fill() may have moved the buffer under tokens scanned before it
+    for (Token& token : tokens) {
+        token.value = source.substr(token.offset, token.value.size());
+    }
+    return !tokens.empty();
+}
+
+
+// Append the next chunk of input; false at its end
+bool Tokenizer::fill() {
+    if (!input || !*input) {
+        return false;
+    }
+    size_t size = owned.size();
+    owned.resize(size + CHUNK_SIZE);
+    input->read(&owned[size], CHUNK_SIZE);
+    owned.resize(size + input->gcount());
+    source = owned;
+    end = owned.size();
+    return input->gcount() > 0;
+}
+
+
+// One tag, PHP token or run of text; false after a misplaced tag
+bool Tokenizer::step(std::vector<Token>& tokens) {
+    if (input && source.length() - position < LOOKAHEAD) {
+        fill();
+    }
+    if (startsWith("<?php") && !isWordChar(position + 5)) {
+        position += 5;
+        if (insidePHP) {
+            std::cerr << "Unexpected <?php tag without closing ?>" << std::endl;
+            return false;
+        }
+        insidePHP = true;
+    } else if (startsWith("?>")) {
+        position += 2;
+        if (!insidePHP) {
+            std::cerr << "Unexpected ?> tag without opening <?php" << std::endl;
+            return false;
+        }
+        insidePHP = false;
+    } else if (insidePHP) {
+        size_t start = position;
+        Token token = scanPHP();
+        // A token that runs into the end of the buffer may go on in the next chunk
+        while (input && (position >= source.length() || (source[start] == '"' && token.type != T_STRING)) && fill()) {
+            position = start;
+            token = scanPHP();
+        }
+        if (token.type != T_EOF) {
+            token.offset = start;
+            locate(token);
+            tokens.push_back(std::move(token));
+        }
+    } else {
+        // Static text runs up to the next "<?php" tag, across any other
+        // '<'. A '<' followed by "?>" ends the run so that the next step
+        // reports the tag. When streaming, a run also stops at a '<' too
+        // close to the end of the buffer to check, and a run longer than
+        // the buffer is split.
+        size_t start = position;
+        while (position < source.length()) {
+            const void* next = std::memchr(source.data() + position, '<', source.length() - position);
+            if (!next) {
+                position = source.length();
+                break;
+            }
+            position = static_cast<const char*>(next) - source.data();
+            if (position > start && ((source.compare(position, 5, "<?php") == 0 && !isWordChar(position + 5)) ||
+                                     (input && source.length() - position < LOOKAHEAD))) {
+                break;
+            }
+            position++;
+            if (source.compare(position, 2, "?>") == 0) {
+                break;
             }
         }
+        tokens.push_back({T_TEXT, source.substr(start, position - start), start});
+        locate(tokens.back());
     }
+    return true;
+}
 
-    tokens.push_back({T_EOF, ""});
-    return tokens;
+
+// Line and column of a token. Tokens come in source order, so every
+// newline is counted once.
+void Tokenizer::locate(Token& token) {
+    for (; scanned < token.offset; ++scanned) {
+        if (source[scanned] == '\n') {
+            line++;
+            lineStart = base + scanned + 1;
+        }
+    }
+    token.line = line;
+    token.column = static_cast<uint32_t>(base + token.offset - lineStart + 1);
 }
 
 
-bool Tokenizer::match(const std::string& pattern) {
-    std::regex re(pattern);
-    std::smatch match;
-    std::string substring = source.substr(position);
-    if (std::regex_search(substring, match, re) && match.position() == 0) {
-        lastMatch = match.str();
-        position += lastMatch.length();
-        return true;
+// Scan one token inside <?php ... ?>. Comments and unknown characters are
+// skipped and reported as T_EOF, which tokenize() does not emit.
+Token Tokenizer::scanPHP() {
+    const size_t length = source.length();
+    size_t start = position;
+    char c = source[position];
+
+    if (startsWith("//")) {
+        position += 2;
+        skipComment();
+        return {T_EOF, ""};
+    }
+    if (startsWith("/*")) {
+        position += 4;
+        skipCommentMultilene();
+        return {T_EOF, ""};
+    }
+    if (startsWith("echo")) {
+        position += 4;
+        return {T_ECHO, "echo"};
+    }
+    if (startsWith("db")) {
+        position += 2;
+        return {T_DB, "db"};
+    }
+    if (startsWith("http")) {
+        position += 4;
+        return {T_HTTP, "http"};
+    }
+    if (c == '$' && position + 1 < length && isIdentStart(source[position + 1])) {
+        position += 2;
+        while (position < length && isIdentChar(source[position])) {
+            position++;
+        }
+        return {T_VARIABLE, source.substr(start, position - start)};
+    }
+    if (isDigit(c)) {
+        while (position < length && isDigit(source[position])) {
+            position++;
+        }
+        if (position + 1 < length && source[position] == '.' && isDigit(source[position + 1])) {
+            position++;
+            while (position < length && isDigit(source[position])) {
+                position++;
+            }
+        }
+        return {T_NUMBER, source.substr(start, position - start)};
+    }
+
+    switch (c) {
+        case '+': case '-': case '*': case '/': case '.':
+            position++;
+            return {T_OPERATOR, source.substr(start, 1)};
+        case '=':
+            position++;
+            return {T_ASSIGN, "="};
+        case '"': {
+            size_t close = source.find('"', position + 1);
+            if (close != std::string_view::npos) {
+                position = close + 1;
+                return {T_STRING, source.substr(start, position - start)};
+            }
+            break;
+        }
+        case ';':
+            position++;
+            return {T_SEMICOLON, ";"};
+        case ',':
+            position++;
+            return {T_COMMA, ","};
+        case '(':
+            position++;
+            return {T_LPAREN, "("};
+        case ')':
+            position++;
+            return {T_RPAREN, ")"};
+        default:
+            break;
     }
-    return false;
+
+    position++;
+    return {T_EOF, ""};
+}
+
+
+bool Tokenizer::startsWith(const char* literal) const {
+    size_t length = std::strlen(literal);
+    return source.compare(position, length, literal) == 0;
+}
+
+
+bool Tokenizer::isWordChar(size_t pos) const {
+    return pos < source.length() && isIdentChar(source[pos]);
 }
 
 
@@ -88,7 +413,7 @@ void Tokenizer::skipComment() {
             position++; // Skip newline character
             break;
         }
-        if (source.substr(position, 2) == "?>") {
+        if (startsWith("?>")) {
             break;
         }
         position++;
@@ -98,14 +423,13 @@ void Tokenizer::skipComment() {
 
 void Tokenizer::skipCommentMultilene() {
     while (position < source.length()) {
-        if (source.substr(position, 2) == "*/") {
+        if (startsWith("*/")) {
             position += 2; // Skip closing tag characters
             break;
         }
-        if (source.substr(position, 2) == "?>") {
+        if (startsWith("?>")) {
             break;
         }
         position++;
     }
 }
-
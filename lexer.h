@@ -1,11 +1,14 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <regex>
 #include <iostream>
 
+#include "threadpool.h"
+
 
 // Enumeration of token types
 enum TokenType {
@@ -34,27 +37,74 @@ enum TokenType {
 // Token structure
 struct Token {
     TokenType type;
-    std::string value;
+    std::string_view value; // span of the source, nothing is copied
+    size_t offset = 0; // position of value in the source
+    uint32_t line = 1;
+    uint32_t column = 1;
 };
 
 
 // Tokenizer class
 class Tokenizer {
 public:
-    Tokenizer(const std::string& source) : source(source), position(0), insidePHP(false) {}
+    // Input is read in chunks of CHUNK_SIZE; statements are handed out in
+    // batches of at least BATCH_SIZE bytes of source
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    static const size_t BATCH_SIZE = 64 * 1024;
+    // Parallel tokenizing splits the source into ranges of at least this
+    // size; smaller sources are tokenized serially
+    static const size_t MIN_PARALLEL_RANGE = 64 * 1024;
+
+    // The source must outlive the tokenizer
+    Tokenizer(std::string_view source)
+        : source(source), end(source.size()), position(0), insidePHP(false) {}
+    // Streaming: the source is read from `input` as tokens are needed
+    explicit Tokenizer(std::istream& input) : end(0), position(0), insidePHP(false), input(&input) {}
 
     std::vector<Token> tokenize();
+    // Same tokens as tokenize(). A quick scan finds the island boundaries,
+    // then ranges of whole islands are tokenized on the pool's threads.
+    std::vector<Token> tokenize(ThreadPool& pool);
+
+    // Streaming: next batch of whole statements; false at the end of input
+    bool nextStatements(std::vector<Token>& tokens);
+    // Text the tokens of the last batch refer to
+    std::string_view buffer() const { return source; }
 
 private:
-    bool match(const std::string& pattern);
+    // Range [begin, end) of a larger source, starting outside PHP code.
+    // Lines are counted from the start of the range.
+    Tokenizer(std::string_view source, size_t begin, size_t end)
+        : source(source), end(end), position(begin), insidePHP(false),
+          scanned(begin), lineStart(begin) {}
+
+    // Bytes a tag check may look at: "<?php" and the character after it
+    static const size_t LOOKAHEAD = 6;
+
+    bool scan(std::vector<Token>& tokens);
+    bool step(std::vector<Token>& tokens);
+    std::vector<size_t> findCuts(size_t rangeSize) const;
+    bool fill();
+    bool startsWith(const char* literal) const;
+    bool isWordChar(size_t pos) const;
+    Token scanPHP();
+    void locate(Token& token);
     void skipComment();
     void skipCommentMultilene();
 
-    std::string source;
+    std::string_view source;
+    size_t end;                  // tokenizing stops here
     size_t position;
-    std::string first;
-    std::string lastMatch;
     bool insidePHP;
+    std::istream* input = nullptr;
+    std::string owned;           // streaming buffer
+    bool stopped = false;
+    // Line bookkeeping for locate(): newlines before `scanned` are counted.
+    // Streaming drops consumed input; base is the offset of what is left.
+    size_t scanned = 0;
+    uint32_t line = 1;
+    size_t lineStart = 0;
+    size_t base = 0;
 };
 
 #endif // LEXER_H
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "loopback.h"
+#include "net.h"
+
+
+LoopbackServer::~LoopbackServer() {
+    if (thread.joinable()) {
+        loop.stop();
+        thread.join();
+    }
+    for (int fd : open) {
+        close(fd);
+    }
+    if (listenFd >= 0) {
+        close(listenFd);
+    }
+}
+
+
+bool LoopbackServer::start() {
+    listenFd = listenSocket("127.0.0.1:0", 4096);
+    sockaddr_in bound{};
+    socklen_t boundSize = sizeof(bound);
+    if (listenFd < 0 || getsockname(listenFd, reinterpret_cast<sockaddr*>(&bound), &boundSize) != 0) {
+        return false;
+    }
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+    boundPort = ntohs(bound.sin_port);
+    loop.spawn(acceptConnections());
+    thread = std::thread([this]() { loop.run(); });
+    return true;
+}
+
+
+std::string LoopbackServer::url(const std::string& target) const {
+    return "http://127.0.0.1:" + std::to_string(boundPort) + target;
+}
+
+
+void LoopbackServer::dropConnections() {
+    std::promise<void> done;
+    loop.post([this, &done]() {
+        for (int fd : open) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        done.set_value();
+    });
+    done.get_future().wait();
+}
+
+
+Task<void> LoopbackServer::acceptConnections() {
+    for (;;) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            accepted++;
+            open.insert(fd);
+            loop.spawn(serve(fd));
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            co_await loop.readable(listenFd);
+        } else if (errno == EMFILE || errno == ENFILE) {
+            // Out of descriptors: wait for connections to close
+            co_await loop.sleep(0.01);
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+            co_return;
+        }
+    }
+}
+
+
+Task<bool> LoopbackServer::send(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t count = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (count > 0) {
+            data.remove_prefix(static_cast<size_t>(count));
+        } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await loop.writable(fd);
+        } else if (count < 0 && errno == EINTR) {
+            continue;
+        } else {
+            co_return false;
+        }
+    }
+    co_return true;
+}
+
+
+// Value of `name` in a query string; a bare name gives an empty value
+static bool queryValue(const std::string& query, const char* name, std::string& value) {
+    size_t length = std::strlen(name);
+    for (size_t start = 0; start < query.size();) {
+        size_t end = query.find('&', start);
+        if (end == std::string::npos) {
+            end = query.size();
+        }
+        if (query.compare(start, length, name) == 0 && (start + length == end || query[start + length] == '=')) {
+            value = start + length == end ? "" : query.substr(start + length + 1, end - start - length - 1);
+            return true;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+
+// One keep-alive connection: requests are answered in order, each after
+// its delay, without holding up the other connections
+Task<void> LoopbackServer::serve(int fd) {
+    std::string buffer;
+    char chunk[16 * 1024];
+    for (;;) {
+        size_t end = buffer.find("\r\n\r\n");
+        size_t length = 0;
+        if (end != std::string::npos) {
+            const char* header = strcasestr(buffer.substr(0, end).c_str(), "\r\nContent-Length:");
+            length = header ? std::strtoull(header + std::strlen("\r\nContent-Length:"), nullptr, 10) : 0;
+        }
+        if (end == std::string::npos || buffer.size() < end + 4 + length) {
+            ssize_t count = read(fd, chunk, sizeof(chunk));
+            if (count > 0) {
+                buffer.append(chunk, static_cast<size_t>(count));
+                continue;
+            }
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                co_await loop.readable(fd);
+                continue;
+            }
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        size_t space = buffer.find(' ');
+        size_t targetEnd = buffer.find(' ', space + 1);
+        std::string method = buffer.substr(0, space);
+        std::string target = buffer.substr(space + 1, targetEnd - space - 1);
+        std::string requestBody = buffer.substr(end + 4, length);
+        buffer.erase(0, end + 4 + length);
+        size_t number = ++received;
+
+        size_t question = target.find('?');
+        std::string query = question == std::string::npos ? "" : target.substr(question + 1);
+        std::string value;
+        double wait = queryValue(query, "delay", value) ? std::atof(value.c_str()) / 1000 : delay;
+        bool closing = queryValue(query, "close", value);
+
+        std::string body = method + " " + std::to_string(number);
+        if (!requestBody.empty()) {
+            body += " " + requestBody;
+        }
+        if (queryValue(query, "size", value) && std::strtoull(value.c_str(), nullptr, 10) > body.size()) {
+            body.append(std::strtoull(value.c_str(), nullptr, 10) - body.size(), '.');
+        }
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n";
+        if (queryValue(query, "max-age", value)) {
+            response += "Cache-Control: max-age=" + value;
+            if (queryValue(query, "stale", value)) {
+                response += ", stale-while-revalidate=" + value;
+            }
+            response += "\r\n";
+        }
+        if (queryValue(query, "no-store", value)) {
+            response += "Cache-Control: no-store\r\n";
+        }
+        if (closing) {
+            response += "Connection: close\r\n";
+        }
+        bool head = method == "HEAD";
+        if (queryValue(query, "chunked", value)) {
+            response += "Transfer-Encoding: chunked\r\n\r\n";
+            for (size_t at = 0; !head && at < body.size(); at += 4096) {
+                size_t size = std::min<size_t>(4096, body.size() - at);
+                char line[32];
+                std::snprintf(line, sizeof(line), "%zx\r\n", size);
+                response += line;
+                response.append(body, at, size);
+                response += "\r\n";
+            }
+            if (!head) {
+                response += "0\r\n\r\n";
+            }
+        } else {
+            response += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+            if (!head) {
+                response += body;
+            }
+        }
+
+        if (wait > 0) {
+            co_await loop.sleep(wait);
+        }
+        if (!co_await send(fd, response) || closing) {
+            break;
+        }
+    }
+    open.erase(fd);
+    close(fd);
+}
@@ -0,0 +1,61 @@
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <atomic>
+#include <cstddef>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "scheduler.h"
+
+
+// LoopbackServer class: HTTP/1.1 stand-in for upstream servers, used by
+// the load test and the http() checks. It serves 127.0.0.1 on a port of
+// its own from an event loop thread and keeps connections alive. The body
+// of every response is "<method> <n>", n counting the requests received,
+// followed by " <body>" when the request had one. The query string shapes
+// the response:
+//   delay=<ms>     answer after this delay instead of the server's
+//   max-age=<s>    Cache-Control max-age; stale=<s> adds
+//                  stale-while-revalidate
+//   no-store       Cache-Control: no-store
+//   size=<bytes>   pad the body with '.' up to this size
+//   chunked        chunked transfer encoding
+//   close          Connection: close, and close the connection
+class LoopbackServer {
+public:
+    explicit LoopbackServer(double delaySeconds = 0) : delay(delaySeconds) {}
+    ~LoopbackServer();
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    // False when no port could be bound
+    bool start();
+    int port() const { return boundPort; }
+    std::string url(const std::string& target) const;
+
+    size_t requests() const { return received; }
+    size_t connections() const { return accepted; }
+    // Close every open connection from the server side, as a restart
+    // would; returns once they are shut down
+    void dropConnections();
+
+private:
+    Task<void> acceptConnections();
+    Task<void> serve(int fd);
+    Task<bool> send(int fd, std::string_view data);
+
+    double delay;
+    int listenFd = -1;
+    int boundPort = 0;
+    EventLoop loop;
+    std::thread thread;
+    std::atomic<size_t> received{0};
+    std::atomic<size_t> accepted{0};
+    // Open connections; touched on the loop thread only
+    std::set<int> open;
+};
+
+#endif // LOOPBACK_H
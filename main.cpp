@@ -1,34 +1,378 @@
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <ostream>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <vector>
 #include <memory>
 
+#include <unistd.h>
+
 #include "lexer.h"
 #include "parser.h"
+#include "resolver.h"
+#include "optimizer.h"
+#include "compiler.h"
+#include "emitter.h"
+#include "cache.h"
+#include "output.h"
 #include "interpret.h"
+#include "httpcache.h"
+#include "memstats.h"
+#include "profile.h"
+#include "server.h"
+#include "batch.h"
+#include "source.h"
+
+
+// Счётчики кэша ответов http() одной строкой
+static void printHttpCacheStats(std::ostream& out) {
+    HttpCache::Stats stats = HttpCache::shared().stats();
+    out << "HTTP cache: " << stats.hits << " hits, " << stats.staleHits << " stale hits, " << stats.misses
+        << " misses, " << stats.coalesced << " coalesced, " << stats.revalidations << " revalidations, "
+        << stats.evictions << " evictions; " << stats.entries << " entries, " << stats.bytes << " bytes" << std::endl;
+}
+
+
+// Счётчики пула базы данных и статистика по каждому запросу
+static void printDbStats(const DbPool& database, std::ostream& out) {
+    DbPool::Stats stats = database.stats();
+    out << "Database: " << stats.queries << " queries in " << stats.roundTrips << " round trips; cache "
+        << stats.cacheHits << " hits, " << stats.cacheMisses << " misses, " << stats.evictions << " evictions; "
+        << stats.cachedResults << " results, " << stats.cachedBytes << " bytes" << std::endl;
+    for (const auto& [query, calls] : database.queryStats()) {
+        out << "  " << calls.calls << " calls, " << calls.cacheHits << " hits, " << calls.cacheMisses << " misses, "
+            << calls.errors << " errors, " << calls.seconds * 1000 << " ms total, " << calls.maxSeconds * 1000
+            << " ms max: " << query << std::endl;
+    }
+}
+
+
+// Счётчики печатаются деструктором, поэтому их получает любой путь выхода
+// из main: кэш скомпилированного шаблона, потоковый, пакетный режим и обычный
+struct StatsReport {
+    bool httpCache = false;
+    const DbPool* database = nullptr;
+
+    ~StatsReport() {
+        if (httpCache) {
+            printHttpCacheStats(std::cerr);
+        }
+        if (database) {
+            printDbStats(*database, std::cerr);
+        }
+    }
+};
+
+
+// Байткод выполняется на цикле событий: пока ждём ответ http() или запрос
+// db, поток не блокируется. stdout общий с родительским процессом, поэтому
+// сам вывод остаётся блокирующим
+static void renderOnLoop(Interpreter& interpreter, const ProgramView& program) {
+    EventLoop loop;
+    interpreter.setEventLoop(loop);
+    loop.spawn(interpreter.render(program));
+    loop.run();
+}
 
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <file_name>" << std::endl;
+    // Разобрать параметры командной строки
+    bool treeWalk = false;
+    bool dumpVars = false;
+    bool optimize = true;
+    bool optimizerReport = false;
+    HttpBackend httpBackend = HTTP_NATIVE;
+    size_t httpConcurrency = Interpreter::DEFAULT_HTTP_CONCURRENCY;
+    double httpCacheTtl = 0;
+    double httpCacheStale = 0;
+    size_t httpCacheSize = HttpCache::DEFAULT_CAPACITY;
+    bool httpCacheStats = false;
+    const char* dbDriver = nullptr;
+    const char* dbInit = nullptr;
+    size_t dbCacheSize = 0;
+    bool dbStats = false;
+    const char* cacheDir = nullptr;
+    const char* fcgiAddress = nullptr;
+    const char* documentRoot = ".";
+    int workers = 4;
+    size_t flushThreshold = OutputBuffer::DEFAULT_FLUSH_THRESHOLD;
+    const char* profileFile = nullptr;
+    bool memStats = false;
+    bool memLines = false;
+    bool stream = false;
+    bool parallelLex = false;
+    const char* batchList = nullptr;
+    const char* batchVars = nullptr;
+    const char* outDir = ".";
+    size_t jobs = 0;
+    const char* emitFile = nullptr;
+    const char* fileName = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--ast") {
+            treeWalk = true;
+        } else if (arg == "--dump-vars") {
+            dumpVars = true;
+        } else if (arg == "--no-optimize") {
+            optimize = false;
+        } else if (arg == "--opt-report") {
+            optimizerReport = true;
+        } else if (arg == "--http-curl") {
+            httpBackend = HTTP_CURL;
+        } else if (arg == "--http-concurrency" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            httpConcurrency = std::atoi(argv[++i]);
+        } else if (arg == "--http-cache-ttl" && i + 1 < argc) {
+            httpCacheTtl = std::atof(argv[++i]);
+        } else if (arg == "--http-cache-stale" && i + 1 < argc) {
+            httpCacheStale = std::atof(argv[++i]);
+        } else if (arg == "--http-cache-size" && i + 1 < argc) {
+            httpCacheSize = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--http-cache-stats") {
+            httpCacheStats = true;
+        } else if (arg == "--db" && i + 1 < argc) {
+            dbDriver = argv[++i];
+        } else if (arg == "--db-init" && i + 1 < argc) {
+            dbInit = argv[++i];
+        } else if (arg == "--db-cache-size" && i + 1 < argc) {
+            dbCacheSize = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--db-stats") {
+            dbStats = true;
+        } else if (arg == "--cache-dir" && i + 1 < argc) {
+            cacheDir = argv[++i];
+        } else if (arg == "--fcgi" && i + 1 < argc) {
+            fcgiAddress = argv[++i];
+        } else if (arg == "--document-root" && i + 1 < argc) {
+            documentRoot = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            workers = std::atoi(argv[++i]);
+        } else if (arg == "--flush-threshold" && i + 1 < argc) {
+            flushThreshold = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--parallel-lex") {
+            parallelLex = true;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchList = argv[++i];
+        } else if (arg == "--vars" && i + 1 < argc) {
+            batchVars = argv[++i];
+        } else if (arg == "--out-dir" && i + 1 < argc) {
+            outDir = argv[++i];
+        } else if (arg == "--jobs" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            jobs = std::atoi(argv[++i]);
+        } else if (arg == "--emit-cpp" && i + 1 < argc) {
+            emitFile = argv[++i];
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profileFile = argv[++i];
+        } else if (arg == "--mem-stats") {
+            memStats = true;
+        } else if (arg == "--mem-stats-lines") {
+            memStats = true;
+            memLines = true;
+        } else if (!fileName && arg[0] != '-') {
+            fileName = argv[i];
+        } else {
+            fileName = nullptr;
+            break;
+        }
+    }
+    // Сводка выделений памяти по фазам выводится при выходе из процесса
+    if (memStats) {
+        if (!MemStats::compiled) {
+            std::cerr << "Allocation tracking is not built in, rebuild with make MEM_STATS=1" << std::endl;
+        }
+        MemStats::reportAtExit();
+    }
+
+    // Кэш ответов http(), общий для всех отрисовок процесса
+    HttpCache::shared().configure(httpCacheTtl, httpCacheStale, httpCacheSize);
+
+    // Пул соединений с базой данных, общий для всех отрисовок
+    std::unique_ptr<DbPool> pool;
+    DbPool* database = &DbPool::shared();
+    if (dbDriver) {
+        std::unique_ptr<DbDriver> driver = makeDbDriver(dbDriver);
+        if (!driver) {
+            std::cerr << "Unknown database driver: " << dbDriver << std::endl;
+            return 1;
+        }
+        pool = std::make_unique<DbPool>(std::move(driver));
+        database = pool.get();
+    }
+    database->setCacheCapacity(dbCacheSize);
+    // Начальные данные загружаются до запуска воркеров, те получают их копию
+    if (dbInit) {
+        std::ifstream script(dbInit);
+        if (!script) {
+            std::cerr << "Unable to open file: " << dbInit << std::endl;
+            return 1;
+        }
+        std::string text{(std::istreambuf_iterator<char>(script)), std::istreambuf_iterator<char>()};
+        std::string error;
+        if (!database->executeScript(text, error)) {
+            std::cerr << "Database error: " << error << std::endl;
+            return 1;
+        }
+    }
+
+    // Объявлен после пула, чтобы напечатать счётчики до его уничтожения
+    StatsReport report;
+    report.httpCache = httpCacheStats;
+    report.database = dbStats ? database : nullptr;
+
+    // Режим FastCGI: шаблон берётся из параметров каждого запроса
+    if (fcgiAddress) {
+        if (fileName) {
+            std::cerr << "--fcgi takes the template from each request, not from the command line: " << fileName << std::endl;
+            return 1;
+        }
+        FcgiServer server(fcgiAddress, workers, flushThreshold);
+        server.setDatabase(*database);
+        server.setHttpBackend(httpBackend);
+        server.setHttpConcurrency(httpConcurrency);
+        server.setDocumentRoot(documentRoot);
+        return server.run();
+    }
+
+    // Пакетный режим: список шаблонов или один шаблон с таблицей переменных.
+    // Каждый шаблон компилируется один раз, отрисовки идут параллельно в свои файлы
+    if (batchList || (batchVars && fileName)) {
+        std::vector<BatchJob> batch;
+        bool loaded = batchList ? readBatchList(batchList, outDir, batch)
+                                : readBatchVariables(fileName, batchVars, outDir, batch);
+        if (!loaded) {
+            return 1;
+        }
+        BatchSettings settings;
+        settings.database = database;
+        settings.httpBackend = httpBackend;
+        settings.httpConcurrency = httpConcurrency;
+        settings.flushThreshold = flushThreshold;
+        std::unique_ptr<ThreadPool> ownPool;
+        if (jobs > 0) {
+            ownPool = std::make_unique<ThreadPool>(jobs);
+        }
+        size_t failed = renderBatch(batch, settings, ownPool ? *ownPool : ThreadPool::shared());
+        return failed == 0 ? 0 : 1;
+    }
+
+    if (!fileName) {
+        std::cerr << "Usage: " << argv[0] << " [--ast] [--dump-vars] [--no-optimize] [--opt-report] [--http-curl] [--http-concurrency <n>]" << std::endl;
+        std::cerr << "       " << std::string(std::strlen(argv[0]), ' ') << " [--http-cache-ttl <s>] [--http-cache-stale <s>] [--http-cache-size <bytes>] [--http-cache-stats]" << std::endl;
+        std::cerr << "       " << std::string(std::strlen(argv[0]), ' ') << " [--db <memory|echo|trace>] [--db-init <file.sql>] [--db-cache-size <bytes>] [--db-stats]" << std::endl;
+        std::cerr << "       " << std::string(std::strlen(argv[0]), ' ') << " [--cache-dir <dir>] [--flush-threshold <bytes>] [--profile <prefix>] [--mem-stats] [--mem-stats-lines]" << std::endl;
+        std::cerr << "       " << std::string(std::strlen(argv[0]), ' ') << " [--stream] [--parallel-lex] <file_name>" << std::endl;
+        std::cerr << "       " << std::string(std::strlen(argv[0]), ' ') << " (--profile and --mem-stats-lines mark every statement: the template cache and db batching are off)" << std::endl;
+        std::cerr << "       " << argv[0] << " --batch <list> [--out-dir <dir>] [--jobs <n>] [--db <driver>] [--db-init <file>]" << std::endl;
+        std::cerr << "       " << argv[0] << " --emit-cpp <file.cpp> [--no-optimize] <file_name>" << std::endl;
+        std::cerr << "       " << argv[0] << " --vars <file.tsv> [--out-dir <dir>] [--jobs <n>] <file_name>" << std::endl;
+        std::cerr << "       " << argv[0] << " --fcgi <socket|host:port> [--workers <n>] [--flush-threshold <bytes>] [--db <driver>] [--db-init <file>]" << std::endl;
+        std::cerr << "       " << std::string(std::strlen(argv[0]), ' ') << " [--document-root <dir>] [--http-curl] [--http-concurrency <n>]" << std::endl;
         return 1;
     }
 
-    // Открыть файл
-    std::ifstream file(argv[1]);
-    if (!file) {
-        std::cerr << "Unable to open file: " << argv[1] << std::endl;
+    // Потоковый режим для очень больших шаблонов: файл читается порциями,
+    // каждая пачка операторов исполняется до чтения следующей, и память
+    // ограничена размером пачки. Оптимизатор, кэш и профилировщик не используются
+    if (stream && !emitFile) {
+        std::ifstream file(fileName, std::ios::binary);
+        if (!file) {
+            std::cerr << "Unable to open file: " << fileName << std::endl;
+            return 1;
+        }
+        FdSink sink(STDOUT_FILENO);
+        OutputBuffer output(sink, flushThreshold);
+        // Таблица символов растёт по мере разбора, declare() переключает на неё
+        SymbolTable none;
+        Interpreter interpreter(none, output);
+        interpreter.setHttpBackend(httpBackend);
+        interpreter.setHttpConcurrency(httpConcurrency);
+        interpreter.setDatabase(*database);
+        // Профилировщика здесь нет, фазы для --mem-stats задаются напрямую
+        Tokenizer tokenizer(file);
+        Resolver resolver;
+        std::vector<Token> tokens;
+        for (;;) {
+            MemStats::phase("tokenize");
+            if (!tokenizer.nextStatements(tokens)) {
+                break;
+            }
+            MemStats::phase("parse");
+            Parser parser(tokens, tokenizer.buffer());
+            Ast ast = parser.parse();
+            MemStats::phase("resolve");
+            interpreter.declare(resolver.extend(ast));
+            MemStats::phase("execute");
+            interpreter.execute(ast);
+        }
+        MemStats::phase("execute");
+        interpreter.finish();
+        MemStats::phase("flush");
+        output.flush();
+        MemStats::phase(nullptr);
+        if (dumpVars) {
+            interpreter.dumpVariables(std::cerr);
+        }
+        return 0;
+    }
+
+    // Профилировщик пишет <prefix>.json и <prefix>.folded; выключенный ничего не делает.
+    // Для учёта памяти по строкам он включается без записи отчёта: строки
+    // берутся из его отметок операторов. Поэтому с --mem-stats-lines, как и
+    // с --profile, кэш шаблонов и объединение запросов к базе выключены,
+    // и измеряется путь без них (см. текст справки)
+    Profiler profiler(profileFile != nullptr || memLines);
+    profiler.phase("read");
+
+    // Отобразить файл в память: токены, узлы AST и статический текст
+    // ссылаются на его страницы без копирования
+    SourceFile sourceFile;
+    if (!sourceFile.open(fileName)) {
+        std::cerr << "Unable to open file: " << fileName << std::endl;
         return 1;
     }
-    
-    // Прочитать файл в строку
-    std::string source{(std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()};
+    std::string_view source = sourceFile.text();
+
+    // Вывод копится в буфере и уходит в stdout порциями не меньше порога
+    FdSink sink(STDOUT_FILENO);
+    OutputBuffer output(sink, flushThreshold);
+
+    // Взять скомпилированный шаблон из кэша, если исходник не менялся.
+    // Ключ учитывает --no-optimize. При профилировании кэш не используется:
+    // нужны отметки операторов; с --opt-report шаблон компилируется заново,
+    // чтобы было что выводить в отчёте
+    CacheKey cacheKey;
+    if (cacheDir) {
+        cacheKey = makeCacheKey(fileName, source, optimize);
+    }
+    if (cacheDir && !treeWalk && !profiler.isEnabled() && !emitFile && !optimizerReport) {
+        TemplateCache cache(cacheDir);
+        MappedProgram cached;
+        if (cache.load(cacheKey, cached)) {
+            Interpreter interpreter(cached.symbols(), output);
+            interpreter.setHttpBackend(httpBackend);
+            interpreter.setHttpConcurrency(httpConcurrency);
+            interpreter.setDatabase(*database);
+            profiler.phase("execute");
+            renderOnLoop(interpreter, cached.view());
+            // Статический текст ссылается на отображённый файл кэша
+            profiler.phase("flush");
+            output.flush();
+            profiler.phase(nullptr);
+            if (dumpVars) {
+                interpreter.dumpVariables(std::cerr);
+            }
+            return 0;
+        }
+    }
 
     // Конструктор класса Tokenizer
+    profiler.phase("tokenize");
     Tokenizer tokenizer{source};
-    std::vector<Token> tokens = tokenizer.tokenize();
+    // Островки PHP большого файла можно разбирать параллельно, результат тот же
+    std::vector<Token> tokens = parallelLex ? tokenizer.tokenize(ThreadPool::shared()) : tokenizer.tokenize();
 /*
     // Вывести на экран список токенов
     for (size_t i = 0; i < tokens.size(); ++i) {
@@ -36,15 +380,93 @@ int main(int argc, char *argv[]) {
     }
 */
     // Конструктор класса Parser
-    Parser parser(tokens);
-    std::vector<std::unique_ptr<ASTNode>> nodes = parser.parse();
+    profiler.phase("parse");
+    Parser parser(tokens, source);
+    Ast ast = parser.parse();
 /*
     // Вывести на экран содержимое AST
-    Parser::printAST(nodes);
+    Parser::printAST(ast);
 */    
+    // Назначить переменным слоты фрейма
+    profiler.phase("resolve");
+    Resolver resolver;
+    SymbolTable symbols = resolver.resolve(ast);
+
+    // Свернуть константные выражения и статический вывод
+    if (optimize) {
+        profiler.phase("optimize");
+        Optimizer optimizer;
+        Optimizer::Stats stats = optimizer.optimize(ast, symbols);
+        if (optimizerReport) {
+            std::cerr << "Optimizer: " << stats.nodesBefore << " -> " << stats.nodesAfter << " nodes, "
+                      << stats.eliminated() << " eliminated; " << stats.folded << " expressions folded, "
+                      << stats.propagated << " variable uses propagated, " << stats.staticEchoes
+                      << " echoes made static, " << stats.mergedTexts << " text chunks merged" << std::endl;
+        }
+    }
+
+    // Трансляция шаблона в C++ вместо исполнения; результат собирается
+    // вместе с библиотекой среды исполнения (make native)
+    if (emitFile) {
+        std::ofstream file(emitFile);
+        if (!file) {
+            std::cerr << "Unable to open file: " << emitFile << std::endl;
+            return 1;
+        }
+        CppEmitter emitter;
+        emitter.emit(ast, symbols, fileName, file);
+        return file.flush() ? 0 : 1;
+    }
+
     // Конструктор класса Interpreter
-    Interpreter interpreter;
-    interpreter.interpret(nodes);
+    Interpreter interpreter(symbols, output);
+    interpreter.setHttpBackend(httpBackend);
+    interpreter.setHttpConcurrency(httpConcurrency);
+    interpreter.setDatabase(*database);
+    if (profiler.isEnabled()) {
+        interpreter.setProfiler(profiler);
+    }
+    if (treeWalk) {
+        // Обход AST без компиляции, для сравнения вывода
+        profiler.phase("execute");
+        profiler.setStatements(ast);
+        interpreter.interpret(ast);
+        profiler.phase("flush");
+    } else {
+        // Компиляция AST в байткод
+        profiler.phase("compile");
+        Compiler compiler;
+        compiler.setProfiling(profiler.isEnabled());
+        // Без кэша текст шаблона выводится прямо из отображённого файла
+        bool storeInCache = cacheDir && !profiler.isEnabled();
+        if (!storeInCache) {
+            compiler.setSource(source);
+        }
+        Program program = compiler.compile(ast, symbols);
+        if (storeInCache) {
+            TemplateCache(cacheDir).store(cacheKey, program);
+        }
+/*
+        // Вывести на экран байткод
+        Compiler::printProgram(program.view(), program.symbols);
+*/
+        profiler.phase("execute");
+        profiler.setStatements(ast);
+        renderOnLoop(interpreter, program.view());
+        // Статический текст ссылается на строки программы
+        profiler.phase("flush");
+        output.flush();
+    }
+    output.flush();
+    profiler.phase(nullptr);
+    if (profileFile && !profiler.save(profileFile)) {
+        return 1;
+    }
+
+    // Вывести значения переменных
+    if (dumpVars) {
+        interpreter.dumpVariables(std::cerr);
+    }
 
     return 0;
 }
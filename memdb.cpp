@@ -0,0 +1,662 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <mutex>
+
+#include "memdb.h"
+
+
+struct SqlToken {
+    enum Kind { WORD, NUMBER, STRING, SYMBOL, PARAM, END };
+    Kind kind;
+    std::string text;      // lowercased for words
+    Value value;           // numbers and strings
+};
+
+
+static bool tokenizeSql(const std::string& query, std::vector<SqlToken>& tokens, std::string& error) {
+    size_t i = 0;
+    while (i < query.size()) {
+        char c = query[i];
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            i++;
+        } else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+            size_t start = i;
+            while (i < query.size() && (std::isalnum(static_cast<unsigned char>(query[i])) || query[i] == '_')) {
+                i++;
+            }
+            std::string word = query.substr(start, i - start);
+            std::transform(word.begin(), word.end(), word.begin(),
+                           [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+            tokens.push_back({SqlToken::WORD, word, Value{}});
+        } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+                   (c == '.' && i + 1 < query.size() && std::isdigit(static_cast<unsigned char>(query[i + 1])))) {
+            size_t start = i;
+            while (i < query.size() && (std::isdigit(static_cast<unsigned char>(query[i])) || query[i] == '.')) {
+                i++;
+            }
+            std::string number = query.substr(start, i - start);
+            tokens.push_back({SqlToken::NUMBER, number, parseNumber(number)});
+        } else if (c == '\'') {
+            // '' inside a string is a quote
+            std::string text;
+            i++;
+            for (;;) {
+                if (i >= query.size()) {
+                    error = "unterminated string";
+                    return false;
+                }
+                if (query[i] == '\'') {
+                    if (i + 1 < query.size() && query[i + 1] == '\'') {
+                        text += '\'';
+                        i += 2;
+                        continue;
+                    }
+                    i++;
+                    break;
+                }
+                text += query[i++];
+            }
+            tokens.push_back({SqlToken::STRING, text, text});
+        } else if (c == '?') {
+            tokens.push_back({SqlToken::PARAM, "?", Value{}});
+            i++;
+        } else if ((c == '<' || c == '>' || c == '!') && i + 1 < query.size() &&
+                   (query[i + 1] == '=' || (c == '<' && query[i + 1] == '>'))) {
+            tokens.push_back({SqlToken::SYMBOL, query.substr(i, 2), Value{}});
+            i += 2;
+        } else if (std::string("(),*=<>;-").find(c) != std::string::npos) {
+            tokens.push_back({SqlToken::SYMBOL, std::string(1, c), Value{}});
+            i++;
+        } else {
+            error = std::string("unexpected character '") + c + "'";
+            return false;
+        }
+    }
+    tokens.push_back({SqlToken::END, "", Value{}});
+    return true;
+}
+
+
+// Literal or '?' placeholder
+struct SqlOperand {
+    bool isParam = false;
+    uint32_t param = 0;
+    Value literal;
+};
+
+
+struct SqlCondition {
+    std::string column;
+    std::string op;
+    SqlOperand operand;
+};
+
+
+struct SqlQuery {
+    enum Kind { CREATE, DROP, INSERT, SELECT, UPDATE, DELETE };
+    Kind kind = SELECT;
+    std::string table;
+    bool ifExists = false;                 // IF EXISTS / IF NOT EXISTS
+    std::vector<std::string> columns;      // created, inserted or selected; empty for *
+    bool count = false;
+    std::vector<std::vector<SqlOperand>> values;
+    std::vector<std::pair<std::string, SqlOperand>> assignments;
+    std::vector<SqlCondition> where;
+    std::string orderBy;
+    bool descending = false;
+    int64_t limit = -1;
+    uint32_t paramCount = 0;
+};
+
+
+// Recursive descent over the token list
+class SqlParser {
+public:
+    explicit SqlParser(const std::vector<SqlToken>& tokens) : tokens(tokens) {}
+
+    bool parse(SqlQuery& query, std::string& error);
+
+private:
+    const SqlToken& peek() const { return tokens[position]; }
+    bool accept(const char* text);
+    bool expect(const char* text, std::string& error);
+    bool name(std::string& out, std::string& error);
+    bool operand(SqlQuery& query, SqlOperand& out, std::string& error);
+    bool where(SqlQuery& query, std::string& error);
+
+    const std::vector<SqlToken>& tokens;
+    size_t position = 0;
+};
+
+
+bool SqlParser::accept(const char* text) {
+    if ((peek().kind == SqlToken::WORD || peek().kind == SqlToken::SYMBOL) && peek().text == text) {
+        position++;
+        return true;
+    }
+    return false;
+}
+
+
+bool SqlParser::expect(const char* text, std::string& error) {
+    if (accept(text)) {
+        return true;
+    }
+    error = std::string("expected ") + text + (peek().kind == SqlToken::END ? " at end" : " near '" + peek().text + "'");
+    return false;
+}
+
+
+bool SqlParser::name(std::string& out, std::string& error) {
+    if (peek().kind != SqlToken::WORD) {
+        error = "expected a name" + (peek().kind == SqlToken::END ? std::string(" at end") : " near '" + peek().text + "'");
+        return false;
+    }
+    out = peek().text;
+    position++;
+    return true;
+}
+
+
+bool SqlParser::operand(SqlQuery& query, SqlOperand& out, std::string& error) {
+    bool negative = accept("-");
+    const SqlToken& token = peek();
+    if (token.kind == SqlToken::PARAM && !negative) {
+        out.isParam = true;
+        out.param = query.paramCount++;
+    } else if (token.kind == SqlToken::NUMBER) {
+        out.literal = negative ? binaryOperation('-', int64_t{0}, token.value) : token.value;
+    } else if (token.kind == SqlToken::STRING && !negative) {
+        out.literal = token.value;
+    } else if (token.kind == SqlToken::WORD && token.text == "null" && !negative) {
+        out.literal = Value{};
+    } else {
+        error = "expected a value" + (token.kind == SqlToken::END ? std::string(" at end") : " near '" + token.text + "'");
+        return false;
+    }
+    position++;
+    return true;
+}
+
+
+bool SqlParser::where(SqlQuery& query, std::string& error) {
+    if (!accept("where")) {
+        return true;
+    }
+    do {
+        SqlCondition condition;
+        if (!name(condition.column, error)) {
+            return false;
+        }
+        static const char* operators[] = {"=", "!=", "<>", "<=", ">=", "<", ">"};
+        for (const char* op : operators) {
+            if (accept(op)) {
+                condition.op = op;
+                break;
+            }
+        }
+        if (condition.op.empty()) {
+            error = "expected a comparison after " + condition.column;
+            return false;
+        }
+        if (!operand(query, condition.operand, error)) {
+            return false;
+        }
+        query.where.push_back(std::move(condition));
+    } while (accept("and"));
+    return true;
+}
+
+
+bool SqlParser::parse(SqlQuery& query, std::string& error) {
+    if (accept("create")) {
+        query.kind = SqlQuery::CREATE;
+        if (!expect("table", error)) {
+            return false;
+        }
+        if (accept("if")) {
+            if (!expect("not", error) || !expect("exists", error)) {
+                return false;
+            }
+            query.ifExists = true;
+        }
+        if (!name(query.table, error) || !expect("(", error)) {
+            return false;
+        }
+        do {
+            std::string column;
+            if (!name(column, error)) {
+                return false;
+            }
+            // Type names and constraints are accepted and ignored
+            while (peek().kind == SqlToken::WORD) {
+                position++;
+            }
+            query.columns.push_back(column);
+        } while (accept(","));
+        if (!expect(")", error)) {
+            return false;
+        }
+    } else if (accept("drop")) {
+        query.kind = SqlQuery::DROP;
+        if (!expect("table", error)) {
+            return false;
+        }
+        if (accept("if")) {
+            if (!expect("exists", error)) {
+                return false;
+            }
+            query.ifExists = true;
+        }
+        if (!name(query.table, error)) {
+            return false;
+        }
+    } else if (accept("insert")) {
+        query.kind = SqlQuery::INSERT;
+        if (!expect("into", error) || !name(query.table, error)) {
+            return false;
+        }
+        if (accept("(")) {
+            do {
+                std::string column;
+                if (!name(column, error)) {
+                    return false;
+                }
+                query.columns.push_back(column);
+            } while (accept(","));
+            if (!expect(")", error)) {
+                return false;
+            }
+        }
+        if (!expect("values", error)) {
+            return false;
+        }
+        do {
+            if (!expect("(", error)) {
+                return false;
+            }
+            std::vector<SqlOperand> row;
+            do {
+                SqlOperand value;
+                if (!operand(query, value, error)) {
+                    return false;
+                }
+                row.push_back(std::move(value));
+            } while (accept(","));
+            if (!expect(")", error)) {
+                return false;
+            }
+            query.values.push_back(std::move(row));
+        } while (accept(","));
+    } else if (accept("select")) {
+        query.kind = SqlQuery::SELECT;
+        if (accept("count")) {
+            if (!expect("(", error) || !expect("*", error) || !expect(")", error)) {
+                return false;
+            }
+            query.count = true;
+        } else if (!accept("*")) {
+            do {
+                std::string column;
+                if (!name(column, error)) {
+                    return false;
+                }
+                query.columns.push_back(column);
+            } while (accept(","));
+        }
+        if (!expect("from", error) || !name(query.table, error) || !where(query, error)) {
+            return false;
+        }
+        if (accept("order")) {
+            if (!expect("by", error) || !name(query.orderBy, error)) {
+                return false;
+            }
+            if (accept("desc")) {
+                query.descending = true;
+            } else {
+                accept("asc");
+            }
+        }
+        if (accept("limit")) {
+            if (peek().kind != SqlToken::NUMBER || !std::holds_alternative<int64_t>(peek().value)) {
+                error = "expected a number after LIMIT";
+                return false;
+            }
+            query.limit = std::get<int64_t>(peek().value);
+            position++;
+        }
+    } else if (accept("update")) {
+        query.kind = SqlQuery::UPDATE;
+        if (!name(query.table, error) || !expect("set", error)) {
+            return false;
+        }
+        do {
+            std::pair<std::string, SqlOperand> assignment;
+            if (!name(assignment.first, error) || !expect("=", error) ||
+                !operand(query, assignment.second, error)) {
+                return false;
+            }
+            query.assignments.push_back(std::move(assignment));
+        } while (accept(","));
+        if (!where(query, error)) {
+            return false;
+        }
+    } else if (accept("delete")) {
+        query.kind = SqlQuery::DELETE;
+        if (!expect("from", error) || !name(query.table, error) || !where(query, error)) {
+            return false;
+        }
+    } else {
+        error = "unsupported statement" + (peek().kind == SqlToken::END ? std::string() : " '" + peek().text + "'");
+        return false;
+    }
+    accept(";");
+    if (peek().kind != SqlToken::END) {
+        error = "unexpected '" + peek().text + "'";
+        return false;
+    }
+    return true;
+}
+
+
+// Numbers compare numerically, with numeric strings read as numbers;
+// anything else compares as strings. Nothing compares with NULL.
+static bool compareValues(const Value& left, const Value& right, int& order) {
+    if (std::holds_alternative<std::monostate>(left) || std::holds_alternative<std::monostate>(right)) {
+        return false;
+    }
+    auto numeric = [](const Value& value) {
+        auto text = std::get_if<std::string>(&value);
+        return !text || isNumericString(*text);
+    };
+    if (numeric(left) && numeric(right) &&
+        !(std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right))) {
+        Value a = toNumber(left);
+        Value b = toNumber(right);
+        auto ai = std::get_if<int64_t>(&a);
+        auto bi = std::get_if<int64_t>(&b);
+        if (ai && bi) {
+            order = *ai < *bi ? -1 : (*ai > *bi ? 1 : 0);
+        } else {
+            double x = ai ? static_cast<double>(*ai) : std::get<double>(a);
+            double y = bi ? static_cast<double>(*bi) : std::get<double>(b);
+            order = x < y ? -1 : (x > y ? 1 : 0);
+        }
+        return true;
+    }
+    int result = toString(left).compare(toString(right));
+    order = result < 0 ? -1 : (result > 0 ? 1 : 0);
+    return true;
+}
+
+
+static bool matches(const std::string& op, int order) {
+    if (op == "=") return order == 0;
+    if (op == "!=" || op == "<>") return order != 0;
+    if (op == "<") return order < 0;
+    if (op == "<=") return order <= 0;
+    if (op == ">") return order > 0;
+    return order >= 0;
+}
+
+
+class MemoryStatement : public DbStatement {
+public:
+    MemoryStatement(std::shared_ptr<MemoryDatabase> database, SqlQuery query)
+        : database(std::move(database)), query(std::move(query)) {}
+
+    bool execute(const std::vector<Value>& params, DbResult& result, std::string& error) override;
+
+private:
+    const Value& bind(const SqlOperand& operand, const std::vector<Value>& params) const {
+        return operand.isParam ? params[operand.param] : operand.literal;
+    }
+    bool columnIndex(const MemoryTable& table, const std::string& name, size_t& index, std::string& error) const;
+    bool filter(const MemoryTable& table, const std::vector<Value>& params,
+                std::vector<size_t>& rows, std::string& error) const;
+    bool select(const MemoryTable& table, const std::vector<Value>& params, DbResult& result, std::string& error);
+
+    std::shared_ptr<MemoryDatabase> database;
+    SqlQuery query;
+};
+
+
+bool MemoryStatement::columnIndex(const MemoryTable& table, const std::string& name,
+                                  size_t& index, std::string& error) const {
+    auto it = std::find(table.columns.begin(), table.columns.end(), name);
+    if (it == table.columns.end()) {
+        error = "no such column: " + name;
+        return false;
+    }
+    index = static_cast<size_t>(it - table.columns.begin());
+    return true;
+}
+
+
+// Indexes of the rows that satisfy the WHERE clause
+bool MemoryStatement::filter(const MemoryTable& table, const std::vector<Value>& params,
+                             std::vector<size_t>& rows, std::string& error) const {
+    std::vector<size_t> columns(query.where.size());
+    for (size_t i = 0; i < query.where.size(); ++i) {
+        if (!columnIndex(table, query.where[i].column, columns[i], error)) {
+            return false;
+        }
+    }
+    for (size_t row = 0; row < table.rows.size(); ++row) {
+        bool match = true;
+        for (size_t i = 0; i < query.where.size() && match; ++i) {
+            int order = 0;
+            match = compareValues(table.rows[row][columns[i]], bind(query.where[i].operand, params), order) &&
+                    matches(query.where[i].op, order);
+        }
+        if (match) {
+            rows.push_back(row);
+        }
+    }
+    return true;
+}
+
+
+bool MemoryStatement::select(const MemoryTable& table, const std::vector<Value>& params,
+                             DbResult& result, std::string& error) {
+    std::vector<size_t> rows;
+    if (!filter(table, params, rows, error)) {
+        return false;
+    }
+    if (query.count) {
+        result.columns.push_back("count");
+        result.rows.push_back({static_cast<int64_t>(rows.size())});
+        return true;
+    }
+
+    std::vector<size_t> columns;
+    if (query.columns.empty()) {
+        for (size_t i = 0; i < table.columns.size(); ++i) {
+            columns.push_back(i);
+        }
+    } else {
+        for (const std::string& name : query.columns) {
+            size_t index;
+            if (!columnIndex(table, name, index, error)) {
+                return false;
+            }
+            columns.push_back(index);
+        }
+    }
+    if (!query.orderBy.empty()) {
+        size_t key;
+        if (!columnIndex(table, query.orderBy, key, error)) {
+            return false;
+        }
+        // NULLs sort first
+        std::stable_sort(rows.begin(), rows.end(), [&](size_t a, size_t b) {
+            const Value& x = table.rows[a][key];
+            const Value& y = table.rows[b][key];
+            int order = 0;
+            if (!compareValues(x, y, order)) {
+                order = std::holds_alternative<std::monostate>(x) - std::holds_alternative<std::monostate>(y);
+                order = -order;
+            }
+            return query.descending ? order > 0 : order < 0;
+        });
+    }
+    if (query.limit >= 0 && rows.size() > static_cast<size_t>(query.limit)) {
+        rows.resize(static_cast<size_t>(query.limit));
+    }
+
+    for (size_t index : columns) {
+        result.columns.push_back(table.columns[index]);
+    }
+    result.rows.reserve(rows.size());
+    for (size_t row : rows) {
+        std::vector<Value> values;
+        values.reserve(columns.size());
+        for (size_t index : columns) {
+            values.push_back(table.rows[row][index]);
+        }
+        result.rows.push_back(std::move(values));
+    }
+    return true;
+}
+
+
+bool MemoryStatement::execute(const std::vector<Value>& params, DbResult& result, std::string& error) {
+    result = DbResult{};
+    if (params.size() != query.paramCount) {
+        error = "expected " + std::to_string(query.paramCount) + " parameters, got " + std::to_string(params.size());
+        return false;
+    }
+
+    if (query.kind == SqlQuery::SELECT) {
+        std::shared_lock<std::shared_mutex> lock(database->mutex);
+        auto it = database->tables.find(query.table);
+        if (it == database->tables.end()) {
+            error = "no such table: " + query.table;
+            return false;
+        }
+        return select(it->second, params, result, error);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(database->mutex);
+    auto it = database->tables.find(query.table);
+    if (query.kind == SqlQuery::CREATE) {
+        if (it != database->tables.end()) {
+            if (query.ifExists) {
+                return true;
+            }
+            error = "table " + query.table + " already exists";
+            return false;
+        }
+        database->tables[query.table].columns = query.columns;
+        return true;
+    }
+    if (it == database->tables.end()) {
+        if (query.kind == SqlQuery::DROP && query.ifExists) {
+            return true;
+        }
+        error = "no such table: " + query.table;
+        return false;
+    }
+    MemoryTable& table = it->second;
+
+    switch (query.kind) {
+        case SqlQuery::DROP:
+            database->tables.erase(it);
+            return true;
+        case SqlQuery::INSERT: {
+            std::vector<size_t> columns;
+            for (const std::string& name : query.columns) {
+                size_t index;
+                if (!columnIndex(table, name, index, error)) {
+                    return false;
+                }
+                columns.push_back(index);
+            }
+            size_t width = columns.empty() ? table.columns.size() : columns.size();
+            for (const std::vector<SqlOperand>& values : query.values) {
+                if (values.size() != width) {
+                    error = "expected " + std::to_string(width) + " values, got " + std::to_string(values.size());
+                    return false;
+                }
+            }
+            for (const std::vector<SqlOperand>& values : query.values) {
+                std::vector<Value> row(table.columns.size());
+                for (size_t i = 0; i < values.size(); ++i) {
+                    row[columns.empty() ? i : columns[i]] = bind(values[i], params);
+                }
+                table.rows.push_back(std::move(row));
+            }
+            result.affected = query.values.size();
+            return true;
+        }
+        case SqlQuery::UPDATE: {
+            std::vector<size_t> columns;
+            for (const auto& assignment : query.assignments) {
+                size_t index;
+                if (!columnIndex(table, assignment.first, index, error)) {
+                    return false;
+                }
+                columns.push_back(index);
+            }
+            std::vector<size_t> rows;
+            if (!filter(table, params, rows, error)) {
+                return false;
+            }
+            for (size_t row : rows) {
+                for (size_t i = 0; i < columns.size(); ++i) {
+                    table.rows[row][columns[i]] = bind(query.assignments[i].second, params);
+                }
+            }
+            result.affected = rows.size();
+            return true;
+        }
+        case SqlQuery::DELETE: {
+            std::vector<size_t> rows;
+            if (!filter(table, params, rows, error)) {
+                return false;
+            }
+            // rows is ascending; keep everything not listed
+            size_t next = 0, kept = 0;
+            for (size_t row = 0; row < table.rows.size(); ++row) {
+                if (next < rows.size() && rows[next] == row) {
+                    next++;
+                } else {
+                    if (kept != row) {
+                        table.rows[kept] = std::move(table.rows[row]);
+                    }
+                    kept++;
+                }
+            }
+            table.rows.resize(kept);
+            result.affected = rows.size();
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+
+class MemoryConnection : public DbConnection {
+public:
+    explicit MemoryConnection(std::shared_ptr<MemoryDatabase> database) : database(std::move(database)) {}
+
+protected:
+    std::unique_ptr<DbStatement> prepare(const std::string& text, std::string& error) override {
+        std::vector<SqlToken> tokens;
+        SqlQuery query;
+        if (!tokenizeSql(text, tokens, error) || !SqlParser(tokens).parse(query, error)) {
+            return nullptr;
+        }
+        return std::make_unique<MemoryStatement>(database, std::move(query));
+    }
+
+private:
+    std::shared_ptr<MemoryDatabase> database;
+};
+
+
+std::unique_ptr<DbConnection> MemoryDriver::connect(std::string&) {
+    return std::make_unique<MemoryConnection>(database);
+}
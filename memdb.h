@@ -0,0 +1,49 @@
+#ifndef MEMDB_H
+#define MEMDB_H
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "db.h"
+
+
+// Tables of the built-in store; column types are not enforced, a column
+// holds whatever value was inserted, as in SQLite
+struct MemoryTable {
+    std::vector<std::string> columns;
+    std::vector<std::vector<Value>> rows;
+};
+
+
+struct MemoryDatabase {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, MemoryTable> tables;
+};
+
+
+// MemoryDriver class: process-local table store behind a small SQL dialect.
+// All connections of a driver see the same tables. Supported statements:
+//
+//   CREATE TABLE [IF NOT EXISTS] t (a, b INTEGER, ...)
+//   DROP TABLE [IF EXISTS] t
+//   INSERT INTO t [(a, b)] VALUES (1, 'x'), (?, ?)
+//   SELECT * | COUNT(*) | a, b FROM t [WHERE a = 1 AND b > ?]
+//          [ORDER BY a [ASC | DESC]] [LIMIT n]
+//   UPDATE t SET a = 1, b = ? [WHERE ...]
+//   DELETE FROM t [WHERE ...]
+//
+// Comparisons are =, !=, <>, <, <=, >, >=; names are case-insensitive.
+class MemoryDriver : public DbDriver {
+public:
+    MemoryDriver() : database(std::make_shared<MemoryDatabase>()) {}
+
+    std::unique_ptr<DbConnection> connect(std::string& error) override;
+
+private:
+    std::shared_ptr<MemoryDatabase> database;
+};
+
+#endif // MEMDB_H
@@ -0,0 +1,228 @@
+#ifdef PHP_MEM_STATS
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include "memstats.h"
+
+
+// Everything here is reached from operator new, so nothing may allocate:
+// the tables are fixed arrays of atomics, constant-initialized before any
+// other static constructor runs.
+namespace {
+
+const size_t MAX_PHASES = 32;
+// Lines past the last one share its counters
+const uint32_t MAX_LINES = 1 << 16;
+const size_t TOP_LINES = 10;
+
+struct Counters {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+    // Allocated in the phase and not yet freed
+    std::atomic<uint64_t> live{0};
+    // Most bytes live in the whole process while the phase was current
+    std::atomic<uint64_t> peak{0};
+};
+
+// Every block starts with its size and phase, so that operator delete can
+// give the bytes back to the phase that allocated them
+struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Header {
+    size_t size;
+    size_t phase;
+};
+
+// Phase 0 collects allocations made outside any phase
+const char* phaseNames[MAX_PHASES] = {"other"};
+Counters phases[MAX_PHASES];
+size_t phaseCount = 1;
+std::mutex phaseMutex;
+// Per thread, so that concurrent renders do not switch each other's phase;
+// threads that never set one count under "other"
+thread_local size_t currentPhase = 0;
+
+std::atomic<bool> reportRequested{false};
+
+std::atomic<uint64_t> totalLive{0};
+std::atomic<uint64_t> totalPeak{0};
+
+thread_local uint32_t currentLine = 0;
+std::atomic<uint64_t> lineCounts[MAX_LINES];
+std::atomic<uint64_t> lineBytes[MAX_LINES];
+
+
+void raise(std::atomic<uint64_t>& peak, uint64_t value) {
+    uint64_t seen = peak.load(std::memory_order_relaxed);
+    while (seen < value && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+
+void* allocate(size_t size) {
+    Header* header = static_cast<Header*>(std::malloc(sizeof(Header) + size));
+    if (!header) {
+        throw std::bad_alloc();
+    }
+    size_t phase = currentPhase;
+    header->size = size;
+    header->phase = phase;
+
+    Counters& counters = phases[phase];
+    counters.count.fetch_add(1, std::memory_order_relaxed);
+    counters.bytes.fetch_add(size, std::memory_order_relaxed);
+    counters.live.fetch_add(size, std::memory_order_relaxed);
+    uint64_t live = totalLive.fetch_add(size, std::memory_order_relaxed) + size;
+    raise(totalPeak, live);
+    raise(counters.peak, live);
+
+    uint32_t line = currentLine;
+    if (line != 0) {
+        uint32_t index = line < MAX_LINES ? line : MAX_LINES - 1;
+        lineCounts[index].fetch_add(1, std::memory_order_relaxed);
+        lineBytes[index].fetch_add(size, std::memory_order_relaxed);
+    }
+    return header + 1;
+}
+
+void release(void* pointer) {
+    if (!pointer) {
+        return;
+    }
+    Header* header = static_cast<Header*>(pointer) - 1;
+    phases[header->phase].live.fetch_sub(header->size, std::memory_order_relaxed);
+    totalLive.fetch_sub(header->size, std::memory_order_relaxed);
+    std::free(header);
+}
+
+
+void report() {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < phaseCount; ++i) {
+        count += phases[i].count.load();
+        bytes += phases[i].bytes.load();
+    }
+    std::fprintf(stderr, "Memory: %llu allocations, %llu bytes, peak %llu bytes live\n",
+                 static_cast<unsigned long long>(count), static_cast<unsigned long long>(bytes),
+                 static_cast<unsigned long long>(totalPeak.load()));
+    for (size_t i = 0; i < phaseCount; ++i) {
+        const Counters& counters = phases[i];
+        if (counters.count.load() == 0) {
+            continue;
+        }
+        std::fprintf(stderr, "  %s: %llu allocations, %llu bytes, peak %llu bytes live, %llu bytes still live\n",
+                     phaseNames[i], static_cast<unsigned long long>(counters.count.load()),
+                     static_cast<unsigned long long>(counters.bytes.load()),
+                     static_cast<unsigned long long>(counters.peak.load()),
+                     static_cast<unsigned long long>(counters.live.load()));
+    }
+
+    // The lines that allocated the most bytes, largest first
+    uint32_t top[TOP_LINES];
+    size_t found = 0;
+    for (uint32_t line = 1; line < MAX_LINES; ++line) {
+        uint64_t lineTotal = lineBytes[line].load();
+        if (lineCounts[line].load() == 0) {
+            continue;
+        }
+        size_t position = found < TOP_LINES ? found++ : TOP_LINES;
+        while (position > 0 && lineBytes[top[position - 1]].load() < lineTotal) {
+            if (position < TOP_LINES) {
+                top[position] = top[position - 1];
+            }
+            --position;
+        }
+        if (position < TOP_LINES) {
+            top[position] = line;
+        }
+    }
+    for (size_t i = 0; i < found; ++i) {
+        std::fprintf(stderr, "  line %u%s: %llu allocations, %llu bytes\n", top[i],
+                     top[i] == MAX_LINES - 1 ? " and later" : "",
+                     static_cast<unsigned long long>(lineCounts[top[i]].load()),
+                     static_cast<unsigned long long>(lineBytes[top[i]].load()));
+    }
+}
+
+}  // namespace
+
+
+void MemStats::phase(const char* name) {
+    size_t index = 0;
+    if (name) {
+        std::lock_guard<std::mutex> lock(phaseMutex);
+        for (index = 1; index < phaseCount && std::strcmp(phaseNames[index], name) != 0; ++index) {
+        }
+        if (index == phaseCount) {
+            if (phaseCount == MAX_PHASES) {
+                index = 0;
+            } else {
+                phaseNames[phaseCount++] = name;
+            }
+        }
+    }
+    raise(phases[index].peak, totalLive.load(std::memory_order_relaxed));
+    currentPhase = index;
+}
+
+void MemStats::line(uint32_t line) {
+    currentLine = line;
+}
+
+MemStats::State MemStats::current() {
+    return State{currentPhase, currentLine};
+}
+
+void MemStats::restore(State state) {
+    currentPhase = state.phase;
+    currentLine = state.line;
+}
+
+void MemStats::reportAtExit() {
+    static std::once_flag registered;
+    std::call_once(registered, []() {
+        reportRequested = true;
+        std::atexit(report);
+    });
+}
+
+void MemStats::reportIfRequested() {
+    if (reportRequested) {
+        report();
+    }
+}
+
+
+// Replacements of the global allocation functions. The nothrow and
+// aligned forms of the standard library are left alone: the former call
+// these, the latter pair with their own operator delete.
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    release(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    release(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    release(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    release(pointer);
+}
+
+#endif // PHP_MEM_STATS
@@ -0,0 +1,52 @@
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+// MemStats class: heap allocations counted per pipeline phase and per
+// source line of the statement being executed. Built in with
+// make MEM_STATS=1 (PHP_MEM_STATS), which replaces the global operator
+// new and delete; otherwise every call below is an empty inline function
+// and the allocator is untouched. Phases are switched by
+// Profiler::phase() or directly at the boundaries of each mode, lines by
+// Profiler::statement(). Both are per thread; a coroutine keeps its own
+// across suspensions (see State).
+class MemStats {
+public:
+    // Phase and line current on a thread, saved by a coroutine when it
+    // suspends and by blocking work handed to another thread
+    struct State {
+        size_t phase = 0;
+        uint32_t line = 0;
+    };
+
+#ifdef PHP_MEM_STATS
+    static constexpr bool compiled = true;
+
+    // Allocations from now on belong to `name`, a string literal; nullptr
+    // attributes them to no phase
+    static void phase(const char* name);
+    // Line of the statement being executed, 0 outside statements
+    static void line(uint32_t line);
+    static State current();
+    static void restore(State state);
+    // Print the summary on stderr when the process exits
+    static void reportAtExit();
+    // Print it now if reportAtExit() was called, for processes that leave
+    // with _exit()
+    static void reportIfRequested();
+#else
+    static constexpr bool compiled = false;
+
+    static void phase(const char*) {}
+    static void line(uint32_t) {}
+    static State current() { return State(); }
+    static void restore(State) {}
+    static void reportAtExit() {}
+    static void reportIfRequested() {}
+#endif
+};
+
+#endif // MEMSTATS_H
@@ -0,0 +1,82 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+
+#include <unistd.h>
+
+#include "native.h"
+
+
+int runNativeTemplate(const NativeTemplate& compiled, int argc, char* argv[]) {
+    bool dumpVars = false;
+    HttpBackend httpBackend = HTTP_NATIVE;
+    size_t httpConcurrency = Runtime::DEFAULT_HTTP_CONCURRENCY;
+    size_t flushThreshold = OutputBuffer::DEFAULT_FLUSH_THRESHOLD;
+    const char* dbDriver = nullptr;
+    const char* dbInit = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--dump-vars") {
+            dumpVars = true;
+        } else if (arg == "--http-curl") {
+            httpBackend = HTTP_CURL;
+        } else if (arg == "--http-concurrency" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            httpConcurrency = std::atoi(argv[++i]);
+        } else if (arg == "--flush-threshold" && i + 1 < argc) {
+            flushThreshold = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--db" && i + 1 < argc) {
+            dbDriver = argv[++i];
+        } else if (arg == "--db-init" && i + 1 < argc) {
+            dbInit = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--dump-vars] [--http-curl] [--http-concurrency <n>] [--flush-threshold <bytes>]"
+                      << " [--db <memory|echo>] [--db-init <file.sql>]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<DbPool> pool;
+    DbPool* database = &DbPool::shared();
+    if (dbDriver) {
+        std::unique_ptr<DbDriver> driver = makeDbDriver(dbDriver);
+        if (!driver) {
+            std::cerr << "Unknown database driver: " << dbDriver << std::endl;
+            return 1;
+        }
+        pool = std::make_unique<DbPool>(std::move(driver));
+        database = pool.get();
+    }
+    if (dbInit) {
+        std::ifstream script(dbInit);
+        if (!script) {
+            std::cerr << "Unable to open file: " << dbInit << std::endl;
+            return 1;
+        }
+        std::string text{(std::istreambuf_iterator<char>(script)), std::istreambuf_iterator<char>()};
+        std::string error;
+        if (!database->executeScript(text, error)) {
+            std::cerr << "Database error: " << error << std::endl;
+            return 1;
+        }
+    }
+
+    SymbolTable symbols;
+    for (size_t slot = 0; slot < compiled.nameCount; ++slot) {
+        symbols.slotFor(compiled.names[slot]);
+    }
+    FdSink sink(STDOUT_FILENO);
+    OutputBuffer output(sink, flushThreshold);
+    Runtime runtime(symbols, output);
+    runtime.setHttpBackend(httpBackend);
+    runtime.setHttpConcurrency(httpConcurrency);
+    runtime.setDatabase(*database);
+    compiled.render(runtime);
+    runtime.finish();
+    output.flush();
+    if (dumpVars) {
+        runtime.dumpVariables(std::cerr);
+    }
+    return 0;
+}
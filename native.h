@@ -0,0 +1,27 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <variant>
+
+#include "output.h"
+#include "runtime.h"
+#include "value.h"
+
+
+// Template compiled to C++ by php --emit-cpp
+struct NativeTemplate {
+    const char* const* names;    // variable names in slot order
+    size_t nameCount;
+    void (*render)(Runtime& runtime);
+};
+
+// main() of a compiled template. Takes the options of php that apply to a
+// single render (--db, --db-init, --http-curl, --http-concurrency,
+// --flush-threshold, --dump-vars), renders to stdout and returns the exit code.
+int runNativeTemplate(const NativeTemplate& compiled, int argc, char* argv[]);
+
+#endif // NATIVE_H
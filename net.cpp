@@ -0,0 +1,148 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "net.h"
+
+
+// Split "host:port"; anything else is a Unix socket path
+static bool splitHostPort(const std::string& address, std::string& host, std::string& port) {
+    if (address.empty() || address[0] == '/' || address[0] == '.') {
+        return false;
+    }
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    return true;
+}
+
+
+bool resolveAddress(const std::string& address, std::vector<SocketAddress>& resolved, bool server) {
+    resolved.clear();
+    std::string host, port;
+    if (!splitHostPort(address, host, port)) {
+        sockaddr_un local{};
+        local.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(local.sun_path)) {
+            std::cerr << "Socket path too long: " << address << std::endl;
+            return false;
+        }
+        std::memcpy(local.sun_path, address.c_str(), address.size() + 1);
+        SocketAddress entry{AF_UNIX, SOCK_STREAM, 0, {}, sizeof(local)};
+        std::memcpy(&entry.storage, &local, sizeof(local));
+        resolved.push_back(entry);
+        return true;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = server ? AI_PASSIVE : 0;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) {
+        return false;
+    }
+    for (addrinfo* info = result; info; info = info->ai_next) {
+        SocketAddress entry{info->ai_family, info->ai_socktype, info->ai_protocol, {}, info->ai_addrlen};
+        std::memcpy(&entry.storage, info->ai_addr, info->ai_addrlen);
+        resolved.push_back(entry);
+    }
+    freeaddrinfo(result);
+    return !resolved.empty();
+}
+
+
+// Addresses are tried in order from `first`, which is left past the one
+// that connected
+static int openSocket(const std::vector<SocketAddress>& resolved, bool server, int backlog, bool nonBlocking,
+                      size_t& first) {
+    int fd = -1;
+    while (first < resolved.size()) {
+        const SocketAddress& entry = resolved[first++];
+        const sockaddr* address = reinterpret_cast<const sockaddr*>(&entry.storage);
+        fd = socket(entry.family, entry.type | (nonBlocking ? SOCK_NONBLOCK : 0), entry.protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        if (server) {
+            if (entry.family == AF_UNIX) {
+                unlink(reinterpret_cast<const sockaddr_un*>(address)->sun_path);
+            } else {
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            }
+            if (bind(fd, address, entry.size) == 0 && listen(fd, backlog) == 0) {
+                break;
+            }
+        } else if (connect(fd, address, entry.size) == 0 || (nonBlocking && errno == EINPROGRESS)) {
+            if (entry.family != AF_UNIX) {
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+
+int listenSocket(const std::string& address, int backlog) {
+    std::vector<SocketAddress> resolved;
+    size_t first = 0;
+    return resolveAddress(address, resolved, true) ? openSocket(resolved, true, backlog, false, first) : -1;
+}
+
+
+int connectSocket(const std::string& address, bool nonBlocking) {
+    std::vector<SocketAddress> resolved;
+    size_t first = 0;
+    return resolveAddress(address, resolved) ? openSocket(resolved, false, 0, nonBlocking, first) : -1;
+}
+
+
+int connectSocket(const std::vector<SocketAddress>& resolved, bool nonBlocking, size_t& next) {
+    return openSocket(resolved, false, 0, nonBlocking, next);
+}
+
+
+bool readFully(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t count = read(fd, data, size);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        data += count;
+        size -= static_cast<size_t>(count);
+    }
+    return true;
+}
+
+
+bool writeFully(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t count = write(fd, data, size);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        data += count;
+        size -= static_cast<size_t>(count);
+    }
+    return true;
+}
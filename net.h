@@ -0,0 +1,34 @@
+#ifndef NET_H
+#define NET_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+
+// Where a socket can connect or listen, resolved ahead of time
+struct SocketAddress {
+    int family;
+    int type;
+    int protocol;
+    sockaddr_storage storage;
+    socklen_t size;
+};
+
+// Socket helpers; an address is a Unix socket path or host:port
+int listenSocket(const std::string& address, int backlog);
+// A non-blocking connect may still be in progress; the socket turns
+// writable once it is done
+int connectSocket(const std::string& address, bool nonBlocking = false);
+// Name lookup may block, so callers on an event loop resolve elsewhere
+// and connect to the result. Addresses are tried from `next` on, and
+// `next` is left past the one connected, so that a non-blocking connect
+// refused later can go on with the rest.
+bool resolveAddress(const std::string& address, std::vector<SocketAddress>& resolved, bool server = false);
+int connectSocket(const std::vector<SocketAddress>& resolved, bool nonBlocking, size_t& next);
+bool readFully(int fd, char* data, size_t size);
+bool writeFully(int fd, const char* data, size_t size);
+
+#endif // NET_H
@@ -0,0 +1,148 @@
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "number.h"
+
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+
+NumberPrefix readNumber(std::string_view text) {
+    NumberPrefix number;
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    const char* p = begin;
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    const char* digits = p < end && (*p == '+' || *p == '-') ? p + 1 : p;
+    if (!(digits < end && isDigit(*digits)) && !(end - digits >= 2 && digits[0] == '.' && isDigit(digits[1]))) {
+        return number;
+    }
+    // from_chars takes a '-' but not a '+'
+    const char* first = *p == '+' ? digits : p;
+
+    std::from_chars_result parsed = std::from_chars(first, end, number.real);
+    if (parsed.ec == std::errc::result_out_of_range) {
+        // Too large or too small for a double: PHP gives INF or 0
+        bool tiny = false;
+        for (const char* c = digits; c < parsed.ptr; ++c) {
+            if ((*c == 'e' || *c == 'E') && c + 1 < parsed.ptr && c[1] == '-') {
+                tiny = true;
+            }
+        }
+        if (!tiny) {
+            tiny = true;
+            for (const char* c = digits; c < parsed.ptr && *c != '.' && *c != 'e' && *c != 'E'; ++c) {
+                tiny = tiny && *c == '0';
+            }
+        }
+        number.real = tiny ? 0.0 : std::numeric_limits<double>::infinity();
+        if (*p == '-') {
+            number.real = -number.real;
+        }
+    }
+    number.length = static_cast<size_t>(parsed.ptr - begin);
+
+    const char* q = digits;
+    while (q < end && isDigit(*q)) {
+        q++;
+    }
+    if (q == parsed.ptr) {
+        number.integral = std::from_chars(first, q, number.integer).ec == std::errc();
+    }
+    return number;
+}
+
+
+void appendInteger(std::string& out, int64_t value) {
+    char buffer[24];
+    std::to_chars_result written = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, written.ptr);
+}
+
+
+// Significant digits of `text`, in to_chars scientific form, without the
+// point and trailing zeros; returns the decimal exponent
+static int splitScientific(const char* text, const char* end, char* digits, size_t& count) {
+    count = 0;
+    const char* p = text;
+    for (; p < end && *p != 'e'; ++p) {
+        if (isDigit(*p)) {
+            digits[count++] = *p;
+        }
+    }
+    while (count > 1 && digits[count - 1] == '0') {
+        count--;
+    }
+    int exponent = 0;
+    std::from_chars(p + (p[1] == '+' ? 2 : 1), end, exponent);
+    return exponent;
+}
+
+
+// Same layout as PHP's zend_gcvt()
+void appendFloat(std::string& out, double value) {
+    if (std::isnan(value)) {
+        out += "NAN";
+        return;
+    }
+    if (std::isinf(value)) {
+        out += value < 0 ? "-INF" : "INF";
+        return;
+    }
+    if (std::signbit(value)) {
+        out += '-';
+        value = -value;
+    }
+
+    // The shortest round-trip form of a normal float is the rounded one
+    // when it has few enough digits. Subnormals are too coarse for that.
+    char text[32];
+    char digits[32];
+    size_t count = SIZE_MAX;
+    int exponent = 0;
+    std::to_chars_result written;
+    if (value == 0 || std::isnormal(value)) {
+        written = std::to_chars(text, text + sizeof(text), value, std::chars_format::scientific);
+        exponent = splitScientific(text, written.ptr, digits, count);
+    }
+    if (count > static_cast<size_t>(PHP_PRECISION)) {
+        written = std::to_chars(text, text + sizeof(text), value, std::chars_format::scientific, PHP_PRECISION - 1);
+        exponent = splitScientific(text, written.ptr, digits, count);
+    }
+
+    // Digits before the decimal point
+    int point = exponent + 1;
+    if (point < 0 ? point < -3 : point > PHP_PRECISION) {
+        out += digits[0];
+        out += '.';
+        if (count > 1) {
+            out.append(digits + 1, count - 1);
+        } else {
+            out += '0';
+        }
+        out += 'E';
+        out += exponent < 0 ? '-' : '+';
+        appendInteger(out, exponent < 0 ? -exponent : exponent);
+    } else if (point <= 0) {
+        out += "0.";
+        out.append(static_cast<size_t>(-point), '0');
+        out.append(digits, count);
+    } else if (count <= static_cast<size_t>(point)) {
+        out.append(digits, count);
+        out.append(static_cast<size_t>(point) - count, '0');
+    } else {
+        out.append(digits, static_cast<size_t>(point));
+        out += '.';
+        out.append(digits + point, count - static_cast<size_t>(point));
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+// Conversions between numbers and text as PHP does them. Built on
+// std::from_chars/std::to_chars, so nothing depends on the locale.
+
+// Significant digits of a float printed by echo (PHP's precision setting)
+const int PHP_PRECISION = 14;
+
+// Number at the start of a text
+struct NumberPrefix {
+    size_t length = 0;       // bytes read, whitespace included; 0 if there is no number
+    bool integral = false;   // no fraction or exponent, and fits in int64
+    int64_t integer = 0;
+    double real = 0;
+};
+
+// Leading whitespace, sign, digits with an optional fraction and exponent
+NumberPrefix readNumber(std::string_view text);
+
+// Append a number the way echo prints it. Floats are rounded to
+// PHP_PRECISION significant digits and lose trailing zeros, so 6.0 prints
+// as "6" and 0.1 + 0.2 as "0.3"; exponents below -4 or above the
+// precision switch to "1.0E+25" notation; NAN and INF print as words.
+void appendInteger(std::string& out, int64_t value);
+void appendFloat(std::string& out, double value);
+
+#endif // NUMBER_H
@@ -0,0 +1,286 @@
+// Conformance table and microbenchmark for the numeric conversions in
+// number.cpp. The table holds what PHP 8 prints (precision 14) and how it
+// reads numeric strings; every run checks it first and fails on a
+// mismatch. The benchmark compares the conversions with the C library
+// calls they replaced.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "number.h"
+#include "value.h"
+
+
+struct FormatCase {
+    double value;
+    const char* expected;
+};
+
+// echo $value;
+static const FormatCase FORMAT_CASES[] = {
+    {0.0, "0"},
+    {-0.0, "-0"},
+    {6.0, "6"},
+    {-6.0, "-6"},
+    {0.5, "0.5"},
+    {-1.5, "-1.5"},
+    {0.1 + 0.2, "0.3"},
+    {1.0 / 3, "0.33333333333333"},
+    {2.0 / 3, "0.66666666666667"},
+    {100.0, "100"},
+    {1234.5678, "1234.5678"},
+    {123456789.12345678, "123456789.12346"},
+    {0.0001, "0.0001"},
+    {0.00012345678901234567, "0.00012345678901235"},
+    {0.00001, "1.0E-5"},
+    {1.5e-7, "1.5E-7"},
+    {1e13, "10000000000000"},
+    {99999999999999.0, "99999999999999"},
+    {999999999999999.0, "1.0E+15"},
+    {1e14, "1.0E+14"},
+    {1e15, "1.0E+15"},
+    {1e25, "1.0E+25"},
+    {1.25e25, "1.25E+25"},
+    {-1e100, "-1.0E+100"},
+    {9223372036854775808.0, "9.2233720368548E+18"},
+    {1.7976931348623157e308, "1.7976931348623E+308"},
+    {2.2250738585072014e-308, "2.2250738585072E-308"},
+    {1e-320, "9.9998886718268E-321"},
+    {4.9406564584124654e-324, "4.9406564584125E-324"},
+    {std::numeric_limits<double>::infinity(), "INF"},
+    {-std::numeric_limits<double>::infinity(), "-INF"},
+    {std::numeric_limits<double>::quiet_NaN(), "NAN"},
+};
+
+
+struct ParseCase {
+    const char* text;
+    const char* expected;    // echo of $text + 0
+    bool numeric;
+};
+
+// "$text" + 0
+static const ParseCase PARSE_CASES[] = {
+    {"12", "12", true},
+    {"-12", "-12", true},
+    {"+3", "3", true},
+    {"2.5", "2.5", true},
+    {".5", "0.5", true},
+    {"5.", "5", true},
+    {"1e3", "1000", true},
+    {"1E-2", "0.01", true},
+    {"  42", "42", true},
+    {"42  ", "42", true},
+    {"\t\n7", "7", true},
+    {"9223372036854775807", "9223372036854775807", true},
+    {"9223372036854775808", "9.2233720368548E+18", true},
+    {"99999999999999999999", "1.0E+20", true},
+    {"1e999", "INF", true},
+    {"-1e999", "-INF", true},
+    {"1e-999", "0", true},
+    {"12abc", "12", false},
+    {"1e", "1", false},
+    {"0x1A", "0", false},
+    {"1,5", "1", false},
+    {"abc", "0", false},
+    {"", "0", false},
+    {".", "0", false},
+    {"-", "0", false},
+    {"inf", "0", false},
+};
+
+
+static int checkConformance() {
+    int failures = 0;
+    for (const FormatCase& test : FORMAT_CASES) {
+        std::string out;
+        appendFloat(out, test.value);
+        if (out != test.expected) {
+            std::cerr << "format: expected " << test.expected << ", got " << out << std::endl;
+            failures++;
+        }
+    }
+    // toNumber() warns about non-numeric strings; keep the report readable
+    std::streambuf* errors = std::cerr.rdbuf(nullptr);
+    std::vector<std::string> mismatches;
+    for (const ParseCase& test : PARSE_CASES) {
+        std::string out = toString(toNumber(std::string(test.text)));
+        bool numeric = isNumericString(test.text);
+        if (out != test.expected || numeric != test.numeric) {
+            mismatches.push_back(std::string("parse \"") + test.text + "\": expected " + test.expected +
+                                 (test.numeric ? " (numeric)" : "") + ", got " + out + (numeric ? " (numeric)" : ""));
+        }
+    }
+    std::cerr.rdbuf(errors);
+    for (const std::string& mismatch : mismatches) {
+        std::cerr << mismatch << std::endl;
+    }
+    return failures + static_cast<int>(mismatches.size());
+}
+
+
+// Mix of template arithmetic results: money, ratios, integral floats and
+// the occasional large or small magnitude
+static std::vector<double> makeValues(size_t count) {
+    std::mt19937 random(42);
+    std::vector<double> values;
+    values.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        switch (random() % 4) {
+            case 0: values.push_back((random() % 100000) / 100.0); break;
+            case 1: values.push_back(static_cast<double>(random() % 1000)); break;
+            case 2: values.push_back(static_cast<double>(random()) / (1 + random() % 1000)); break;
+            default: values.push_back(std::ldexp(static_cast<double>(random()), static_cast<int>(random() % 200) - 100)); break;
+        }
+    }
+    return values;
+}
+
+
+// Results of the timed loops end up here so they are not optimized away
+static volatile size_t observed;
+
+
+struct Result {
+    const char* name;
+    double nanoseconds;    // per conversion, best of the repetitions
+};
+
+
+static Result measure(const char* name, int reps, size_t count, const std::function<size_t()>& body) {
+    double best = 0;
+    size_t sink = 0;
+    for (int i = 0; i < reps; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        sink += body();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best = i == 0 ? elapsed.count() : std::min(best, elapsed.count());
+    }
+    observed = sink;
+    return {name, best / count};
+}
+
+
+int main(int argc, char* argv[]) {
+    bool json = false;
+    int reps = 5;
+    size_t count = 200000;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json") {
+            json = true;
+        } else if (arg == "--reps" && i + 1 < argc) {
+            reps = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--count" && i + 1 < argc) {
+            count = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--json] [--reps <n>] [--count <values>]" << std::endl;
+            return 1;
+        }
+    }
+
+    int failures = checkConformance();
+    if (failures > 0) {
+        std::cerr << failures << " conformance failures" << std::endl;
+        return 1;
+    }
+
+    std::vector<double> values = makeValues(count);
+    std::vector<int64_t> integers;
+    integers.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        integers.push_back(static_cast<int64_t>(i * 7919 % 1000003) - 500000);
+    }
+    std::vector<std::string> texts;
+    texts.reserve(count);
+    for (double value : values) {
+        std::string text;
+        appendFloat(text, value);
+        texts.push_back(text);
+    }
+
+    std::vector<Result> results;
+    results.push_back(measure("format_float", reps, count, [&]() {
+        size_t bytes = 0;
+        std::string out;
+        for (double value : values) {
+            out.clear();
+            appendFloat(out, value);
+            bytes += out.size();
+        }
+        return bytes;
+    }));
+    results.push_back(measure("format_float_to_string", reps, count, [&]() {
+        size_t bytes = 0;
+        for (double value : values) {
+            bytes += std::to_string(value).size();
+        }
+        return bytes;
+    }));
+    results.push_back(measure("format_float_printf", reps, count, [&]() {
+        size_t bytes = 0;
+        char buffer[64];
+        for (double value : values) {
+            bytes += std::snprintf(buffer, sizeof(buffer), "%.14G", value);
+        }
+        return bytes;
+    }));
+    results.push_back(measure("format_int", reps, count, [&]() {
+        size_t bytes = 0;
+        std::string out;
+        for (int64_t value : integers) {
+            out.clear();
+            appendInteger(out, value);
+            bytes += out.size();
+        }
+        return bytes;
+    }));
+    results.push_back(measure("format_int_to_string", reps, count, [&]() {
+        size_t bytes = 0;
+        for (int64_t value : integers) {
+            bytes += std::to_string(value).size();
+        }
+        return bytes;
+    }));
+    results.push_back(measure("parse", reps, count, [&]() {
+        size_t numbers = 0;
+        for (const std::string& text : texts) {
+            numbers += readNumber(text).length > 0;
+        }
+        return numbers;
+    }));
+    results.push_back(measure("parse_strtod", reps, count, [&]() {
+        size_t numbers = 0;
+        for (const std::string& text : texts) {
+            char* end = nullptr;
+            std::strtod(text.c_str(), &end);
+            numbers += end != text.c_str();
+        }
+        return numbers;
+    }));
+
+    if (json) {
+        std::printf("{\"count\": %zu, \"reps\": %d, \"unit\": \"ns\", \"results\": {", count, reps);
+        for (size_t i = 0; i < results.size(); ++i) {
+            std::printf("%s\n  \"%s\": %.2f", i > 0 ? "," : "", results[i].name, results[i].nanoseconds);
+        }
+        std::printf("\n}}\n");
+    } else {
+        std::printf("%zu conformance cases passed; %zu values, best of %d\n",
+                    std::size(FORMAT_CASES) + std::size(PARSE_CASES), count, reps);
+        for (const Result& result : results) {
+            std::printf("  %-23s %8.1f ns\n", result.name, result.nanoseconds);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,215 @@
+#include <string>
+
+#include "optimizer.h"
+
+
+// Strings past MAX_FOLDED_STRING when joined
+static bool isLong(const Value& left, const Value& right) {
+    size_t size = 0;
+    for (const Value* operand : {&left, &right}) {
+        if (auto text = std::get_if<std::string>(operand)) {
+            size += text->size();
+        }
+    }
+    return size > Optimizer::MAX_FOLDED_STRING;
+}
+
+
+// Constant operands whose operation is evaluated without warnings
+static bool isSilent(char op, const Value& left, const Value& right) {
+    if (op == '.') {
+        return true;
+    }
+    if (op != '+' && op != '-' && op != '*' && op != '/') {
+        return false;
+    }
+    for (const Value* operand : {&left, &right}) {
+        auto text = std::get_if<std::string>(operand);
+        if (text && !isNumericString(*text)) {
+            return false;
+        }
+    }
+    if (op == '/') {
+        Value divisor = toNumber(right);
+        auto integer = std::get_if<int64_t>(&divisor);
+        if (integer ? *integer == 0 : std::get<double>(divisor) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+Optimizer::Stats Optimizer::optimize(Ast& ast, const SymbolTable& symbols) {
+    stats = Stats{};
+    known.assign(symbols.names.size(), Value{});
+    isKnown.assign(symbols.names.size(), false);
+    for (NodeId id : ast.statements) {
+        stats.nodesBefore += countNodes(ast, id);
+    }
+
+    // Statements run in order, so the last assignment seen is the one
+    // that reaches a use
+    for (NodeId id : ast.statements) {
+        Node& node = ast[id];
+        switch (node.kind) {
+            case N_PRINT: {
+                rewriteExpression(ast, node.left);
+                Value value;
+                if (constantValue(ast, node.left, value)) {
+                    node.kind = N_TEXT;
+                    node.text = ast.arena.copy(toString(value) + "\n");
+                    node.left = NO_NODE;
+                    stats.staticEchoes++;
+                }
+                break;
+            }
+            case N_ASSIGNMENT: {
+                rewriteExpression(ast, node.right);
+                uint32_t slot = ast[node.left].slot;
+                Value value;
+                isKnown[slot] = node.right != NO_NODE && constantValue(ast, node.right, value) &&
+                                !isLong(value, Value{});
+                known[slot] = std::move(value);
+                break;
+            }
+            case N_HTTP:
+                isKnown[ast[node.left].slot] = false;
+                break;
+            case N_DB:
+                for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+                    rewriteExpression(ast, ast[argument].left);
+                }
+                if (node.left != NO_NODE) {
+                    isKnown[ast[node.left].slot] = false;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    mergeTexts(ast);
+    for (NodeId id : ast.statements) {
+        stats.nodesAfter += countNodes(ast, id);
+    }
+    return stats;
+}
+
+
+void Optimizer::rewriteExpression(Ast& ast, NodeId id) {
+    if (id == NO_NODE) {
+        return;
+    }
+    Node& node = ast[id];
+    if (node.kind == N_VARIABLE) {
+        if (isKnown[node.slot]) {
+            makeLiteral(ast, node, known[node.slot]);
+            stats.propagated++;
+        }
+    } else if (node.kind == N_EXPRESSION) {
+        rewriteExpression(ast, node.left);
+        rewriteExpression(ast, node.right);
+        Value left, right;
+        if (constantValue(ast, node.left, left) && constantValue(ast, node.right, right) &&
+            isSilent(node.op, left, right) && (node.op != '.' || !isLong(left, right))) {
+            makeLiteral(ast, node, binaryOperation(node.op, left, right));
+            stats.folded++;
+        }
+    }
+}
+
+
+// Adjacent short text statements become one chunk
+void Optimizer::mergeTexts(Ast& ast) {
+    auto mergeable = [&](size_t i) {
+        const Node& node = ast[ast.statements[i]];
+        return node.kind == N_TEXT && node.text.size() < MAX_MERGED_TEXT;
+    };
+    std::vector<NodeId> statements;
+    statements.reserve(ast.statements.size());
+    std::string text;
+    for (size_t i = 0; i < ast.statements.size(); ++i) {
+        NodeId id = ast.statements[i];
+        statements.push_back(id);
+        if (!mergeable(i)) {
+            continue;
+        }
+        size_t last = i;
+        while (last + 1 < ast.statements.size() && mergeable(last + 1)) {
+            last++;
+        }
+        if (last == i) {
+            continue;
+        }
+        text.clear();
+        for (size_t j = i; j <= last; ++j) {
+            text += ast[ast.statements[j]].text;
+        }
+        ast[id].text = ast.arena.copy(text);
+        stats.mergedTexts += static_cast<uint32_t>(last - i);
+        i = last;
+    }
+    ast.statements = std::move(statements);
+}
+
+
+// Literals and a missing operand, which evaluates to null
+bool Optimizer::constantValue(const Ast& ast, NodeId id, Value& value) {
+    if (id == NO_NODE) {
+        value = Value{};
+        return true;
+    }
+    const Node& node = ast[id];
+    if (node.kind == N_NUMBER) {
+        value = numberValue(node);
+        return true;
+    }
+    if (node.kind == N_STRING) {
+        value = std::string(node.text);
+        return true;
+    }
+    return false;
+}
+
+
+void Optimizer::makeLiteral(Ast& ast, Node& node, const Value& value) {
+    node.left = NO_NODE;
+    node.right = NO_NODE;
+    node.op = 0;
+    if (auto text = std::get_if<std::string>(&value)) {
+        node.kind = N_STRING;
+        node.text = ast.arena.copy(*text);
+        return;
+    }
+    node.kind = N_NUMBER;
+    node.text = ast.arena.copy(toString(value));
+    if (auto real = std::get_if<double>(&value)) {
+        node.isFloat = true;
+        node.real = *real;
+    } else {
+        node.isFloat = false;
+        node.integer = std::holds_alternative<int64_t>(value) ? std::get<int64_t>(value) : 0;
+    }
+}
+
+
+uint32_t Optimizer::countNodes(const Ast& ast, NodeId id) {
+    if (id == NO_NODE) {
+        return 0;
+    }
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case N_PRINT:
+            return 1 + countNodes(ast, node.left);
+        case N_HTTP:
+            return 1 + countNodes(ast, node.left) + 4;
+        case N_EXPRESSION:
+        case N_ASSIGNMENT:
+        case N_DB:
+        case N_ARGUMENT:
+            return 1 + countNodes(ast, node.left) + countNodes(ast, node.right);
+        default:
+            return 1;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "parser.h"
+#include "resolver.h"
+#include "value.h"
+
+
+// Optimizer class: rewrites a resolved AST in place before it is interpreted
+// or compiled. Folds constant arithmetic and concatenation, substitutes
+// variables whose value at the point of use is a known constant, turns
+// echoes of constants into text and merges adjacent text into one chunk.
+// Operations that would print a warning at runtime are left alone.
+class Optimizer {
+public:
+    // Longer text is not merged: it stays a reference into the source
+    // instead of being copied together with its neighbours
+    static const size_t MAX_MERGED_TEXT = 4 * 1024;
+    // Longer strings are neither folded nor propagated: every use would
+    // get its own copy, and a string grown by repeated concatenation
+    // would be copied once per step
+    static const size_t MAX_FOLDED_STRING = 4 * 1024;
+
+    struct Stats {
+        uint32_t nodesBefore = 0;
+        uint32_t nodesAfter = 0;
+        uint32_t folded = 0;
+        uint32_t propagated = 0;
+        uint32_t staticEchoes = 0;
+        uint32_t mergedTexts = 0;
+
+        uint32_t eliminated() const { return nodesBefore - nodesAfter; }
+    };
+
+    Stats optimize(Ast& ast, const SymbolTable& symbols);
+
+private:
+    void rewriteExpression(Ast& ast, NodeId id);
+    void mergeTexts(Ast& ast);
+    static bool constantValue(const Ast& ast, NodeId id, Value& value);
+    static void makeLiteral(Ast& ast, Node& node, const Value& value);
+    static uint32_t countNodes(const Ast& ast, NodeId id);
+
+    // Value of each slot at the current statement, when it is a constant
+    std::vector<Value> known;
+    std::vector<bool> isKnown;
+    Stats stats;
+};
+
+#endif // OPTIMIZER_H
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+
+#include <unistd.h>
+
+#include "output.h"
+
+
+bool writevFully(int fd, const iovec* pieces, size_t count) {
+    std::vector<iovec> rest(pieces, pieces + count);
+    size_t first = 0;
+    while (first < rest.size()) {
+        int batch = static_cast<int>(std::min<size_t>(rest.size() - first, IOV_MAX));
+        ssize_t written = writev(fd, &rest[first], batch);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            return false;
+        }
+        // Skip what went out, then trim a partially written piece
+        size_t left = static_cast<size_t>(written);
+        while (first < rest.size() && left >= rest[first].iov_len) {
+            left -= rest[first].iov_len;
+            first++;
+        }
+        if (left > 0) {
+            rest[first].iov_base = static_cast<char*>(rest[first].iov_base) + left;
+            rest[first].iov_len -= left;
+        }
+    }
+    return true;
+}
+
+
+bool FdSink::write(const iovec* pieces, size_t count) {
+    return writevFully(fd, pieces, count);
+}
+
+
+OutputBuffer::~OutputBuffer() {
+    while (!levels.empty()) {
+        endFlush();
+    }
+    flush();
+}
+
+
+void OutputBuffer::write(std::string_view data) {
+    if (data.empty()) {
+        return;
+    }
+    if (!levels.empty()) {
+        levels.back().append(data.data(), data.size());
+        return;
+    }
+    // Consecutive copies extend the same segment
+    if (!segments.empty() && !segments.back().data &&
+        segments.back().offset + segments.back().size == owned.size()) {
+        segments.back().size += data.size();
+    } else {
+        segments.push_back({nullptr, owned.size(), data.size()});
+    }
+    owned.append(data.data(), data.size());
+    pending += data.size();
+    if (pending >= flushThreshold) {
+        flush();
+    }
+}
+
+
+void OutputBuffer::writeStatic(std::string_view data) {
+    if (!levels.empty() || data.size() < MIN_STATIC_SIZE) {
+        write(data);
+        return;
+    }
+    segments.push_back({data.data(), 0, data.size()});
+    pending += data.size();
+    if (pending >= flushThreshold) {
+        flush();
+    }
+}
+
+
+void OutputBuffer::start() {
+    levels.emplace_back();
+}
+
+
+// Pass the innermost level's contents to the level below it
+bool OutputBuffer::endFlush() {
+    if (levels.empty()) {
+        return false;
+    }
+    std::string contents = std::move(levels.back());
+    levels.pop_back();
+    write(contents);
+    return true;
+}
+
+
+bool OutputBuffer::endClean() {
+    if (levels.empty()) {
+        return false;
+    }
+    levels.pop_back();
+    return true;
+}
+
+
+void OutputBuffer::clean() {
+    if (!levels.empty()) {
+        levels.back().clear();
+    }
+}
+
+
+std::string OutputBuffer::getContents() const {
+    return levels.empty() ? std::string() : levels.back();
+}
+
+
+bool OutputBuffer::flush() {
+    if (segments.empty() || error) {
+        segments.clear();
+        owned.clear();
+        pending = 0;
+        return !error;
+    }
+    std::vector<iovec> pieces;
+    pieces.reserve(segments.size());
+    for (const Segment& segment : segments) {
+        const char* data = segment.data ? segment.data : owned.data() + segment.offset;
+        pieces.push_back({const_cast<char*>(data), segment.size});
+    }
+    error = !sink.write(pieces.data(), pieces.size());
+    segments.clear();
+    owned.clear();
+    pending = 0;
+    return !error;
+}
@@ -0,0 +1,90 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/uio.h>
+
+
+// Destination of rendered output; receives whole batches of pieces at once
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+
+    // Write all pieces in order; false once the destination has failed
+    virtual bool write(const iovec* pieces, size_t count) = 0;
+};
+
+
+// Sink for a file descriptor: one writev per batch
+class FdSink : public OutputSink {
+public:
+    explicit FdSink(int fd) : fd(fd) {}
+
+    bool write(const iovec* pieces, size_t count) override;
+
+private:
+    int fd;
+};
+
+// writev() that retries short writes and splits batches longer than IOV_MAX
+bool writevFully(int fd, const iovec* pieces, size_t count);
+
+
+// OutputBuffer class: collects output until the flush threshold is reached.
+// Static text that outlives the buffer (the program's string pool, the
+// template source) is kept by reference and handed to the sink as is;
+// everything else is copied into a growable buffer. start()/endFlush()/
+// endClean() nest capture levels like PHP's ob_start()/ob_end_flush()/
+// ob_end_clean(); nothing reaches the sink while a level is open.
+class OutputBuffer {
+public:
+    static const size_t DEFAULT_FLUSH_THRESHOLD = 64 * 1024;
+    // Shorter static chunks are copied, an iovec entry costs more than the copy
+    static const size_t MIN_STATIC_SIZE = 64;
+
+    explicit OutputBuffer(OutputSink& sink, size_t flushThreshold = DEFAULT_FLUSH_THRESHOLD)
+        : sink(sink), flushThreshold(flushThreshold) {}
+    ~OutputBuffer();
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void write(std::string_view data);
+    // Data must stay valid until the next flush()
+    void writeStatic(std::string_view data);
+
+    // Output buffering levels
+    void start();
+    bool endFlush();
+    bool endClean();
+    void clean();
+    std::string getContents() const;
+    size_t level() const { return levels.size(); }
+
+    // Send everything below the open levels to the sink
+    bool flush();
+    bool failed() const { return error; }
+    size_t pendingSize() const { return pending; }
+
+private:
+    // Piece of pending output: a reference to static text, or a range of
+    // `owned` when data is null
+    struct Segment {
+        const char* data;
+        size_t offset;
+        size_t size;
+    };
+
+    OutputSink& sink;
+    size_t flushThreshold;
+    std::string owned;
+    std::vector<Segment> segments;
+    std::vector<std::string> levels;
+    size_t pending = 0;
+    bool error = false;
+};
+
+#endif // OUTPUT_H
@@ -1,51 +1,140 @@
 #include <iostream>
+#include <new>
 #include "lexer.h"
 #include "parser.h"
 
 
+Value numberValue(const Node& node) {
+    if (node.isFloat) {
+        return node.real;
+    }
+    return node.integer;
+}
+
+
+void concatOperands(const Ast& ast, NodeId id, std::vector<NodeId>& operands) {
+    if (id != NO_NODE && ast[id].kind == N_EXPRESSION && ast[id].op == '.') {
+        concatOperands(ast, ast[id].left, operands);
+        concatOperands(ast, ast[id].right, operands);
+    } else {
+        operands.push_back(id);
+    }
+}
+
+
+static bool usesSlot(const Ast& ast, NodeId id, uint32_t slot) {
+    if (id == NO_NODE) {
+        return false;
+    }
+    const Node& node = ast[id];
+    if (node.kind == N_VARIABLE) {
+        return node.slot == slot;
+    }
+    return node.kind == N_EXPRESSION && (usesSlot(ast, node.left, slot) || usesSlot(ast, node.right, slot));
+}
+
+
+bool isSelfAppend(const Ast& ast, const Node& assignment, const std::vector<NodeId>& operands) {
+    uint32_t slot = ast[assignment.left].slot;
+    if (operands.size() < 2 || operands[0] == NO_NODE || ast[operands[0]].kind != N_VARIABLE ||
+        ast[operands[0]].slot != slot) {
+        return false;
+    }
+    for (size_t i = 1; i < operands.size(); ++i) {
+        if (usesSlot(ast, operands[i], slot)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+size_t dbBatchLength(const Ast& ast, size_t first) {
+    size_t end = first;
+    while (end < ast.statements.size() && ast[ast.statements[end]].kind == N_DB) {
+        const Node& node = ast[ast.statements[end]];
+        for (size_t i = first; i < end; ++i) {
+            NodeId target = ast[ast.statements[i]].left;
+            if (target == NO_NODE) {
+                continue;
+            }
+            for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+                if (usesSlot(ast, ast[argument].left, ast[target].slot)) {
+                    return end - first;
+                }
+            }
+        }
+        ++end;
+    }
+    return end - first;
+}
+
+
+// Добавить узел: блоки узлов берутся из арены, адреса узлов не меняются
+NodeId Ast::add(const Node& node) {
+    if (count % NODES_PER_BLOCK == 0) {
+        blocks.push_back(arena.allocateArray<Node>(NODES_PER_BLOCK));
+    }
+    NodeId id = count++;
+    new (&(*this)[id]) Node(node);
+    return id;
+}
+
+
 // Функция для парсинга исходного кода
-std::vector<std::unique_ptr<ASTNode>> Parser::parse() {
-    std::vector<std::unique_ptr<ASTNode>> nodes;
-    while (position < tokens.size() && tokens[position].type != T_EOF) {
-        if (tokens[position].type == T_TEXT) {
-            nodes.push_back(std::make_unique<TextNode>(tokens[position].value));
+Ast Parser::parse() {
+    while (position < tokens.size() && peek().type != T_EOF) {
+        const Token& first = peek();
+        size_t count = ast.statements.size();
+        if (peek().type == T_TEXT) {
+            ast.statements.push_back(ast.add(Node(N_TEXT, span(peek()))));
             position++;
-        } else if (tokens[position].type == T_ECHO) {
+        } else if (peek().type == T_ECHO) {
             position++;
-            auto expr = parseExpression();
-            if (tokens[position].type == T_SEMICOLON) {
+            NodeId expr = parseExpression();
+            if (peek().type == T_SEMICOLON) {
                 position++;
-                nodes.push_back(std::make_unique<PrintNode>(std::move(expr)));
+                Node print(N_PRINT);
+                print.left = expr;
+                ast.statements.push_back(ast.add(print));
             } else {
                 std::cerr << "Expected semicolon after expression" << std::endl;
             }
-        } else if (tokens[position].type == T_DB) {
+        } else if (peek().type == T_DB) {
             position++;
-            if (tokens[position].type == T_STRING) {
-                std::string query = tokens[position].value;
+            if (peek().type == T_STRING) {
+                std::string_view query = unquote(peek());
                 position++;
-                if (tokens[position].type == T_SEMICOLON) {
+                if (peek().type == T_SEMICOLON) {
                     position++;
-                    nodes.push_back(std::make_unique<DatabaseQueryNode>(query));
+                    ast.statements.push_back(ast.add(Node(N_DB, query)));
                 } else {
                     std::cerr << "Expected semicolon after query" << std::endl;
                 }
+            } else if (peek().type == T_LPAREN) {
+                NodeId queryNode = parseDatabaseQuery();
+                if (queryNode != NO_NODE) {
+                    ast.statements.push_back(queryNode);
+                }
             } else {
                 std::cerr << "Expected query after db" << std::endl;
             }
-        } else if (tokens[position].type == T_HTTP) {
-            auto httpRequestNode = parseHttpRequest();
-            if (httpRequestNode) {
-                nodes.push_back(std::move(httpRequestNode));
+        } else if (peek().type == T_HTTP) {
+            NodeId httpRequestNode = parseHttpRequest();
+            if (httpRequestNode != NO_NODE) {
+                ast.statements.push_back(httpRequestNode);
             }
-        } else if (tokens[position].type == T_VARIABLE) {
-            auto variable = parseVariable();
-            if (tokens[position].type == T_ASSIGN) {
+        } else if (peek().type == T_VARIABLE) {
+            NodeId variable = parseVariable();
+            if (peek().type == T_ASSIGN) {
                 position++;
-                auto expr = parseExpression();
-                if (tokens[position].type == T_SEMICOLON) {
+                NodeId expr = parseExpression();
+                if (peek().type == T_SEMICOLON) {
                     position++;
-                    nodes.push_back(std::make_unique<AssignmentNode>(std::move(variable), std::move(expr)));
+                    Node assignment(N_ASSIGNMENT);
+                    assignment.left = variable;
+                    assignment.right = expr;
+                    ast.statements.push_back(ast.add(assignment));
                 } else {
                     std::cerr << "Expected semicolon after assignment" << std::endl;
                 }
@@ -53,174 +142,230 @@ std::vector<std::unique_ptr<ASTNode>> Parser::parse() {
                 std::cerr << "Expected assignment operator after variable" << std::endl;
             }
         } else {
-            std::cerr << "Unexpected token: " << tokens[position].value << std::endl;
+            std::cerr << "Unexpected token: " << peek().value << std::endl;
             position++;
         }
+        // Запомнить строку и столбец оператора для профилировщика
+        if (ast.statements.size() > count) {
+            Node& statement = ast[ast.statements.back()];
+            statement.line = first.line;
+            statement.column = first.column;
+        }
     }
-    return nodes;
+    return std::move(ast);
+}
+
+
+// Текущий токен; за концом списка всегда T_EOF
+const Token& Parser::peek() const {
+    static const Token eof{T_EOF, ""};
+    return position < tokens.size() ? tokens[position] : eof;
+}
+
+
+// Текст токена как ссылка на исходный буфер
+std::string_view Parser::span(const Token& token) const {
+    return source.substr(token.offset, token.value.size());
+}
+
+
+// Текст строкового литерала без кавычек
+std::string_view Parser::unquote(const Token& token) const {
+    return source.substr(token.offset + 1, token.value.size() - 2);
 }
 
 
 // Функция для печати AST
-void Parser::printAST(const std::vector<std::unique_ptr<ASTNode>>& nodes) {
-    for (const auto& node : nodes) {
-        if (auto printNode = dynamic_cast<PrintNode*>(node.get())) {
+void Parser::printAST(const Ast& ast) {
+    for (NodeId id : ast.statements) {
+        printNode(ast, id);
+    }
+}
+
+
+void Parser::printNode(const Ast& ast, NodeId id) {
+    if (id == NO_NODE) {
+        std::cerr << "Unknown ASTNode type!" << std::endl;
+        return;
+    }
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case N_PRINT:
             std::cout << "PrintNode: ";
-            // Рекурсивный вызов для выражения
-            std::vector<std::unique_ptr<ASTNode>> exprNodes;
-            exprNodes.push_back(std::move(printNode->expr));
-            printAST(exprNodes);
-        } else if (auto dbQueryNode = dynamic_cast<DatabaseQueryNode*>(node.get())) {
-            std::cout << "DatabaseQueryNode: " << dbQueryNode->query << std::endl;
-        } else if (auto httpRequestNode = dynamic_cast<HttpRequestAssignmentNode*>(node.get())) {
-            std::cout << "HttpRequestAssignmentNode: Variable = " << httpRequestNode->variable
-                      << ", URL = " << httpRequestNode->url
-                      << ", Data = " << httpRequestNode->data
-                      << ", Header = " << httpRequestNode->header 
-                      << ", Type = " << httpRequestNode->type << std::endl;
-        } else if (auto textNode = dynamic_cast<TextNode*>(node.get())) {
-            std::cout << "TextNode: " << textNode->text << std::endl;
-        } else if (auto variableNode = dynamic_cast<VariableNode*>(node.get())) {
-            std::cout << "VariableNode: " << variableNode->name << std::endl;
-        } else if (auto exprNode = dynamic_cast<ExpressionNode*>(node.get())) {
+            printNode(ast, node.left);
+            break;
+        case N_DB:
+            std::cout << "DatabaseQueryNode: ";
+            if (node.left != NO_NODE) {
+                std::cout << "Variable = " << ast[node.left].text << ", Query = ";
+            }
+            std::cout << "\"" << node.text << "\"" << std::endl;
+            for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+                printNode(ast, argument);
+            }
+            break;
+        case N_ARGUMENT:
+            std::cout << "ArgumentNode: ";
+            printNode(ast, node.left);
+            break;
+        case N_HTTP:
+            std::cout << "HttpRequestAssignmentNode: Variable = " << ast[node.left].text
+                      << ", URL = \"" << ast[node.right].text << "\""
+                      << ", Data = \"" << ast[node.right + 1].text << "\""
+                      << ", Header = \"" << ast[node.right + 2].text << "\""
+                      << ", Type = \"" << ast[node.right + 3].text << "\"" << std::endl;
+            break;
+        case N_TEXT:
+            std::cout << "TextNode: " << node.text << std::endl;
+            break;
+        case N_VARIABLE:
+            std::cout << "VariableNode: " << node.text << std::endl;
+            break;
+        case N_EXPRESSION:
             std::cout << "ExpressionNode: ";
-            std::vector<std::unique_ptr<ASTNode>> exprNodes;
-            exprNodes.push_back(std::move(exprNode->left));
-            std::cout << " Operator = " << exprNode->op << " ";
-            exprNodes.push_back(std::move(exprNode->right));
-            printAST(exprNodes);
-        } else if (auto stringNode = dynamic_cast<StringNode*>(node.get())) {
-            std::cout << "StringNode: " << stringNode->value << std::endl;
-        } else if (auto numberNode = dynamic_cast<NumberNode*>(node.get())) {
-            std::cout << "NumberNode: " << numberNode->value << std::endl;
-        } else if (auto assignmentNode = dynamic_cast<AssignmentNode*>(node.get())) {
-            std::cout << "AssignmentNode: Variable = " << assignmentNode->variable->name << " ";
-            std::vector<std::unique_ptr<ASTNode>> exprNodes;
-            exprNodes.push_back(std::move(assignmentNode->expr));
-            printAST(exprNodes);
-        } else {
-            std::cerr << "Unknown ASTNode type!" << std::endl;
-        }
+            std::cout << " Operator = " << node.op << " ";
+            printNode(ast, node.left);
+            printNode(ast, node.right);
+            break;
+        case N_STRING:
+            std::cout << "StringNode: \"" << node.text << "\"" << std::endl;
+            break;
+        case N_NUMBER:
+            std::cout << "NumberNode: " << node.text << std::endl;
+            break;
+        case N_ASSIGNMENT:
+            std::cout << "AssignmentNode: Variable = " << ast[node.left].text << " ";
+            printNode(ast, node.right);
+            break;
     }
 }
 
 
 // Функция для парсинга выражений
-std::unique_ptr<ASTNode> Parser::parseExpression() {
-    auto left = parseTerm();
-    while (position < tokens.size() && (tokens[position].type == T_OPERATOR &&
-           (tokens[position].value == "+" || tokens[position].value == "-" || tokens[position].value == "."))) {
-        std::string op = tokens[position].value;
+NodeId Parser::parseExpression() {
+    NodeId left = parseTerm();
+    while (peek().type == T_OPERATOR &&
+           (peek().value == "+" || peek().value == "-" || peek().value == ".")) {
+        Node expression(N_EXPRESSION);
+        expression.op = peek().value[0];
         position++;
-        auto right = parseTerm();
-        left = std::make_unique<ExpressionNode>(std::move(left), op, std::move(right));
+        expression.left = left;
+        expression.right = parseTerm();
+        left = ast.add(expression);
     }
     return left;
 }
 
 
 // Функция для парсинга термов
-std::unique_ptr<ASTNode> Parser::parseTerm() {
-    auto left = parseFactor();
-    while (position < tokens.size() && (tokens[position].type == T_OPERATOR &&
-           (tokens[position].value == "*" || tokens[position].value == "/"))) {
-        std::string op = tokens[position].value;
+NodeId Parser::parseTerm() {
+    NodeId left = parseFactor();
+    while (peek().type == T_OPERATOR &&
+           (peek().value == "*" || peek().value == "/")) {
+        Node expression(N_EXPRESSION);
+        expression.op = peek().value[0];
         position++;
-        auto right = parseFactor();
-        left = std::make_unique<ExpressionNode>(std::move(left), op, std::move(right));
+        expression.left = left;
+        expression.right = parseFactor();
+        left = ast.add(expression);
     }
     return left;
 }
 
 
 // Функция для парсинга факторов
-std::unique_ptr<ASTNode> Parser::parseFactor() {
-    if (tokens[position].type == T_NUMBER) {
-        auto numberNode = std::make_unique<NumberNode>(tokens[position].value);
-        position++;
-        return numberNode;
-    } else if (tokens[position].type == T_VARIABLE) {
-        auto variableNode = std::make_unique<VariableNode>(tokens[position].value);
+NodeId Parser::parseFactor() {
+    if (peek().type == T_NUMBER) {
+        Node number(N_NUMBER, span(peek()));
+        Value value = parseNumber(peek().value);
+        if (auto real = std::get_if<double>(&value)) {
+            number.isFloat = true;
+            number.real = *real;
+        } else {
+            number.integer = std::get<int64_t>(value);
+        }
         position++;
-        return variableNode;
-    } else if (tokens[position].type == T_STRING) {
-        auto stringNode = std::make_unique<StringNode>(tokens[position].value);
+        return ast.add(number);
+    } else if (peek().type == T_VARIABLE) {
+        return parseVariable();
+    } else if (peek().type == T_STRING) {
+        NodeId stringNode = ast.add(Node(N_STRING, unquote(peek())));
         position++;
         return stringNode;
-    } else if (tokens[position].type == T_LPAREN) {
+    } else if (peek().type == T_LPAREN) {
         position++;
-        auto expr = parseExpression();
-        if (tokens[position].type == T_RPAREN) {
+        NodeId expr = parseExpression();
+        if (peek().type == T_RPAREN) {
             position++;
         } else {
             std::cerr << "Expected closing parenthesis" << std::endl;
         }
         return expr;
     } else {
-        std::cerr << "Unexpected token: " << tokens[position].value << std::endl;
+        std::cerr << "Unexpected token: " << peek().value << std::endl;
         position++;
-        return nullptr;
+        return NO_NODE;
     }
 }
 
 
 // Функция для парсинга переменных
-std::unique_ptr<VariableNode> Parser::parseVariable() {
-    if (tokens[position].type == T_VARIABLE) {
-        auto variableNode = std::make_unique<VariableNode>(tokens[position].value);
+NodeId Parser::parseVariable() {
+    if (peek().type == T_VARIABLE) {
+        NodeId variableNode = ast.add(Node(N_VARIABLE, span(peek())));
         position++;
         return variableNode;
     }
-    return nullptr;
+    return NO_NODE;
 }
 
 
 // Функция для парсинга HTTP запросов
-std::unique_ptr<ASTNode> Parser::parseHttpRequest() {
-    if (tokens[position].type == T_HTTP) {
+NodeId Parser::parseHttpRequest() {
+    if (peek().type == T_HTTP) {
         position++;
-        if (tokens[position].type == T_LPAREN) {
+        if (peek().type == T_LPAREN) {
             position++;
-            std::string varName, url, data, header, type;
+            NodeId variable = NO_NODE;
+            std::string_view url, data, header, type;
 
-            if (tokens[position].type == T_VARIABLE) {
-                varName = tokens[position].value;
-                position++;
+            if (peek().type == T_VARIABLE) {
+                variable = parseVariable();
             } else {
                 std::cerr << "Expected variable for assignment" << std::endl;
             }
 
-            if (tokens[position].type == T_COMMA) {
+            if (peek().type == T_COMMA) {
                 position++;
-                if (tokens[position].type == T_STRING) {
-                    url = tokens[position].value;
+                if (peek().type == T_STRING) {
+                    url = unquote(peek());
                     position++;
                 } else {
                     std::cerr << "Expected URL" << std::endl;
                 }
 
-                    if (tokens[position].type == T_COMMA) {
+                    if (peek().type == T_COMMA) {
                         position++;
-                        if (tokens[position].type == T_STRING) {
-                            data = tokens[position].value;
+                        if (peek().type == T_STRING) {
+                            data = unquote(peek());
                             position++;
                         } else {
                             std::cerr << "Expected data" << std::endl;
                         }
 
-                        if (tokens[position].type == T_COMMA) {
+                        if (peek().type == T_COMMA) {
                             position++;
-                            if (tokens[position].type == T_STRING) {
-                                header = tokens[position].value;
+                            if (peek().type == T_STRING) {
+                                header = unquote(peek());
                                 position++;
                             } else {
                                 std::cerr << "Expected header" << std::endl;
                             }
-                            
-                            if (tokens[position].type == T_COMMA) {
+
+                            if (peek().type == T_COMMA) {
                             	position++;
-                            	if (tokens[position].type == T_STRING) {
-                                	type = tokens[position].value;
+                            	if (peek().type == T_STRING) {
+                                	type = unquote(peek());
                                 	position++;
                             	} else {
                                 	std::cerr << "Expected type" << std::endl;
@@ -229,11 +374,22 @@ std::unique_ptr<ASTNode> Parser::parseHttpRequest() {
                         }
                     }
 
-                    if (tokens[position].type == T_RPAREN) {
+                    if (peek().type == T_RPAREN) {
                         position++;
-                        if (tokens[position].type == T_SEMICOLON) {
+                        if (peek().type == T_SEMICOLON) {
                             position++;
-                            return std::make_unique<HttpRequestAssignmentNode>(varName, url, data, header, type);
+                            if (variable == NO_NODE) {
+                                // Переменная нужна узлу, даже если её имя не разобрано
+                                variable = ast.add(Node(N_VARIABLE));
+                            }
+                            // Аргументы идут подряд, чтобы адресоваться одним индексом
+                            Node httpRequest(N_HTTP);
+                            httpRequest.left = variable;
+                            httpRequest.right = ast.add(Node(N_STRING, url));
+                            ast.add(Node(N_STRING, data));
+                            ast.add(Node(N_STRING, header));
+                            ast.add(Node(N_STRING, type));
+                            return ast.add(httpRequest);
                         } else {
                             std::cerr << "Expected semicolon after HTTP request" << std::endl;
                         }
@@ -247,6 +403,55 @@ std::unique_ptr<ASTNode> Parser::parseHttpRequest() {
             std::cerr << "Expected opening parenthesis" << std::endl;
         }
     }
-    return nullptr;
+    return NO_NODE;
 }
 
+
+// Функция для парсинга запроса с присваиванием: db($var, "query", аргументы...);
+NodeId Parser::parseDatabaseQuery() {
+    position++;
+    NodeId variable = parseVariable();
+    if (variable == NO_NODE) {
+        std::cerr << "Expected variable for assignment" << std::endl;
+        return NO_NODE;
+    }
+    if (peek().type != T_COMMA) {
+        std::cerr << "Expected query" << std::endl;
+        return NO_NODE;
+    }
+    position++;
+    if (peek().type != T_STRING) {
+        std::cerr << "Expected query" << std::endl;
+        return NO_NODE;
+    }
+    Node query(N_DB, unquote(peek()));
+    query.left = variable;
+    position++;
+
+    // Аргументы для параметров '?' связываются в порядке следования
+    NodeId last = NO_NODE;
+    while (peek().type == T_COMMA) {
+        position++;
+        Node argument(N_ARGUMENT);
+        argument.left = parseExpression();
+        NodeId id = ast.add(argument);
+        if (last == NO_NODE) {
+            query.right = id;
+        } else {
+            ast[last].right = id;
+        }
+        last = id;
+    }
+
+    if (peek().type != T_RPAREN) {
+        std::cerr << "Expected closing parenthesis" << std::endl;
+        return NO_NODE;
+    }
+    position++;
+    if (peek().type != T_SEMICOLON) {
+        std::cerr << "Expected semicolon after query" << std::endl;
+        return NO_NODE;
+    }
+    position++;
+    return ast.add(query);
+}
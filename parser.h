@@ -1,118 +1,116 @@
 #ifndef PARSER_H
 #define PARSER_H
 
-#include <memory>
+#include <cstdint>
 #include <string>
-#include <variant>
+#include <string_view>
 #include <vector>
 
-
-// Базовый класс для AST узлов
-class ASTNode {
-public:
-    virtual ~ASTNode() = default;
-};
-
-
-// Классы для узлов AST
-class PrintNode : public ASTNode {
-public:
-    PrintNode(std::unique_ptr<ASTNode> expr) : expr(std::move(expr)) {}
-    std::unique_ptr<ASTNode> expr;
-};
-
-
-class DatabaseQueryNode : public ASTNode {
-public:
-    DatabaseQueryNode(const std::string& query) : query(query) {}
-    std::string query;
+#include "arena.h"
+#include "lexer.h"
+#include "value.h"
+
+
+// Виды узлов AST
+enum NodeKind : uint8_t {
+    N_TEXT,          // text
+    N_PRINT,         // left: expression
+    N_DB,            // text: query; left: variable for db($var, ...), right: first N_ARGUMENT
+    N_HTTP,          // left: variable, right: url, data, header, type as consecutive N_STRING nodes
+    N_VARIABLE,      // text: name, slot
+    N_EXPRESSION,    // op, left, right
+    N_STRING,        // text without quotes
+    N_NUMBER,        // text, parsed integer or real
+    N_ASSIGNMENT,    // left: variable, right: expression
+    N_ARGUMENT       // left: expression, right: next N_ARGUMENT
 };
 
 
-class HttpRequestAssignmentNode : public ASTNode {
-public:
-    HttpRequestAssignmentNode(const std::string& var, const std::string& url,
-                              const std::string& data, const std::string& header, const std::string& type)
-        : variable(var), url(url), data(data), header(header), type(type) {}
-
-    std::string variable;
-    std::string url;
-    std::string data;
-    std::string header;
-    std::string type;
+// Индекс узла в Ast
+using NodeId = uint32_t;
+constexpr NodeId NO_NODE = UINT32_MAX;
+
+
+// Узел AST: дети задаются индексами, текст ссылается на исходный буфер
+struct Node {
+    NodeKind kind;
+    char op = 0;
+    bool isFloat = false;
+    uint32_t slot = 0;
+    uint32_t line = 0;      // позиция начала оператора в исходнике
+    uint32_t column = 0;
+    NodeId left = NO_NODE;
+    NodeId right = NO_NODE;
+    std::string_view text;
+    union {
+        int64_t integer;
+        double real;
+    };
+
+    Node(NodeKind kind, std::string_view text = {}) : kind(kind), text(text), integer(0) {}
 };
 
+// Значение числового литерала
+Value numberValue(const Node& node);
 
-class TextNode : public ASTNode {
-public:
-    TextNode(const std::string& text) : text(text) {}
-    std::string text;
-};
 
+class Ast;
 
-class VariableNode : public ASTNode {
-public:
-    VariableNode(const std::string& name) : name(name) {}
-    std::string name;
-};
+// Операнды цепочки конкатенаций слева направо; выражение без '.'
+// остаётся единственным операндом
+void concatOperands(const Ast& ast, NodeId id, std::vector<NodeId>& operands);
+// Присваивание вида $x = $x . ..., где $x больше не встречается справа:
+// строку можно дописать на месте, не копируя
+bool isSelfAppend(const Ast& ast, const Node& assignment, const std::vector<NodeId>& operands);
+// Число идущих подряд с инструкции first запросов db, аргументы которых не
+// читают переменные, заполняемые предыдущими из них: такие запросы можно
+// отправить в базу одним пакетом
+size_t dbBatchLength(const Ast& ast, size_t first);
 
 
-class ExpressionNode : public ASTNode {
+// Плоское AST: узлы лежат блоками в арене и освобождаются разом
+class Ast {
 public:
-    ExpressionNode(std::unique_ptr<ASTNode> left, const std::string& op, std::unique_ptr<ASTNode> right)
-        : left(std::move(left)), op(op), right(std::move(right)) {}
+    static constexpr uint32_t NODES_PER_BLOCK = 4096;
 
-    std::unique_ptr<ASTNode> left;
-    std::string op;
-    std::unique_ptr<ASTNode> right;
-};
+    NodeId add(const Node& node);
+    Node& operator[](NodeId id) { return blocks[id / NODES_PER_BLOCK][id % NODES_PER_BLOCK]; }
+    const Node& operator[](NodeId id) const { return blocks[id / NODES_PER_BLOCK][id % NODES_PER_BLOCK]; }
+    uint32_t size() const { return count; }
 
+    std::vector<NodeId> statements;
+    Arena arena;
 
-class StringNode : public ASTNode {
-public:
-    StringNode(const std::string& value) : value(value) {}
-    std::string value;
-};
-
-
-class NumberNode : public ASTNode {
-public:
-    NumberNode(const std::string& value) : value(value) {}
-    std::string value;
-};
-
-
-class AssignmentNode : public ASTNode {
-public:
-    AssignmentNode(std::unique_ptr<VariableNode> variable, std::unique_ptr<ASTNode> expr)
-        : variable(std::move(variable)), expr(std::move(expr)) {}
-
-    std::unique_ptr<VariableNode> variable;
-    std::unique_ptr<ASTNode> expr;
+private:
+    std::vector<Node*> blocks;
+    uint32_t count = 0;
 };
 
 
-// Определение варианта типа для значений переменных
-using VariableValue = std::variant<double, std::string>;
-
-
 class Parser {
 public:
-    Parser(const std::vector<Token>& tokens) : tokens(tokens), position(0) {}
+    Parser(const std::vector<Token>& tokens, std::string_view source) : tokens(tokens), source(source), position(0) {}
 
-    std::vector<std::unique_ptr<ASTNode>> parse();
-    static void printAST(const std::vector<std::unique_ptr<ASTNode>>& nodes);
+    Ast parse();
+    static void printAST(const Ast& ast);
 
 private:
     const std::vector<Token>& tokens;
+    std::string_view source;
     size_t position;
-
-    std::unique_ptr<ASTNode> parseExpression();
-    std::unique_ptr<ASTNode> parseTerm();
-    std::unique_ptr<ASTNode> parseFactor();
-    std::unique_ptr<VariableNode> parseVariable();
-    std::unique_ptr<ASTNode> parseHttpRequest();
+    Ast ast;
+
+    const Token& peek() const;
+    std::string_view span(const Token& token) const;
+    std::string_view unquote(const Token& token) const;
+    static void printNode(const Ast& ast, NodeId id);
+
+    NodeId parseExpression();
+    NodeId parseTerm();
+    NodeId parseFactor();
+    NodeId parseVariable();
+    NodeId parseHttpRequest();
+    NodeId parseDatabaseQuery();
 };
 
 #endif // PARSER_H
-
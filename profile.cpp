@@ -0,0 +1,207 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "memstats.h"
+#include "profile.h"
+
+
+static const char* statementKind(NodeKind kind) {
+    switch (kind) {
+        case N_TEXT: return "text";
+        case N_PRINT: return "echo";
+        case N_DB: return "db";
+        case N_HTTP: return "http";
+        case N_ASSIGNMENT: return "assign";
+        default: return "statement";
+    }
+}
+
+
+static void writeJsonString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out << escape;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+
+// Frame names may not contain the separators of the collapsed format
+static std::string frameName(const std::string& text) {
+    std::string name = text.substr(0, 120);
+    for (char& c : name) {
+        if (c == ';' || c == '\n' || c == '\r') {
+            c = ' ';
+        }
+    }
+    return name;
+}
+
+
+static long long micros(double seconds) {
+    return std::llround(seconds * 1e6);
+}
+
+
+void Profiler::phase(const char* name) {
+    MemStats::phase(name);
+    if (!enabled) {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    if (currentPhase != SIZE_MAX) {
+        phases[currentPhase].seconds += since(phaseStart, now);
+        currentPhase = SIZE_MAX;
+    }
+    if (!name) {
+        return;
+    }
+    for (size_t i = 0; i < phases.size(); ++i) {
+        if (std::string(phases[i].name) == name) {
+            currentPhase = i;
+        }
+    }
+    if (currentPhase == SIZE_MAX) {
+        currentPhase = phases.size();
+        phases.push_back({name});
+    }
+    phases[currentPhase].count++;
+    phaseStart = now;
+}
+
+
+void Profiler::setStatements(const Ast& ast) {
+    if (!enabled) {
+        return;
+    }
+    statements.clear();
+    statements.reserve(ast.statements.size());
+    for (NodeId id : ast.statements) {
+        const Node& node = ast[id];
+        statements.push_back({node.line, node.column, statementKind(node.kind)});
+    }
+    statementPhase = currentPhase;
+}
+
+
+void Profiler::statement(uint32_t index) {
+    if (!enabled) {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    if (current != NO_STATEMENT) {
+        statements[current].seconds += since(statementStart, now);
+    }
+    current = index < statements.size() ? index : NO_STATEMENT;
+    if (current != NO_STATEMENT) {
+        statements[current].count++;
+    }
+    MemStats::line(current != NO_STATEMENT ? statements[current].line : 0);
+    statementStart = now;
+}
+
+
+void Profiler::endStatements() {
+    statement(NO_STATEMENT);
+}
+
+
+void Profiler::call(const char* kind, const std::string& detail, uint32_t statement,
+                    Clock::time_point start, Clock::time_point end, bool synchronous) {
+    if (!enabled) {
+        return;
+    }
+    double seconds = since(start, end);
+    calls.push_back({kind, detail, statement, synchronous, since(started, start), seconds});
+    if (statement != NO_STATEMENT) {
+        statements[statement].calls++;
+        if (synchronous) {
+            statements[statement].callSeconds += seconds;
+        }
+    }
+}
+
+
+// Times are in microseconds
+void Profiler::writeJson(std::ostream& out) const {
+    double total = 0;
+    for (const Phase& phase : phases) {
+        total += phase.seconds;
+    }
+    out << "{\"unit\": \"us\", \"total\": " << micros(total) << ",\n \"phases\": [";
+    for (size_t i = 0; i < phases.size(); ++i) {
+        out << (i > 0 ? "," : "") << "\n  {\"name\": \"" << phases[i].name << "\", \"count\": "
+            << phases[i].count << ", \"time\": " << micros(phases[i].seconds) << "}";
+    }
+    out << "],\n \"statements\": [";
+    for (size_t i = 0; i < statements.size(); ++i) {
+        const Statement& statement = statements[i];
+        out << (i > 0 ? "," : "") << "\n  {\"index\": " << i << ", \"line\": " << statement.line
+            << ", \"column\": " << statement.column << ", \"kind\": \"" << statement.kind
+            << "\", \"count\": " << statement.count << ", \"time\": " << micros(statement.seconds)
+            << ", \"calls\": " << statement.calls << "}";
+    }
+    out << "],\n \"calls\": [";
+    for (size_t i = 0; i < calls.size(); ++i) {
+        const Call& call = calls[i];
+        out << (i > 0 ? "," : "") << "\n  {\"kind\": \"" << call.kind << "\", \"detail\": ";
+        writeJsonString(out, call.detail);
+        out << ", \"line\": " << (call.statement != NO_STATEMENT ? statements[call.statement].line : 0)
+            << ", \"start\": " << micros(call.start) << ", \"time\": " << micros(call.seconds) << "}";
+    }
+    out << "]}\n";
+}
+
+
+// Statements are nested in the phase that ran them and synchronous calls
+// in their statement, each frame counting its own time only. Background
+// http() requests overlap other frames and appear in the JSON report only.
+void Profiler::writeCollapsed(std::ostream& out) const {
+    double statementSeconds = 0;
+    for (const Statement& statement : statements) {
+        statementSeconds += statement.seconds;
+    }
+    for (size_t i = 0; i < phases.size(); ++i) {
+        double self = phases[i].seconds - (i == statementPhase ? statementSeconds : 0);
+        if (micros(self) > 0) {
+            out << "php;" << phases[i].name << " " << micros(self) << "\n";
+        }
+    }
+    std::string parent = std::string("php;") + (statementPhase < phases.size() ? phases[statementPhase].name : "execute");
+    for (size_t i = 0; i < statements.size(); ++i) {
+        const Statement& statement = statements[i];
+        std::string frame = parent + ";line " + std::to_string(statement.line) + ":" +
+                            std::to_string(statement.column) + " " + statement.kind;
+        if (micros(statement.seconds - statement.callSeconds) > 0) {
+            out << frame << " " << micros(statement.seconds - statement.callSeconds) << "\n";
+        }
+        for (const Call& call : calls) {
+            if (call.synchronous && call.statement == i && micros(call.seconds) > 0) {
+                out << frame << ";" << call.kind << " " << frameName(call.detail) << " " << micros(call.seconds) << "\n";
+            }
+        }
+    }
+}
+
+
+bool Profiler::save(const std::string& prefix) const {
+    std::ofstream json(prefix + ".json");
+    std::ofstream collapsed(prefix + ".folded");
+    if (!json || !collapsed) {
+        std::cerr << "Unable to write profile: " << prefix << std::endl;
+        return false;
+    }
+    writeJson(json);
+    writeCollapsed(collapsed);
+    return true;
+}
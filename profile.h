@@ -0,0 +1,91 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+
+
+// Profiler class: wall time and counts per pipeline phase, per top-level
+// statement and per http()/db call of a render. A disabled profiler
+// ignores every call; the interpreter does not even call it unless one
+// was set, and the statement markers the VM needs are only compiled in
+// when profiling (see Compiler::setProfiling()). Phase and statement
+// changes also go to MemStats when it is built in.
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+    static const uint32_t NO_STATEMENT = UINT32_MAX;
+
+    explicit Profiler(bool enabled = false) : enabled(enabled), started(Clock::now()) {}
+
+    bool isEnabled() const { return enabled; }
+
+    // Start a phase, ending the current one; nullptr only ends it
+    void phase(const char* name);
+
+    // Statements of the AST about to be executed, indexed like ast.statements
+    void setStatements(const Ast& ast);
+    // Statement `index` starts; the previous one ends
+    void statement(uint32_t index);
+    void endStatements();
+    uint32_t currentStatement() const { return current; }
+
+    // http() or db call issued by `statement`; the time of a synchronous
+    // call is part of the statement's own time
+    void call(const char* kind, const std::string& detail, uint32_t statement,
+              Clock::time_point start, Clock::time_point end, bool synchronous);
+
+    // JSON report and collapsed stacks for flamegraph.pl and compatible tools
+    void writeJson(std::ostream& out) const;
+    void writeCollapsed(std::ostream& out) const;
+    // Write <prefix>.json and <prefix>.folded
+    bool save(const std::string& prefix) const;
+
+private:
+    struct Phase {
+        const char* name;
+        uint64_t count = 0;
+        double seconds = 0;
+    };
+
+    struct Statement {
+        uint32_t line;
+        uint32_t column;
+        const char* kind;
+        uint64_t count = 0;
+        double seconds = 0;
+        uint64_t calls = 0;
+        double callSeconds = 0;     // synchronous calls, included in seconds
+    };
+
+    struct Call {
+        const char* kind;
+        std::string detail;
+        uint32_t statement;
+        bool synchronous;
+        double start;               // since the profiler was created
+        double seconds;
+    };
+
+    static double since(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double>(to - from).count();
+    }
+
+    bool enabled;
+    Clock::time_point started;
+    std::vector<Phase> phases;
+    size_t currentPhase = SIZE_MAX;
+    Clock::time_point phaseStart;
+    size_t statementPhase = SIZE_MAX;     // phase the statements ran in
+    std::vector<Statement> statements;
+    uint32_t current = NO_STATEMENT;
+    Clock::time_point statementStart;
+    std::vector<Call> calls;
+};
+
+#endif // PROFILE_H
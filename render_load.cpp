@@ -0,0 +1,174 @@
+// Load test for renders on the event loop: a local server answers every
+// http() request after a fixed delay, and a template that calls it (plus
+// one db statement) is rendered many times. Each thread runs one event
+// loop that keeps up to -c renders in flight; the report shows how many
+// were in flight at once on each thread. --blocking renders with run()
+// instead, one render per thread at a time, for comparison.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "db.h"
+#include "interpret.h"
+#include "loopback.h"
+#include "output.h"
+#include "scheduler.h"
+
+
+// Per-thread counters of the coroutine renders
+struct LoopStats {
+    size_t inFlight = 0;
+    size_t peak = 0;
+    size_t completed = 0;
+    size_t bytes = 0;
+};
+
+
+static std::string makeTemplate(int port, int calls) {
+    std::string url = "http://127.0.0.1:" + std::to_string(port) + "/";
+    std::string text = "<?php\n";
+    std::string echo = "$name . \": \"";
+    for (int i = 0; i < calls; ++i) {
+        std::string name = "$r" + std::to_string(i);
+        text += "http(" + name + ", \"" + url + std::to_string(i) + "\", \"\", \"\", \"GET\");\n";
+        echo += " . " + name;
+    }
+    text += "db($name, \"SELECT name FROM users WHERE id = ?\", 1);\n?>\n";
+    text += "<p><?php echo " + echo + "; ?></p>\n";
+    return text;
+}
+
+
+static Task<void> renderOne(EventLoop& loop, const Program& program, DbPool& database, int sinkFd,
+                            LoopStats& stats) {
+    AsyncFdSink sink(loop, sinkFd);
+    OutputBuffer output(sink);
+    Interpreter interpreter(program.symbols, output);
+    interpreter.setEventLoop(loop, &sink);
+    interpreter.setDatabase(database);
+    stats.peak = std::max(stats.peak, ++stats.inFlight);
+    co_await interpreter.render(program.view());
+    output.flush();
+    co_await sink.drain();
+    stats.bytes += sink.written();
+    stats.inFlight--;
+    stats.completed++;
+}
+
+// One slot of a thread's in-flight renders: renders until none are left
+static Task<void> renderSlot(EventLoop& loop, const Program& program, DbPool& database, int sinkFd,
+                             std::atomic<size_t>& next, size_t total, LoopStats& stats) {
+    while (next.fetch_add(1) < total) {
+        co_await renderOne(loop, program, database, sinkFd, stats);
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t renders = 2000;
+    size_t concurrency = 500;
+    int threads = 1;
+    double delayMs = 50;
+    int calls = 2;
+    bool blocking = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string flag = argv[i];
+        if (flag == "--blocking") {
+            blocking = true;
+        } else if (i + 1 < argc && flag == "-n") {
+            renders = std::max(1L, std::atol(argv[++i]));
+        } else if (i + 1 < argc && flag == "-c") {
+            concurrency = std::max(1L, std::atol(argv[++i]));
+        } else if (i + 1 < argc && flag == "-t") {
+            threads = std::max(1, std::atoi(argv[++i]));
+        } else if (i + 1 < argc && flag == "-d") {
+            delayMs = std::max(0.0, std::atof(argv[++i]));
+        } else if (i + 1 < argc && flag == "-k") {
+            calls = std::clamp(std::atoi(argv[++i]), 1, 8);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [-n renders] [-c in-flight renders per thread] [-t threads]"
+                      << " [-d delay_ms] [-k http_calls] [--blocking]" << std::endl;
+            return 1;
+        }
+    }
+
+    // The delayed server runs on its own event loop thread
+    LoopbackServer server(delayMs / 1000);
+    if (!server.start()) {
+        std::cerr << "Unable to listen: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    int port = server.port();
+
+    std::string source = makeTemplate(port, calls);
+    Program program = compileTemplate(source);
+    DbPool database(makeDbDriver("memory"));
+    std::string error;
+    if (!database.executeScript("CREATE TABLE users (id INT, name TEXT); INSERT INTO users VALUES (1, 'ann');", error)) {
+        std::cerr << "Database error: " << error << std::endl;
+        return 1;
+    }
+
+    std::atomic<size_t> next{0};
+    std::vector<LoopStats> stats(threads);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            int sinkFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+            LoopStats& own = stats[t];
+            if (blocking) {
+                while (next.fetch_add(1) < renders) {
+                    FdSink sink(sinkFd);
+                    OutputBuffer output(sink);
+                    Interpreter interpreter(program.symbols, output);
+                    interpreter.setDatabase(database);
+                    own.peak = 1;
+                    interpreter.run(program.view());
+                    output.flush();
+                    own.completed++;
+                }
+            } else {
+                EventLoop loop;
+                for (size_t slot = 0; slot < concurrency; ++slot) {
+                    loop.spawn(renderSlot(loop, program, database, sinkFd, next, renders, own));
+                }
+                loop.run();
+            }
+            close(sinkFd);
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t completed = 0;
+    size_t peak = 0;
+    std::string perThread;
+    for (int t = 0; t < threads; ++t) {
+        completed += stats[t].completed;
+        peak = std::max(peak, stats[t].peak);
+        perThread += (t ? ", " : "") + std::to_string(stats[t].peak);
+    }
+    std::printf("mode:        %s, %d thread%s\n", blocking ? "blocking" : "coroutines", threads, threads == 1 ? "" : "s");
+    std::printf("renders:     %zu, %d http() calls each against a %.0f ms server, %zu requests served\n",
+                completed, calls, delayMs, server.requests());
+    std::printf("time:        %.3f s\n", elapsed.count());
+    std::printf("throughput:  %.1f renders/s\n", completed / elapsed.count());
+    std::printf("in flight:   peak %zu renders per thread (%s)\n", peak, perThread.c_str());
+    return completed == renders && server.requests() == renders * calls ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include "resolver.h"
+
+
+uint32_t SymbolTable::slotFor(const std::string& name) {
+    auto it = slots.find(name);
+    if (it != slots.end()) {
+        return it->second;
+    }
+    uint32_t slot = static_cast<uint32_t>(names.size());
+    names.push_back(name);
+    slots.emplace(name, slot);
+    return slot;
+}
+
+
+const uint32_t* SymbolTable::find(const std::string& name) const {
+    auto it = slots.find(name);
+    return it != slots.end() ? &it->second : nullptr;
+}
+
+
+SymbolTable Resolver::resolve(Ast& ast) {
+    symbols = SymbolTable{};
+    extend(ast);
+    return std::move(symbols);
+}
+
+
+const SymbolTable& Resolver::extend(Ast& ast) {
+    for (NodeId id : ast.statements) {
+        const Node& node = ast[id];
+        switch (node.kind) {
+            case N_PRINT:
+                resolveExpression(ast, node.left);
+                break;
+            case N_HTTP:
+                resolveExpression(ast, node.left);
+                break;
+            case N_DB:
+                resolveExpression(ast, node.left);
+                for (NodeId argument = node.right; argument != NO_NODE; argument = ast[argument].right) {
+                    resolveExpression(ast, ast[argument].left);
+                }
+                break;
+            case N_ASSIGNMENT:
+                resolveExpression(ast, node.right);
+                resolveExpression(ast, node.left);
+                break;
+            default:
+                break;
+        }
+    }
+    return symbols;
+}
+
+
+void Resolver::resolveExpression(Ast& ast, NodeId id) {
+    if (id == NO_NODE) {
+        return;
+    }
+    Node& node = ast[id];
+    if (node.kind == N_VARIABLE) {
+        node.slot = symbols.slotFor(std::string(node.text));
+    } else if (node.kind == N_EXPRESSION) {
+        resolveExpression(ast, node.left);
+        resolveExpression(ast, node.right);
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parser.h"
+
+
+// Variable names in slot order, with the reverse index used for dynamic
+// access by name and for debug dumps
+struct SymbolTable {
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> slots;
+
+    uint32_t slotFor(const std::string& name);
+    const uint32_t* find(const std::string& name) const;
+};
+
+
+// Resolver class: assigns a dense frame slot to every variable in the AST
+class Resolver {
+public:
+    SymbolTable resolve(Ast& ast);
+    // Resolve more statements against the slots assigned so far, for
+    // templates that are parsed in parts
+    const SymbolTable& extend(Ast& ast);
+
+private:
+    void resolveExpression(Ast& ast, NodeId id);
+
+    SymbolTable symbols;
+};
+
+#endif // RESOLVER_H
@@ -0,0 +1,368 @@
+#include <stdexcept>
+#include <array>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+
+#include "runtime.h"
+
+
+Runtime::Runtime(const SymbolTable& symbols, OutputBuffer& output)
+    : out(output), symbols(&symbols), frame(symbols.names.size()), defined(symbols.names.size(), false),
+      pending(symbols.names.size(), false) {}
+
+
+void Runtime::declare(const SymbolTable& table) {
+    if (ownSymbols) {
+        for (size_t slot = ownSymbols->names.size(); slot < table.names.size(); ++slot) {
+            ownSymbols->slotFor(table.names[slot]);
+        }
+    } else {
+        symbols = &table;
+    }
+    frame.resize(symbols->names.size());
+    defined.resize(symbols->names.size(), false);
+    pending.resize(symbols->names.size(), false);
+}
+
+void Runtime::finish() {
+    resolveAll();
+}
+
+std::string Runtime::exec(const char* cmd) {
+    std::array<char, 128> buffer;
+    std::string result;
+    std::shared_ptr<FILE> pipe(popen(cmd, "r"), pclose);
+    if (!pipe) throw std::runtime_error("popen() failed!");
+    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
+        result += buffer.data();
+    }
+    return result;
+}
+
+const Value& Runtime::loadVariable(uint32_t slot) {
+    static const Value null;
+    if (pending[slot]) {
+        resolvePending(slot);
+    }
+    if (defined[slot]) {
+        return frame[slot];
+    }
+    std::cerr << "Undefined variable: " << symbols->names[slot] << std::endl;
+    return null;
+}
+
+Value Runtime::takeVariable(uint32_t slot) {
+    loadVariable(slot);
+    return defined[slot] ? std::move(frame[slot]) : Value{};
+}
+
+void Runtime::writeValue(const Value& value) {
+    if (auto text = std::get_if<std::string>(&value)) {
+        out.write(*text);
+    } else {
+        out.write(toString(value));
+    }
+}
+
+void Runtime::storeVariable(uint32_t slot, Value value) {
+    if (pending[slot]) {
+        detachPending(slot);
+    }
+    frame[slot] = std::move(value);
+    defined[slot] = true;
+}
+
+const Value* Runtime::getVariable(const std::string& name) const {
+    const uint32_t* slot = symbols->find(name);
+    if (slot && defined[*slot]) {
+        return &frame[*slot];
+    }
+    return nullptr;
+}
+
+// Names that the program never mentions get a fresh slot at the end of the frame
+void Runtime::setVariable(const std::string& name, Value value) {
+    const uint32_t* known = symbols->find(name);
+    if (known) {
+        storeVariable(*known, std::move(value));
+        return;
+    }
+    if (!ownSymbols) {
+        ownSymbols = std::make_unique<SymbolTable>(*symbols);
+        symbols = ownSymbols.get();
+    }
+    uint32_t slot = ownSymbols->slotFor(name);
+    if (slot >= frame.size()) {
+        frame.resize(slot + 1);
+        defined.resize(slot + 1, false);
+        pending.resize(slot + 1, false);
+    }
+    storeVariable(slot, std::move(value));
+}
+
+void Runtime::dumpVariables(std::ostream& out) const {
+    for (size_t slot = 0; slot < symbols->names.size(); ++slot) {
+        out << symbols->names[slot] << " = ";
+        if (!defined[slot]) {
+            out << "(unset)";
+        } else if (std::holds_alternative<std::string>(frame[slot])) {
+            out << '"' << std::get<std::string>(frame[slot]) << '"';
+        } else if (std::holds_alternative<std::monostate>(frame[slot])) {
+            out << "null";
+        } else {
+            out << toString(frame[slot]);
+        }
+        out << std::endl;
+    }
+}
+
+// Rows as lines of comma-separated values
+static std::string formatRows(const DbResult& result) {
+    std::string text;
+    for (size_t row = 0; row < result.rows.size(); ++row) {
+        if (row > 0) {
+            text += '\n';
+        }
+        for (size_t column = 0; column < result.rows[row].size(); ++column) {
+            if (column > 0) {
+                text += ", ";
+            }
+            appendTo(text, result.rows[row][column]);
+        }
+    }
+    return text;
+}
+
+// Without a target the rows are printed. A variable gets a single value
+// as is, null for no rows, the affected row count for statements that
+// return no columns, and the printed form otherwise.
+void Runtime::databaseQuery(uint32_t slot, const std::string& query, const std::vector<Value>& params) {
+    std::vector<DbQuery> queries(1);
+    queries[0].query = query;
+    queries[0].params = params;
+    databaseQueries(queries, &slot);
+}
+
+// One round trip for the batch; results are bound in statement order
+void Runtime::databaseQueries(std::vector<DbQuery>& queries, const uint32_t* slots) {
+    Profiler::Clock::time_point started = profiler ? Profiler::Clock::now() : Profiler::Clock::time_point{};
+    database->executeBatch(queries);
+    if (profiler) {
+        Profiler::Clock::time_point finished = Profiler::Clock::now();
+        for (const DbQuery& query : queries) {
+            profiler->call("db", query.query, profiler->currentStatement(), started, finished, true);
+        }
+    }
+    for (size_t i = 0; i < queries.size(); ++i) {
+        bindResult(slots[i], queries[i]);
+    }
+}
+
+void Runtime::bindResult(uint32_t slot, DbQuery& query) {
+    if (!query.ok) {
+        std::cerr << "Database error: " << query.error << ": " << query.query << std::endl;
+        if (slot != NO_SLOT) {
+            storeVariable(slot, Value{});
+        }
+        return;
+    }
+    DbResult& result = query.result;
+    if (slot == NO_SLOT) {
+        out.write(formatRows(result));
+        out.write("\n");
+    } else if (result.columns.empty()) {
+        storeVariable(slot, static_cast<int64_t>(result.affected));
+    } else if (result.rows.empty()) {
+        storeVariable(slot, Value{});
+    } else if (result.rows.size() == 1 && result.rows[0].size() == 1) {
+        storeVariable(slot, std::move(result.rows[0][0]));
+    } else {
+        storeVariable(slot, formatRows(result));
+    }
+}
+
+// http() only starts the request; the variable is bound to the result
+// when it is first read, or when the render ends
+void Runtime::httpRequest(uint32_t slot, const std::string& url, const std::string& data,
+                          const std::string& header, const std::string& method) {
+    if (pending[slot]) {
+        detachPending(slot);
+    }
+    while (inFlight.size() >= httpConcurrency) {
+        PendingHttp oldest = std::move(inFlight.front());
+        inFlight.pop_front();
+        finishHttp(oldest);
+    }
+    if (loop) {
+        auto state = std::make_shared<AsyncHttp>();
+        startAsyncHttp(state, url, data, header, method);
+        inFlight.push_back({slot, url, std::future<HttpResult>(),
+                            profiler ? profiler->currentStatement() : Profiler::NO_STATEMENT,
+                            Profiler::Clock::now(), state});
+        pending[slot] = true;
+        return;
+    }
+    HttpBackend backend = httpBackend;
+    inFlight.push_back({slot, url, std::async(std::launch::async, [backend, url, data, header, method]() {
+        HttpResult result = httpExchange(backend, url, data, header, method);
+        result.finished = Profiler::Clock::now();
+        return result;
+    }), profiler ? profiler->currentStatement() : Profiler::NO_STATEMENT, Profiler::Clock::now(), nullptr});
+    pending[slot] = true;
+}
+
+// The method comes from the type argument; anything that is not an
+// HTTP method token falls back to GET, like the curl command did.
+// Runs on a background thread and touches no render state.
+Runtime::HttpResult Runtime::httpExchange(HttpBackend backend, const std::string& url,
+                                          const std::string& data, const std::string& header,
+                                          const std::string& method) {
+    HttpResult result;
+    if (backend == HTTP_NATIVE) {
+        HttpResponse response;
+        result.ok = HttpCache::shared().request(requestMethod(method), url, data, header, response, result.error);
+        result.body = std::move(response.body);
+        return result;
+    }
+
+    std::string command = "curl -X GET ";
+    command += "--data \"" + data + "\" ";
+    command += "-H \"" + header + "\" ";
+    command += url;
+
+    result.body = exec(command.c_str());
+    result.ok = true;
+    return result;
+}
+
+std::string Runtime::requestMethod(const std::string& method) {
+    bool token = !method.empty();
+    for (char c : method) {
+        token = token && c >= 'A' && c <= 'Z';
+    }
+    return token ? method : "GET";
+}
+
+
+// The native client runs on the loop itself. Through the response cache
+// or curl a request blocks, so it goes to the loop's blocking work. Either
+// way the loop owns the task, so an abandoned render leaves it nothing
+// dangling.
+void Runtime::startAsyncHttp(const std::shared_ptr<AsyncHttp>& state, const std::string& url,
+                             const std::string& data, const std::string& header, const std::string& method) {
+    if (httpBackend == HTTP_NATIVE && !HttpCache::shared().enabled()) {
+        loop->spawn(fetchHttp(*loop, state, requestMethod(method), url, data, header));
+    } else {
+        loop->spawn(exchangeHttp(*loop, state, httpBackend, url, data, header, method));
+    }
+}
+
+Task<void> Runtime::fetchHttp(EventLoop& loop, std::shared_ptr<AsyncHttp> state, std::string method,
+                              std::string url, std::string data, std::string header) {
+    HttpResult result;
+    HttpResponse response;
+    result.ok = co_await HttpClient::shared().requestAsync(loop, method, url, data, header, response, result.error);
+    result.body = std::move(response.body);
+    result.finished = Profiler::Clock::now();
+    completeHttp(loop, *state, std::move(result));
+}
+
+Task<void> Runtime::exchangeHttp(EventLoop& loop, std::shared_ptr<AsyncHttp> state, HttpBackend backend,
+                                 std::string url, std::string data, std::string header, std::string method) {
+    HttpResult result;
+    co_await loop.blocking([&]() { result = httpExchange(backend, url, data, header, method); });
+    result.finished = Profiler::Clock::now();
+    completeHttp(loop, *state, std::move(result));
+}
+
+void Runtime::completeHttp(EventLoop& loop, AsyncHttp& state, HttpResult result) {
+    state.result = std::move(result);
+    state.done = true;
+    if (state.waiter) {
+        loop.schedule(std::exchange(state.waiter, {}));
+    }
+}
+
+
+Runtime::HttpWait Runtime::httpResult(uint32_t slot) const {
+    for (const PendingHttp& request : inFlight) {
+        if (request.slot == slot) {
+            return {request.async};
+        }
+    }
+    return {};
+}
+
+Runtime::HttpWait Runtime::httpCapacity() const {
+    return inFlight.size() >= httpConcurrency ? HttpWait{inFlight.front().async} : HttpWait{};
+}
+
+Task<void> Runtime::databaseQueriesAsync(std::vector<DbQuery>& queries, const uint32_t* slots) {
+    DbPool* pool = database;
+    uint32_t statement = profiler ? profiler->currentStatement() : Profiler::NO_STATEMENT;
+    Profiler::Clock::time_point started = profiler ? Profiler::Clock::now() : Profiler::Clock::time_point{};
+    co_await loop->blocking([pool, &queries]() { pool->executeBatch(queries); });
+    if (profiler) {
+        Profiler::Clock::time_point finished = Profiler::Clock::now();
+        for (const DbQuery& query : queries) {
+            profiler->call("db", query.query, statement, started, finished, true);
+        }
+    }
+    for (size_t i = 0; i < queries.size(); ++i) {
+        bindResult(slots[i], queries[i]);
+    }
+}
+
+Task<void> Runtime::resolveAllAsync() {
+    for (const PendingHttp& request : inFlight) {
+        co_await HttpWait{request.async};
+    }
+    resolveAll();
+}
+
+
+// Wait for a request and bind its result, unless the variable moved on
+void Runtime::finishHttp(PendingHttp& request) {
+    HttpResult result = request.async ? std::move(request.async->result) : request.result.get();
+    if (profiler) {
+        profiler->call("http", request.url, request.statement, request.started, result.finished, false);
+    }
+    if (!result.ok) {
+        std::cerr << "HTTP request failed: " << request.url << ": " << result.error << std::endl;
+        result.body.clear();
+    }
+    if (request.slot != NO_SLOT) {
+        pending[request.slot] = false;
+        frame[request.slot] = std::move(result.body);
+        defined[request.slot] = true;
+    }
+}
+
+void Runtime::resolvePending(uint32_t slot) {
+    for (auto it = inFlight.begin(); it != inFlight.end(); ++it) {
+        if (it->slot == slot) {
+            PendingHttp request = std::move(*it);
+            inFlight.erase(it);
+            finishHttp(request);
+            return;
+        }
+    }
+}
+
+void Runtime::detachPending(uint32_t slot) {
+    for (PendingHttp& request : inFlight) {
+        if (request.slot == slot) {
+            request.slot = NO_SLOT;
+        }
+    }
+    pending[slot] = false;
+}
+
+void Runtime::resolveAll() {
+    while (!inFlight.empty()) {
+        PendingHttp request = std::move(inFlight.front());
+        inFlight.pop_front();
+        finishHttp(request);
+    }
+}
@@ -0,0 +1,176 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "resolver.h"
+#include "db.h"
+#include "http.h"
+#include "httpcache.h"
+#include "output.h"
+#include "profile.h"
+#include "scheduler.h"
+#include "value.h"
+
+
+// How http() statements are executed
+enum HttpBackend {
+    HTTP_NATIVE,     // built-in client with pooled keep-alive connections
+    HTTP_CURL        // curl through popen, kept for comparison
+};
+
+
+// State of one render: the variable frame, the output, and the db and http
+// statements with their in-flight requests. The interpreter and the VM run
+// on top of it; templates compiled to C++ call it directly.
+class Runtime {
+public:
+    static const uint32_t NO_SLOT = UINT32_MAX;
+    // Requests that may be in flight at once during one render
+    static const size_t DEFAULT_HTTP_CONCURRENCY = 8;
+
+    // The symbol table must outlive the runtime
+    Runtime(const SymbolTable& symbols, OutputBuffer& output);
+
+    // Switch to a symbol table grown by the resolver, for templates that
+    // are resolved in parts
+    void declare(const SymbolTable& table);
+    // Wait for the requests still in flight; the render is over
+    void finish();
+
+    // Access by name, for variables bound from outside and debug dumps
+    const Value* getVariable(const std::string& name) const;
+    void setVariable(const std::string& name, Value value);
+    void dumpVariables(std::ostream& out) const;
+
+    void setHttpBackend(HttpBackend backend) { httpBackend = backend; }
+    void setHttpConcurrency(size_t limit) { httpConcurrency = limit > 0 ? limit : 1; }
+    // Pool used by db statements, DbPool::shared() by default
+    void setDatabase(DbPool& pool) { database = &pool; }
+    // Statement and call timings go to the profiler when one is set
+    void setProfiler(Profiler& profile) { profiler = &profile; }
+    // Render as a coroutine on the loop (Interpreter::render()): instead of
+    // blocking the thread, it suspends while an http() result or a db
+    // statement is pending, or while `output` cannot take more
+    void setEventLoop(EventLoop& eventLoop, AsyncFdSink* output = nullptr) {
+        loop = &eventLoop;
+        asyncOutput = output;
+    }
+
+    OutputBuffer& output() { return out; }
+
+    // Frame access by slot. Reading an unset variable warns and gives null;
+    // reading one bound by http() waits for its request.
+    const Value& loadVariable(uint32_t slot);
+    // Value of the slot moved out, for a concatenation stored back into it
+    Value takeVariable(uint32_t slot);
+    void storeVariable(uint32_t slot, Value value);
+    void writeValue(const Value& value);
+
+    // db statement; without a target slot (NO_SLOT) the rows are printed
+    void databaseQuery(uint32_t slot, const std::string& query, const std::vector<Value>& params);
+    // Independent db statements sent as one batch; slots[i] is the target of queries[i]
+    void databaseQueries(std::vector<DbQuery>& queries, const uint32_t* slots);
+    // http() statement; the request runs in the background
+    void httpRequest(uint32_t slot, const std::string& url, const std::string& data,
+                     const std::string& header, const std::string& method);
+
+protected:
+    struct HttpResult {
+        bool ok = false;
+        std::string body;
+        std::string error;
+        Profiler::Clock::time_point finished;
+    };
+
+    // Result of an http() made on the event loop, set on the loop thread
+    struct AsyncHttp {
+        bool done = false;
+        HttpResult result;
+        std::coroutine_handle<> waiter;
+    };
+
+    // Awaitable that resumes once the request is done
+    struct HttpWait {
+        std::shared_ptr<AsyncHttp> state;
+        MemStats::State memory = {};
+
+        bool await_ready() const noexcept { return !state || state->done; }
+        void await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            state->waiter = awaiting;
+            memory = MemStats::current();
+        }
+        void await_resume() const noexcept { MemStats::restore(memory); }
+    };
+
+    // http() started in the background; slot is NO_SLOT once the variable
+    // has been assigned again and the result is no longer wanted. With an
+    // event loop the result arrives in `async` instead of `result`.
+    struct PendingHttp {
+        uint32_t slot;
+        std::string url;
+        std::future<HttpResult> result;
+        uint32_t statement;
+        Profiler::Clock::time_point started;
+        std::shared_ptr<AsyncHttp> async;
+    };
+
+    static std::string exec(const char* cmd);
+    static HttpResult httpExchange(HttpBackend backend, const std::string& url, const std::string& data,
+                                   const std::string& header, const std::string& method);
+    void bindResult(uint32_t slot, DbQuery& query);
+    static std::string requestMethod(const std::string& method);
+    void startAsyncHttp(const std::shared_ptr<AsyncHttp>& state, const std::string& url, const std::string& data,
+                        const std::string& header, const std::string& method);
+    static Task<void> fetchHttp(EventLoop& loop, std::shared_ptr<AsyncHttp> state, std::string method,
+                                std::string url, std::string data, std::string header);
+    static Task<void> exchangeHttp(EventLoop& loop, std::shared_ptr<AsyncHttp> state, HttpBackend backend,
+                                   std::string url, std::string data, std::string header, std::string method);
+    static void completeHttp(EventLoop& loop, AsyncHttp& state, HttpResult result);
+
+    // Suspension points of a render on the event loop
+    HttpWait httpResult(uint32_t slot) const;
+    HttpWait httpCapacity() const;
+    Task<void> databaseQueriesAsync(std::vector<DbQuery>& queries, const uint32_t* slots);
+    Task<void> resolveAllAsync();
+    bool outputBacklog() const { return asyncOutput && asyncOutput->backlog() > 0; }
+    void finishHttp(PendingHttp& request);
+    void resolvePending(uint32_t slot);
+    void detachPending(uint32_t slot);
+    void resolveAll();
+
+    OutputBuffer& out;
+    DbPool* database = &DbPool::shared();
+    Profiler* profiler = nullptr;
+    HttpBackend httpBackend = HTTP_NATIVE;
+    size_t httpConcurrency = DEFAULT_HTTP_CONCURRENCY;
+    EventLoop* loop = nullptr;
+    AsyncFdSink* asyncOutput = nullptr;
+    std::deque<PendingHttp> inFlight;
+    // Frame of variable values indexed by slot; a clear bit marks an unset
+    // slot, a set pending bit a slot still waiting for its http() result
+    const SymbolTable* symbols;
+    // Private copy, made when setVariable() adds a name the program lacks
+    std::unique_ptr<SymbolTable> ownSymbols;
+    std::vector<Value> frame;
+    std::vector<bool> defined;
+    std::vector<bool> pending;
+};
+
+
+// Concatenation of the parts of a '.' chain in generated code, evaluated
+// left to right
+template <typename... Parts>
+std::string concat(Parts&&... parts) {
+    Value values[] = {Value(std::forward<Parts>(parts))...};
+    return concatenate(values, sizeof...(Parts));
+}
+
+#endif // RUNTIME_H
@@ -0,0 +1,15 @@
+<?php
+db "CREATE TABLE users (id INT, name TEXT)";
+db "INSERT INTO users VALUES (1, 'ann')";
+db "INSERT INTO users VALUES (2, 'bob')";
+$id = 2;
+db($a, "SELECT name FROM users WHERE id = ?", 1);
+db($b, "SELECT name FROM users WHERE id = ?", $id);
+db($c, "SELECT  name FROM users   WHERE id = ?;", $a);
+db "SELECT name FROM users";
+echo $a . " " . $b . " " . $c;
+db($d, "SELECT name FROM users WHERE id = ?", 1);
+db "UPDATE users SET name = 'zed' WHERE id = 1";
+db($e, "SELECT name FROM users WHERE id = ?", 1);
+echo $d . " " . $e;
+?>
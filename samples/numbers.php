@@ -0,0 +1,17 @@
+<?php
+$int = 7;
+$float = 2.5;
+$big = 9223372036854775807;
+$numeric = "  12";
+$text = "abc";
+?>
+<h1>Numbers</h1>
+<p>int + float: <?php echo $int + $float; ?></p>
+<p>int / int: <?php echo 10 / 4; ?>, <?php echo 10 / 5; ?></p>
+<p>overflow: <?php echo $big + 1; ?></p>
+<p>numeric string: <?php echo $numeric * 2; ?>, <?php echo "1e3" + 1; ?></p>
+<p>text in arithmetic: <?php echo $text + 1; ?></p>
+<p>division by zero: <?php echo $int / 0; ?></p>
+<p>precedence: <?php echo 2 + 3 * 4 - 6 / 3; ?>, <?php echo (2 + 3) * 4; ?></p>
+<p>concat: <?php echo $int . $float . 0.1 + 0.2; ?></p>
+<p>undefined: <?php echo $missing . "!"; ?></p>
@@ -0,0 +1,17 @@
+<!DOCTYPE html>
+<html>
+  <body>
+    <p>a < b and b > a, <em>tags</em> &amp; entities</p>
+<?php $greeting = "Hello"; $name = "World"; ?>
+    <p><?php echo $greeting . ", " . $name . "!"; ?></p>
+    <p>less than before code: 1 <<?php echo 2; ?></p>
+<?php
+// a comment
+/* a block comment */
+$line = "one" . " " . "line";
+$greeting = $greeting . " again";
+?>
+    <p><?php echo $line; ?> / <?php echo $greeting; ?></p>
+    <script>if (a < b && c > d) {}</script>
+  </body>
+</html>
@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "scheduler.h"
+#include "threadpool.h"
+
+
+const uint32_t EventLoop::EPOLL_READ = EPOLLIN | EPOLLRDHUP;
+const uint32_t EventLoop::EPOLL_WRITE = EPOLLOUT;
+
+
+EventLoop::EventLoop() : epollFd(epoll_create1(EPOLL_CLOEXEC)), wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (epollFd < 0 || wakeFd < 0) {
+        std::cerr << "Unable to create event loop: " << std::strerror(errno) << std::endl;
+        std::terminate();
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+}
+
+EventLoop::~EventLoop() {
+    // Blocking work still running refers to suspended tasks and posts to
+    // the loop when done, and a thread that posted last may still be
+    // writing the eventfd
+    std::unique_lock<std::mutex> lock(postMutex);
+    blockingDone.wait(lock, [this]() { return blockingJobs == 0; });
+    close(wakeFd);
+    close(epollFd);
+}
+
+
+void EventLoop::spawn(Task<void> task) {
+    spawned.push_back(std::move(task));
+    // Started from the loop, so that spawning never runs a task inline
+    ready.push_back(std::coroutine_handle<>());
+}
+
+void EventLoop::stop() {
+    post([this]() { stopped = true; });
+}
+
+void EventLoop::post(std::function<void()> work) {
+    std::lock_guard<std::mutex> lock(postMutex);
+    posted.push_back(std::move(work));
+    uint64_t one = 1;
+    ssize_t written = write(wakeFd, &one, sizeof(one));
+    (void)written;
+}
+
+void EventLoop::finishBlocking(std::coroutine_handle<> awaiting) {
+    std::lock_guard<std::mutex> lock(postMutex);
+    posted.push_back([this, awaiting]() { schedule(awaiting); });
+    uint64_t one = 1;
+    ssize_t written = write(wakeFd, &one, sizeof(one));
+    (void)written;
+    blockingJobs--;
+    blockingDone.notify_all();
+}
+
+void EventLoop::schedule(std::coroutine_handle<> coroutine) {
+    ready.push_back(coroutine);
+}
+
+
+void EventLoop::arm(Wait& wait) {
+    if (wait.timeout > 0) {
+        auto delay = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(wait.timeout));
+        wait.timer = timers.emplace(Clock::now() + delay, &wait);
+        wait.timed = true;
+    }
+    if (wait.fd < 0) {
+        return;
+    }
+    epoll_event event{};
+    event.events = wait.events | EPOLLONESHOT;
+    event.data.ptr = &wait;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, wait.fd, &event) != 0 &&
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wait.fd, &event) != 0) {
+        // Not pollable (a regular file, /dev/null): always ready
+        if (wait.timed) {
+            timers.erase(wait.timer);
+            wait.timed = false;
+        }
+        ready.push_back(wait.coroutine);
+    }
+}
+
+void EventLoop::wake(Wait& wait, bool timedOut) {
+    if (wait.timed) {
+        timers.erase(wait.timer);
+        wait.timed = false;
+    }
+    if (timedOut && wait.fd >= 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, wait.fd, nullptr);
+    }
+    wait.timedOut = timedOut && wait.fd >= 0;
+    resume(wait.coroutine);
+}
+
+void EventLoop::resume(std::coroutine_handle<> coroutine) {
+    MemStats::State outside = MemStats::current();
+    coroutine.resume();
+    MemStats::restore(outside);
+}
+
+
+// Resume what is ready; a null handle starts the oldest unstarted task
+void EventLoop::runReady() {
+    size_t unstarted = 0;
+    while (!ready.empty()) {
+        std::vector<std::coroutine_handle<>> batch;
+        batch.swap(ready);
+        for (std::coroutine_handle<> coroutine : batch) {
+            if (coroutine) {
+                resume(coroutine);
+            } else {
+                unstarted++;
+            }
+        }
+    }
+    if (unstarted > 0) {
+        // Newly spawned tasks are at the end of the list. Starting them may
+        // spawn more, which the next round starts.
+        std::vector<Task<void>*> starting;
+        auto task = spawned.end();
+        std::advance(task, -static_cast<std::ptrdiff_t>(unstarted));
+        for (; task != spawned.end(); ++task) {
+            starting.push_back(&*task);
+        }
+        MemStats::State outside = MemStats::current();
+        for (Task<void>* start : starting) {
+            start->start();
+            MemStats::restore(outside);
+        }
+        runReady();
+    }
+}
+
+
+void EventLoop::run() {
+    static const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    stopped = false;
+    for (;;) {
+        runReady();
+        spawned.remove_if([](const Task<void>& task) { return task.done(); });
+        if (spawned.empty() || stopped) {
+            return;
+        }
+
+        int timeout = -1;
+        if (!timers.empty()) {
+            auto wait = timers.begin()->first - Clock::now();
+            long long milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(wait).count() + 1;
+            timeout = static_cast<int>(std::max(0LL, std::min<long long>(milliseconds, INT_MAX)));
+        }
+        int count = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+        if (count < 0 && errno != EINTR) {
+            std::cerr << "epoll_wait failed: " << std::strerror(errno) << std::endl;
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (!events[i].data.ptr) {
+                uint64_t value;
+                ssize_t got = read(wakeFd, &value, sizeof(value));
+                (void)got;
+                std::vector<std::function<void()>> work;
+                {
+                    std::lock_guard<std::mutex> lock(postMutex);
+                    work.swap(posted);
+                }
+                for (std::function<void()>& item : work) {
+                    item();
+                }
+            } else {
+                wake(*static_cast<Wait*>(events[i].data.ptr), false);
+            }
+        }
+        Clock::time_point now = Clock::now();
+        while (!timers.empty() && timers.begin()->first <= now) {
+            wake(*timers.begin()->second, true);
+        }
+    }
+}
+
+
+void EventLoop::Blocking::await_suspend(std::coroutine_handle<> awaiting) {
+    EventLoop* target = &loop;
+    std::function<void()>* job = &work;
+    memory = MemStats::current();
+    MemStats::State task = memory;
+    {
+        std::lock_guard<std::mutex> lock(target->postMutex);
+        target->blockingJobs++;
+    }
+    ThreadPool::shared().submit([target, job, awaiting, task]() {
+        MemStats::State worker = MemStats::current();
+        MemStats::restore(task);
+        (*job)();
+        MemStats::restore(worker);
+        target->finishBlocking(awaiting);
+    });
+}
+
+
+// Pieces go straight to the descriptor while nothing is queued, so the
+// template text they point to is not copied; only what the descriptor
+// does not take now is queued for drain()
+bool AsyncFdSink::write(const iovec* pieces, size_t count) {
+    if (error) {
+        return false;
+    }
+    std::vector<iovec> rest(pieces, pieces + count);
+    size_t first = 0;
+    while (backlog() == 0 && first < rest.size()) {
+        int batch = static_cast<int>(std::min<size_t>(rest.size() - first, IOV_MAX));
+        ssize_t wrote = writev(fd, &rest[first], batch);
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrote < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (wrote < 0) {
+            error = true;
+            return false;
+        }
+        total += static_cast<size_t>(wrote);
+        size_t left = static_cast<size_t>(wrote);
+        while (first < rest.size() && left >= rest[first].iov_len) {
+            left -= rest[first].iov_len;
+            first++;
+        }
+        if (left > 0) {
+            rest[first].iov_base = static_cast<char*>(rest[first].iov_base) + left;
+            rest[first].iov_len -= left;
+        }
+    }
+    for (; first < rest.size(); ++first) {
+        queued.append(static_cast<const char*>(rest[first].iov_base), rest[first].iov_len);
+    }
+    return true;
+}
+
+Task<bool> AsyncFdSink::drain() {
+    while (!error && sent < queued.size()) {
+        ssize_t count = ::write(fd, queued.data() + sent, queued.size() - sent);
+        if (count > 0) {
+            sent += static_cast<size_t>(count);
+            total += static_cast<size_t>(count);
+        } else if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            error = !co_await loop.writable(fd, TIMEOUT_SECONDS);
+        } else {
+            error = true;
+        }
+    }
+    queued.clear();
+    sent = 0;
+    co_return !error;
+}
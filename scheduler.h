@@ -0,0 +1,228 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "memstats.h"
+#include "output.h"
+
+
+template <typename T>
+struct TaskResult {
+    std::optional<T> value;
+    void return_value(T result) { value = std::move(result); }
+};
+
+template <>
+struct TaskResult<void> {
+    void return_void() {}
+};
+
+
+// Task class: C++20 coroutine that starts when it is awaited or start()ed
+// and resumes its awaiter when it finishes. Errors are results, as
+// everywhere else; an exception escaping a task terminates the process.
+template <typename T = void>
+class Task {
+public:
+    struct promise_type : TaskResult<T> {
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept {
+            struct Final {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> self) noexcept {
+                    std::coroutine_handle<> next = self.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            return Final{};
+        }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Task() = default;
+    Task(Task&& other) noexcept : coroutine(std::exchange(other.coroutine, {})) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            coroutine = std::exchange(other.coroutine, {});
+        }
+        return *this;
+    }
+    ~Task() { reset(); }
+
+    // Run up to the first suspension. A task that never waits for the
+    // event loop has finished when this returns.
+    void start() { coroutine.resume(); }
+    bool done() const { return !coroutine || coroutine.done(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        coroutine.promise().continuation = awaiting;
+        return coroutine;
+    }
+    T await_resume() {
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*coroutine.promise().value);
+        }
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {}
+
+    void reset() {
+        if (coroutine) {
+            coroutine.destroy();
+            coroutine = {};
+        }
+    }
+
+    std::coroutine_handle<promise_type> coroutine;
+};
+
+
+// EventLoop class: runs coroutines on one thread over epoll. A task
+// waiting for a descriptor, a timer or blocking work done elsewhere is
+// suspended and costs nothing until it is resumed, so one thread can
+// keep many renders in flight. Only post() may be called from other
+// threads. The destructor waits for blocking work started for its tasks,
+// which resumes them through the loop once it is done.
+class EventLoop {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Awaitable wait for a descriptor or a timer; co_await gives false when
+    // the timeout passed first
+    struct Wait {
+        EventLoop& loop;
+        int fd;                 // -1 for a plain timer
+        uint32_t events;
+        double timeout;         // seconds, 0 for none
+        std::coroutine_handle<> coroutine;
+        std::multimap<Clock::time_point, Wait*>::iterator timer;
+        bool timed = false;
+        bool timedOut = false;
+        MemStats::State memory = {};
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> awaiting) {
+            coroutine = awaiting;
+            memory = MemStats::current();
+            loop.arm(*this);
+        }
+        bool await_resume() const noexcept {
+            MemStats::restore(memory);
+            return !timedOut;
+        }
+    };
+
+    // Awaitable run of blocking work on ThreadPool::shared(); the awaiting
+    // task resumes on the loop once the work is done. The work allocates
+    // under the phase and line of the task.
+    struct Blocking {
+        EventLoop& loop;
+        std::function<void()> work;
+        MemStats::State memory = {};
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> awaiting);
+        void await_resume() const noexcept { MemStats::restore(memory); }
+    };
+
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // The loop owns the task and starts it on its next turn
+    void spawn(Task<void> task);
+    // Run until every spawned task has finished or stop() is called
+    void run();
+    // Safe from any thread
+    void stop();
+    // Call work on the loop thread; safe from any thread
+    void post(std::function<void()> work);
+    // Resume a suspended coroutine on the loop's next turn
+    void schedule(std::coroutine_handle<> coroutine);
+
+    Wait readable(int fd, double timeout = 0) { return Wait{*this, fd, EPOLL_READ, timeout, {}, {}}; }
+    Wait writable(int fd, double timeout = 0) { return Wait{*this, fd, EPOLL_WRITE, timeout, {}, {}}; }
+    Wait sleep(double seconds) { return Wait{*this, -1, 0, seconds, {}, {}}; }
+    Blocking blocking(std::function<void()> work) { return Blocking{*this, std::move(work)}; }
+
+    size_t tasks() const { return spawned.size(); }
+
+private:
+    static const uint32_t EPOLL_READ;
+    static const uint32_t EPOLL_WRITE;
+
+    void arm(Wait& wait);
+    void wake(Wait& wait, bool timedOut);
+    void runReady();
+    // Resume a task; whatever phase it leaves on the thread is dropped, so
+    // that the next task does not inherit it
+    void resume(std::coroutine_handle<> coroutine);
+    // Called by the pool thread that did the work of a Blocking wait
+    void finishBlocking(std::coroutine_handle<> awaiting);
+
+    int epollFd;
+    int wakeFd;
+    std::list<Task<void>> spawned;
+    std::vector<std::coroutine_handle<>> ready;
+    std::multimap<Clock::time_point, Wait*> timers;
+    bool stopped = false;
+
+    // Filled by other threads; the eventfd wakes the loop up
+    std::mutex postMutex;
+    std::vector<std::function<void()>> posted;
+    // Blocking waits whose work has not finished yet
+    size_t blockingJobs = 0;
+    std::condition_variable blockingDone;
+};
+
+
+// Output sink of a render on an event loop. Batches from the output buffer
+// are written to a non-blocking descriptor as far as it takes them; the
+// rest is queued, and drain() writes it, suspending the render while the
+// descriptor is full.
+class AsyncFdSink : public OutputSink {
+public:
+    static const int TIMEOUT_SECONDS = 30;
+
+    AsyncFdSink(EventLoop& loop, int fd) : loop(loop), fd(fd) {}
+
+    bool write(const iovec* pieces, size_t count) override;
+    size_t backlog() const { return queued.size() - sent; }
+    size_t written() const { return total; }
+
+    // Write everything queued; false once the descriptor has failed
+    Task<bool> drain();
+
+private:
+    EventLoop& loop;
+    int fd;
+    std::string queued;
+    size_t sent = 0;
+    size_t total = 0;
+    bool error = false;
+};
+
+#endif // SCHEDULER_H
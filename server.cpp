@@ -0,0 +1,376 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "interpret.h"
+#include "memstats.h"
+#include "server.h"
+#include "source.h"
+
+
+static volatile sig_atomic_t stopping = 0;
+
+static void onStopSignal(int) {
+    stopping = 1;
+}
+
+
+int FcgiServer::run() {
+    char* root = realpath(documentRoot.c_str(), nullptr);
+    if (!root) {
+        std::cerr << "Unable to open document root " << documentRoot << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    documentRoot = root;
+    free(root);
+
+    signal(SIGPIPE, SIG_IGN);
+    listenFd = listenSocket(address, 128);
+    if (listenFd < 0) {
+        std::cerr << "Unable to listen on " << address << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    // Without SA_RESTART, wait() returns as soon as a stop signal arrives
+    struct sigaction action{};
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+
+    std::vector<pid_t> children(workers, -1);
+    auto spawn = [this](pid_t& child) {
+        child = fork();
+        if (child == 0) {
+            // SIGTERM ends the worker loop (see workerLoop), so that
+            // --mem-stats is printed on the way out
+            signal(SIGINT, SIG_DFL);
+            workerLoop();
+            MemStats::reportIfRequested();
+            _exit(0);
+        }
+        if (child < 0) {
+            std::cerr << "fork() failed: " << std::strerror(errno) << std::endl;
+        }
+    };
+    for (pid_t& child : children) {
+        spawn(child);
+    }
+
+    // Respawn workers that exit until the server is told to stop
+    while (!stopping) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (pid_t& child : children) {
+            if (child == pid && !stopping) {
+                spawn(child);
+            }
+        }
+    }
+
+    for (pid_t child : children) {
+        if (child > 0) {
+            kill(child, SIGTERM);
+        }
+    }
+    while (wait(nullptr) > 0 || errno == EINTR) {
+    }
+    close(listenFd);
+    if (address.find(':') == std::string::npos) {
+        unlink(address.c_str());
+    }
+    return 0;
+}
+
+
+// SIGTERM is read from a signalfd and only ends the worker once no request
+// is in progress, so that requests begun are answered before it leaves;
+// idle connections are closed. The listening socket is non-blocking:
+// another worker may accept first.
+void FcgiServer::workerLoop() {
+    sigset_t blocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, nullptr);
+    // A SIGTERM taken by the handler before it was blocked
+    if (stopping) {
+        return;
+    }
+    int signalFd = signalfd(-1, &blocked, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd < 0) {
+        std::cerr << "signalfd() failed: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+
+    EventLoop eventLoop;
+    loop = &eventLoop;
+    eventLoop.spawn(watchStop(signalFd));
+    eventLoop.spawn(acceptConnections());
+    eventLoop.run();
+    for (int fd : connections) {
+        close(fd);
+    }
+    connections.clear();
+    close(signalFd);
+}
+
+
+Task<void> FcgiServer::watchStop(int signalFd) {
+    signalfd_siginfo info;
+    while (read(signalFd, &info, sizeof(info)) != static_cast<ssize_t>(sizeof(info))) {
+        co_await loop->readable(signalFd);
+    }
+    stopWhenIdle();
+}
+
+
+void FcgiServer::stopWhenIdle() {
+    stopping = 1;
+    if (busy == 0) {
+        loop->stop();
+    }
+}
+
+
+void FcgiServer::requestDone() {
+    if (--busy == 0 && stopping) {
+        loop->stop();
+    }
+}
+
+
+Task<void> FcgiServer::acceptConnections() {
+    for (;;) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0) {
+            connections.insert(fd);
+            loop->spawn(serveConnection(fd));
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            co_await loop->readable(listenFd);
+        } else if (errno == EMFILE || errno == ENFILE) {
+            // Out of descriptors: wait for connections to close
+            co_await loop->sleep(0.01);
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            std::cerr << "accept() failed: " << std::strerror(errno) << std::endl;
+            stopWhenIdle();
+            co_return;
+        }
+    }
+}
+
+
+// One request at a time per connection; the connection stays open
+// between requests when the web server asks for FCGI_KEEP_CONN. The
+// worker's other connections are served while a render waits.
+Task<void> FcgiServer::serveConnection(int fd) {
+    static const size_t CHUNK = 16 * 1024;
+    AsyncFdSink out(*loop, fd);
+    std::string input;
+    size_t parsed = 0;
+    uint16_t requestId = 0;
+    bool active = false;
+    bool keepConn = false;
+    bool open = true;
+    std::string paramData;
+
+    while (open) {
+        FcgiRecord record;
+        size_t size;
+        if (!parseRecord(std::string_view(input).substr(parsed), record, size)) {
+            break;
+        }
+        if (size == 0) {
+            input.erase(0, parsed);
+            parsed = 0;
+            size_t length = input.size();
+            input.resize(length + CHUNK);
+            ssize_t count = read(fd, &input[length], CHUNK);
+            input.resize(length + (count > 0 ? static_cast<size_t>(count) : 0));
+            if (count > 0 || (count < 0 && errno == EINTR)) {
+                continue;
+            }
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                co_await loop->readable(fd);
+                continue;
+            }
+            break;
+        }
+        parsed += size;
+
+        std::string reply;
+        switch (record.type) {
+            case FCGI_GET_VALUES: {
+                FcgiParams query;
+                decodeParams(record.content, query);
+                std::string body;
+                for (const auto& entry : query) {
+                    if (entry.first == "FCGI_MAX_CONNS" || entry.first == "FCGI_MAX_REQS") {
+                        encodeParam(body, entry.first, std::to_string(workers));
+                    } else if (entry.first == "FCGI_MPXS_CONNS") {
+                        encodeParam(body, entry.first, "0");
+                    }
+                }
+                appendRecord(reply, FCGI_GET_VALUES_RESULT, 0, body);
+                break;
+            }
+            case FCGI_BEGIN_REQUEST: {
+                if (record.content.size() < 8) {
+                    open = false;
+                    break;
+                }
+                uint16_t role = static_cast<uint16_t>((static_cast<unsigned char>(record.content[0]) << 8) |
+                                                      static_cast<unsigned char>(record.content[1]));
+                uint8_t flags = static_cast<uint8_t>(record.content[2]);
+                if (active) {
+                    appendEndRequest(reply, record.requestId, 0, FCGI_CANT_MPX_CONN);
+                } else if (role != FCGI_RESPONDER) {
+                    appendEndRequest(reply, record.requestId, 0, FCGI_UNKNOWN_ROLE);
+                } else {
+                    requestId = record.requestId;
+                    keepConn = (flags & FCGI_KEEP_CONN) != 0;
+                    paramData.clear();
+                    active = true;
+                    busy++;
+                }
+                break;
+            }
+            case FCGI_PARAMS:
+                if (active && record.requestId == requestId) {
+                    paramData += record.content;
+                }
+                break;
+            case FCGI_STDIN:
+                // The request body is not used; its end starts the response
+                if (active && record.requestId == requestId && record.content.empty()) {
+                    FcgiParams params;
+                    decodeParams(paramData, params);
+                    open = co_await respond(out, requestId, params) && keepConn;
+                    active = false;
+                    requestDone();
+                }
+                break;
+            case FCGI_ABORT_REQUEST:
+                if (active && record.requestId == requestId) {
+                    appendEndRequest(reply, requestId, 0, FCGI_REQUEST_COMPLETE);
+                    open = keepConn;
+                    active = false;
+                    requestDone();
+                }
+                break;
+            default: {
+                char body[8] = {static_cast<char>(record.type), 0, 0, 0, 0, 0, 0, 0};
+                appendRecord(reply, FCGI_UNKNOWN_TYPE, 0, std::string_view(body, sizeof(body)));
+                break;
+            }
+        }
+        if (!reply.empty()) {
+            iovec piece{reply.data(), reply.size()};
+            if (!out.write(&piece, 1) || !co_await out.drain()) {
+                break;
+            }
+        }
+    }
+    // A request begun on a connection that went away
+    if (active) {
+        requestDone();
+    }
+    connections.erase(fd);
+    close(fd);
+}
+
+
+Task<bool> FcgiServer::respond(AsyncFdSink& out, uint16_t requestId, const FcgiParams& params) {
+    std::string path;
+    auto script = params.find("SCRIPT_FILENAME");
+    if (script != params.end()) {
+        path = script->second;
+    } else {
+        auto root = params.find("DOCUMENT_ROOT");
+        auto name = params.find("SCRIPT_NAME");
+        if (root != params.end() && name != params.end()) {
+            path = root->second + name->second;
+        }
+    }
+
+    // Links are followed before the check, so that they cannot lead out of the root
+    char* real = path.empty() ? nullptr : realpath(path.c_str(), nullptr);
+    std::string resolved = real ? real : "";
+    free(real);
+
+    FcgiSink sink(out, requestId);
+    OutputBuffer buffer(sink, flushThreshold);
+    std::shared_ptr<const Program> program;
+    if (!resolved.empty() && !insideRoot(resolved)) {
+        buffer.write("Status: 403 Forbidden\r\nContent-Type: text/plain\r\n\r\nAccess denied.\n");
+    } else if (resolved.empty() || !(program = findTemplate(resolved))) {
+        buffer.write("Status: 404 Not Found\r\nContent-Type: text/plain\r\n\r\nFile not found.\n");
+    } else {
+        buffer.write("Content-Type: text/html; charset=UTF-8\r\n\r\n");
+        Interpreter interpreter(program->symbols, buffer);
+        interpreter.setHttpBackend(httpBackend);
+        interpreter.setHttpConcurrency(httpConcurrency);
+        interpreter.setDatabase(*database);
+        interpreter.setEventLoop(*loop, &out);
+        MemStats::phase("execute");
+        co_await interpreter.render(program->view());
+    }
+    MemStats::phase("flush");
+    std::string end;
+    appendRecord(end, FCGI_STDOUT, requestId, {});
+    appendEndRequest(end, requestId, 0, FCGI_REQUEST_COMPLETE);
+    iovec piece{end.data(), end.size()};
+    bool flushed = buffer.flush() && out.write(&piece, 1) && co_await out.drain();
+    MemStats::phase(nullptr);
+    co_return flushed;
+}
+
+
+bool FcgiServer::insideRoot(const std::string& path) const {
+    if (documentRoot == "/") {
+        return true;
+    }
+    return path.size() > documentRoot.size() && path.compare(0, documentRoot.size(), documentRoot) == 0 &&
+           path[documentRoot.size()] == '/';
+}
+
+
+// Compiled template for a path, recompiled when the file's mtime or size changes
+std::shared_ptr<const Program> FcgiServer::findTemplate(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return nullptr;
+    }
+    int64_t mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    uint64_t size = static_cast<uint64_t>(info.st_size);
+
+    CachedTemplate& cached = templates[path];
+    if (!cached.program || cached.mtime != mtime || cached.size != size) {
+        // Copied: a template edited in place while it compiles must not kill the worker
+        SourceFile source;
+        if (!source.open(path, true)) {
+            templates.erase(path);
+            return nullptr;
+        }
+        cached.program = std::make_shared<const Program>(compileTemplate(source.text()));
+        cached.mtime = mtime;
+        cached.size = size;
+    }
+    return cached.program;
+}
@@ -0,0 +1,71 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include "compiler.h"
+#include "db.h"
+#include "fcgi.h"
+#include "output.h"
+#include "runtime.h"
+#include "scheduler.h"
+
+
+// FcgiServer class: FastCGI responder with a pool of pre-forked workers.
+// Each worker keeps compiled templates in memory between requests and
+// serves its connections on one event loop, so that renders waiting for
+// http() or db results overlap.
+class FcgiServer {
+public:
+    FcgiServer(const std::string& address, int workers,
+               size_t flushThreshold = OutputBuffer::DEFAULT_FLUSH_THRESHOLD)
+        : address(address), workers(workers), flushThreshold(flushThreshold) {}
+
+    int run();
+    void setDatabase(DbPool& pool) { database = &pool; }
+    void setHttpBackend(HttpBackend backend) { httpBackend = backend; }
+    void setHttpConcurrency(size_t limit) { httpConcurrency = limit; }
+    // Only scripts under this directory are served, the working directory by default
+    void setDocumentRoot(const std::string& dir) { documentRoot = dir; }
+
+private:
+    // Shared with the renders in progress, which keep a replaced program
+    struct CachedTemplate {
+        int64_t mtime = 0;
+        uint64_t size = 0;
+        std::shared_ptr<const Program> program;
+    };
+
+    void workerLoop();
+    Task<void> watchStop(int signalFd);
+    Task<void> acceptConnections();
+    Task<void> serveConnection(int fd);
+    Task<bool> respond(AsyncFdSink& out, uint16_t requestId, const FcgiParams& params);
+    void stopWhenIdle();
+    void requestDone();
+    bool insideRoot(const std::string& path) const;
+    std::shared_ptr<const Program> findTemplate(const std::string& path);
+
+    std::string address;
+    int workers;
+    std::string documentRoot = ".";
+    size_t flushThreshold;
+    int listenFd = -1;
+    DbPool* database = &DbPool::shared();
+    HttpBackend httpBackend = HTTP_NATIVE;
+    size_t httpConcurrency = Runtime::DEFAULT_HTTP_CONCURRENCY;
+    std::unordered_map<std::string, CachedTemplate> templates;
+
+    // Event loop of a worker, its open connections and the requests begun
+    // and not answered yet
+    EventLoop* loop = nullptr;
+    std::set<int> connections;
+    size_t busy = 0;
+};
+
+#endif // SERVER_H
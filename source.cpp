@@ -0,0 +1,64 @@
+#include <csignal>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.h"
+
+
+SourceFile::~SourceFile() {
+    if (data) {
+        munmap(data, size);
+    }
+}
+
+
+// The only mappings that can lose pages are files truncated behind our back
+static void onTruncated(int) {
+    static const char message[] = "Template file truncated while in use\n";
+    if (write(STDERR_FILENO, message, sizeof(message) - 1)) {
+    }
+    _exit(1);
+}
+
+static void guardTruncation() {
+    static const bool installed = []() {
+        struct sigaction action{};
+        action.sa_handler = onTruncated;
+        return sigaction(SIGBUS, &action, nullptr) == 0;
+    }();
+    (void)installed;
+}
+
+
+bool SourceFile::open(const std::string& path, bool copy) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (!copy && fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        guardTruncation();
+        void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            close(fd);
+            data = mapped;
+            size = static_cast<size_t>(info.st_size);
+            // The tokenizer reads the file front to back once
+            madvise(data, size, MADV_SEQUENTIAL);
+            content = std::string_view(static_cast<const char*>(data), size);
+            return true;
+        }
+    }
+
+    char chunk[64 * 1024];
+    ssize_t count;
+    while ((count = read(fd, chunk, sizeof(chunk))) > 0) {
+        owned.append(chunk, static_cast<size_t>(count));
+    }
+    close(fd);
+    content = owned;
+    return count == 0;
+}
@@ -0,0 +1,36 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+
+// SourceFile class: template source mapped read-only. Tokens, AST text and
+// static output point into the mapping, so it must outlive the render.
+// Files that cannot be mapped (pipes, empty files) are read into memory.
+//
+// The mapping is only safe while the file keeps its length: if another
+// process truncates it, touching the lost pages raises SIGBUS (and output
+// written straight from them fails). Mapping a file installs a SIGBUS
+// handler that exits with a message instead of dumping core. Long-running processes whose templates may be edited in
+// place (FastCGI workers, batch runs) open them with copy set, which reads
+// the file into memory instead.
+class SourceFile {
+public:
+    SourceFile() = default;
+    ~SourceFile();
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    bool open(const std::string& path, bool copy = false);
+    std::string_view text() const { return content; }
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+    std::string owned;
+    std::string_view content;
+};
+
+#endif // SOURCE_H
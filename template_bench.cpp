@@ -0,0 +1,398 @@
+// Benchmark for the template pipeline: generates synthetic templates and
+// times every phase separately. Output is a table, or JSON with --json so
+// runs from different commits can be compared.
+//
+// interpret and vm run the unoptimized program: the generated templates
+// are all constants, and after optimization nothing would be left to
+// evaluate. The optimize phase is timed on its own.
+//
+// --lex times only the tokenizer, on multi-megabyte templates by default;
+// --file repeats a real template instead of generating one.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lexer.h"
+#include "parser.h"
+#include "resolver.h"
+#include "optimizer.h"
+#include "compiler.h"
+#include "output.h"
+#include "interpret.h"
+
+
+// Shape of a generated template
+struct TemplateShape {
+    std::string name;
+    size_t size = 64 * 1024;     // approximate length in bytes
+    size_t density = 8;          // PHP islands per kilobyte
+    size_t depth = 3;            // nesting of each assigned expression
+    size_t vars = 16;            // distinct variables read by expressions
+    size_t concat = 4;           // operands of each echoed concatenation
+};
+
+
+static const TemplateShape SUITE[] = {
+    {"small", 4 * 1024, 4, 3, 8, 4},
+    {"large", 512 * 1024, 4, 3, 32, 4},
+    {"dense", 256 * 1024, 64, 2, 16, 2},
+    {"deep", 64 * 1024, 8, 64, 8, 2},
+    {"vars", 256 * 1024, 16, 3, 1024, 2},
+    {"concat", 256 * 1024, 8, 1, 16, 64}
+};
+
+// Lexing throughput on inputs where a quadratic lexer would not finish
+static const TemplateShape LEX_SUITE[] = {
+    {"lex_1mb", 1024 * 1024, 8, 3, 16, 4},
+    {"lex_4mb", 4 * 1024 * 1024, 8, 3, 16, 4},
+    {"lex_16mb", 16 * 1024 * 1024, 8, 3, 16, 4}
+};
+
+
+// Every island assigns one result variable and echoes a concatenation.
+// Results are kept apart from the variables expressions read, so values
+// stay small and nothing prints a warning.
+static std::string generateTemplate(const TemplateShape& shape, size_t& islands) {
+    std::mt19937 random(42);
+    auto pick = [&](size_t count) { return static_cast<size_t>(random() % count); };
+    size_t vars = std::max<size_t>(shape.vars, 1);
+    auto leaf = [&]() {
+        return pick(2) ? "$v" + std::to_string(pick(vars)) : std::to_string(1 + pick(9));
+    };
+
+    std::string out = "<?php\n";
+    for (size_t i = 0; i < vars; ++i) {
+        out += "$v" + std::to_string(i) + " = " + std::to_string(1 + i % 9) + ";\n";
+    }
+    out += "?>\n";
+    islands = 1;
+
+    static const char* line = "<div class=\"row\"><span>Lorem ipsum dolor sit amet</span></div>\n";
+    size_t textSize = 1024 / std::max<size_t>(shape.density, 1);
+    while (out.size() < shape.size) {
+        for (size_t written = 0; written < textSize;) {
+            std::string chunk(line, std::min(std::char_traits<char>::length(line), textSize - written));
+            out += chunk;
+            written += chunk.size();
+        }
+
+        out += "<?php $r" + std::to_string(islands % vars) + " = ";
+        std::string expression = leaf();
+        for (size_t level = 0; level < shape.depth; ++level) {
+            expression = "(" + leaf() + " " + "+-*"[pick(3)] + " " + expression + ")";
+        }
+        out += expression + "; echo ";
+        for (size_t i = 0; i < std::max<size_t>(shape.concat, 1); ++i) {
+            if (i > 0) {
+                out += " . ";
+            }
+            out += i % 2 ? "$r" + std::to_string(islands % vars) : "\"item " + std::to_string(i) + " \"";
+        }
+        out += "; ?>\n";
+        islands++;
+    }
+    return out;
+}
+
+
+// Text of a real template repeated until it is at least `size` bytes long
+static std::string repeatFile(const std::string& path, size_t size, size_t& islands) {
+    std::ifstream file(path, std::ios::binary);
+    std::string text{(std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()};
+    std::string out = text;
+    while (!text.empty() && out.size() < size) {
+        out += text;
+    }
+    islands = 0;
+    for (size_t at = out.find("<?php"); at != std::string::npos; at = out.find("<?php", at + 5)) {
+        islands++;
+    }
+    return out;
+}
+
+
+// Discards output, counting it
+class NullSink : public OutputSink {
+public:
+    bool write(const iovec* pieces, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            bytes += pieces[i].iov_len;
+        }
+        return true;
+    }
+
+    size_t bytes = 0;
+};
+
+
+struct PhaseTiming {
+    const char* name;
+    std::vector<double> samples;    // microseconds
+
+    double percentile(double p) const {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+    double mean() const {
+        double sum = 0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        return sum / samples.size();
+    }
+};
+
+
+struct CaseResult {
+    TemplateShape shape;
+    size_t bytes = 0;
+    size_t islands = 0;
+    size_t tokens = 0;
+    size_t nodes = 0;
+    size_t instructions = 0;
+    size_t output = 0;
+    std::vector<PhaseTiming> phases;
+};
+
+
+// Time `body` after `warmup` untimed runs; `setup` runs before each call
+// and is not timed
+static PhaseTiming measure(const char* name, int warmup, int reps,
+                           const std::function<void()>& setup, const std::function<void()>& body) {
+    PhaseTiming timing{name, {}};
+    for (int i = 0; i < warmup + reps; ++i) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        if (i >= warmup) {
+            timing.samples.push_back(elapsed.count());
+        }
+    }
+    return timing;
+}
+
+
+// `file`, when set, replaces the generated template
+static CaseResult runCase(const TemplateShape& shape, const std::string& file, int warmup, int reps, bool lexOnly) {
+    CaseResult result;
+    result.shape = shape;
+    std::string source = file.empty() ? generateTemplate(shape, result.islands)
+                                      : repeatFile(file, shape.size, result.islands);
+    result.bytes = source.size();
+    auto nothing = []() {};
+
+    std::vector<Token> tokens;
+    result.phases.push_back(measure("tokenize", warmup, reps, nothing, [&]() {
+        tokens = Tokenizer(source).tokenize();
+    }));
+    result.tokens = tokens.size();
+
+    result.phases.push_back(measure("tokenize_parallel", warmup, reps, nothing, [&]() {
+        tokens = Tokenizer(source).tokenize(ThreadPool::shared());
+    }));
+    if (lexOnly) {
+        return result;
+    }
+
+    Ast ast;
+    result.phases.push_back(measure("parse", warmup, reps, nothing, [&]() {
+        ast = Parser(tokens, source).parse();
+    }));
+    result.nodes = ast.size();
+
+    SymbolTable symbols;
+    result.phases.push_back(measure("resolve", warmup, reps, [&]() {
+        ast = Parser(tokens, source).parse();
+    }, [&]() {
+        symbols = Resolver().resolve(ast);
+    }));
+
+    Program program;
+    result.phases.push_back(measure("compile", warmup, reps, nothing, [&]() {
+        program = Compiler().compile(ast, symbols);
+    }));
+    result.instructions = program.code.size();
+
+    NullSink sink;
+    result.phases.push_back(measure("interpret", warmup, reps, nothing, [&]() {
+        OutputBuffer out(sink);
+        Interpreter(symbols, out).interpret(ast);
+    }));
+    result.output = sink.bytes / (warmup + reps);
+
+    ProgramView view = program.view();
+    result.phases.push_back(measure("vm", warmup, reps, nothing, [&]() {
+        OutputBuffer out(sink);
+        Interpreter(symbols, out).run(view);
+    }));
+
+    // Optimizing rewrites the tree, so every run gets a freshly resolved one
+    Ast fresh;
+    result.phases.push_back(measure("optimize", warmup, reps, [&]() {
+        fresh = Parser(tokens, source).parse();
+        symbols = Resolver().resolve(fresh);
+    }, [&]() {
+        Optimizer().optimize(fresh, symbols);
+    }));
+    return result;
+}
+
+
+static void printTable(const std::vector<CaseResult>& results) {
+    for (const CaseResult& result : results) {
+        const TemplateShape& shape = result.shape;
+        std::printf("%s: %zu bytes, %zu islands, depth %zu, %zu vars, concat %zu; "
+                    "%zu tokens, %zu nodes, %zu instructions\n",
+                    shape.name.c_str(), result.bytes, result.islands, shape.depth, shape.vars, shape.concat,
+                    result.tokens, result.nodes, result.instructions);
+        for (const PhaseTiming& phase : result.phases) {
+            std::printf("  %-17s median %10.1f us  p99 %10.1f us  mean %10.1f us  %8.1f MB/s\n",
+                        phase.name, phase.percentile(50), phase.percentile(99), phase.mean(),
+                        result.bytes / phase.percentile(50));
+        }
+    }
+}
+
+
+static void printJson(const std::vector<CaseResult>& results, int warmup, int reps) {
+    std::printf("{\"warmup\": %d, \"reps\": %d, \"unit\": \"us\", \"cases\": [", warmup, reps);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const CaseResult& result = results[i];
+        const TemplateShape& shape = result.shape;
+        std::printf("%s\n  {\"name\": \"%s\", \"size\": %zu, \"density\": %zu, \"depth\": %zu, "
+                    "\"vars\": %zu, \"concat\": %zu,\n   \"bytes\": %zu, \"islands\": %zu, \"tokens\": %zu, "
+                    "\"nodes\": %zu, \"instructions\": %zu, \"output\": %zu,\n   \"phases\": {",
+                    i > 0 ? "," : "", shape.name.c_str(), shape.size, shape.density, shape.depth,
+                    shape.vars, shape.concat, result.bytes, result.islands, result.tokens,
+                    result.nodes, result.instructions, result.output);
+        for (size_t j = 0; j < result.phases.size(); ++j) {
+            const PhaseTiming& phase = result.phases[j];
+            std::printf("%s\n    \"%s\": {\"median\": %.3f, \"p99\": %.3f, \"mean\": %.3f, \"min\": %.3f}",
+                        j > 0 ? "," : "", phase.name, phase.percentile(50), phase.percentile(99),
+                        phase.mean(), phase.percentile(0));
+        }
+        std::printf("}}");
+    }
+    std::printf("\n]}\n");
+}
+
+
+int main(int argc, char* argv[]) {
+    bool json = false;
+    bool dump = false;
+    bool lexOnly = false;
+    bool sized = false;
+    std::string file;
+    int warmup = 3;
+    int reps = 20;
+    std::string only;
+    TemplateShape custom;
+    custom.name = "custom";
+    bool isCustom = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto number = [&](size_t& out) {
+            out = std::strtoull(argv[++i], nullptr, 10);
+            isCustom = true;
+        };
+        if (arg == "--json") {
+            json = true;
+        } else if (arg == "--dump") {
+            dump = true;
+        } else if (arg == "--lex") {
+            lexOnly = true;
+        } else if (arg == "--file" && i + 1 < argc) {
+            file = argv[++i];
+            custom.name = file;
+            isCustom = true;
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmup = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--reps" && i + 1 < argc) {
+            reps = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--case" && i + 1 < argc) {
+            only = argv[++i];
+        } else if (arg == "--size" && i + 1 < argc) {
+            number(custom.size);
+            sized = true;
+        } else if (arg == "--density" && i + 1 < argc) {
+            number(custom.density);
+        } else if (arg == "--depth" && i + 1 < argc) {
+            number(custom.depth);
+        } else if (arg == "--vars" && i + 1 < argc) {
+            number(custom.vars);
+        } else if (arg == "--concat" && i + 1 < argc) {
+            number(custom.concat);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--json] [--warmup <n>] [--reps <n>] [--case <name>] [--dump] [--lex]" << std::endl;
+            std::cerr << "       " << argv[0] << " [--size <bytes>] [--density <islands/KB>] [--depth <n>]"
+                      << " [--vars <n>] [--concat <n>]" << std::endl;
+            std::cerr << "       " << argv[0] << " --file <template> [--size <bytes>] [--lex]" << std::endl;
+            std::cerr << "Cases:";
+            for (const TemplateShape& shape : SUITE) {
+                std::cerr << " " << shape.name;
+            }
+            std::cerr << std::endl << "Cases with --lex:";
+            for (const TemplateShape& shape : LEX_SUITE) {
+                std::cerr << " " << shape.name;
+            }
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+
+    if (!file.empty() && !std::ifstream(file)) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return 1;
+    }
+    // A file is used as is unless --size asks for more
+    if (!file.empty() && !sized) {
+        custom.size = 0;
+    }
+
+    std::vector<TemplateShape> shapes;
+    if (isCustom) {
+        shapes.push_back(custom);
+    } else {
+        std::vector<TemplateShape> suite = lexOnly ? std::vector<TemplateShape>(std::begin(LEX_SUITE), std::end(LEX_SUITE))
+                                                   : std::vector<TemplateShape>(std::begin(SUITE), std::end(SUITE));
+        for (const TemplateShape& shape : suite) {
+            if (only.empty() || shape.name == only) {
+                shapes.push_back(shape);
+            }
+        }
+        if (shapes.empty()) {
+            std::cerr << "Unknown case: " << only << std::endl;
+            return 1;
+        }
+    }
+
+    // Print the generated template, to run it through php directly
+    if (dump) {
+        size_t islands = 0;
+        const TemplateShape& shape = shapes.front();
+        std::cout << (file.empty() ? generateTemplate(shape, islands) : repeatFile(file, shape.size, islands));
+        return 0;
+    }
+
+    std::vector<CaseResult> results;
+    for (const TemplateShape& shape : shapes) {
+        results.push_back(runCase(shape, file, warmup, reps, lexOnly));
+    }
+    if (json) {
+        printJson(results, warmup, reps);
+    } else {
+        printTable(results);
+    }
+    return 0;
+}
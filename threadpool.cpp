@@ -0,0 +1,99 @@
+#include <algorithm>
+
+#include "threadpool.h"
+
+
+// Pool and queue index of the calling thread, when it is a worker
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local size_t currentQueue = 0;
+
+
+ThreadPool::ThreadPool(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([this, i]() { work(i); });
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+    std::packaged_task<void()> packaged(std::move(task));
+    std::future<void> result = packaged.get_future();
+    size_t index = currentPool == this ? currentQueue : nextQueue.fetch_add(1) % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(packaged));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+    ready.notify_one();
+    return result;
+}
+
+
+// Own queue from the back, then the other queues from the front
+bool ThreadPool::take(size_t self, std::packaged_task<void()>& task) {
+    for (size_t i = 0; i < queues.size(); ++i) {
+        Queue& queue = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+
+// Pending tasks are still run when the pool is destroyed
+void ThreadPool::work(size_t self) {
+    currentPool = this;
+    currentQueue = self;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this]() { return stopping || queued > 0; });
+            if (queued == 0) {
+                return;
+            }
+        }
+        std::packaged_task<void()> task;
+        if (take(self, task)) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queued--;
+            }
+            task();
+        }
+    }
+}
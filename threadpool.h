@@ -0,0 +1,52 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// ThreadPool class: work-stealing pool. Every worker has its own queue;
+// tasks submitted from a worker go to its queue and are taken newest
+// first, tasks from outside are spread over the queues. An idle worker
+// steals the oldest task of another queue.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // One thread per core, started on first use
+    static ThreadPool& shared();
+
+    std::future<void> submit(std::function<void()> task);
+    size_t size() const { return workers.size(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::packaged_task<void()>> tasks;
+    };
+
+    bool take(size_t self, std::packaged_task<void()>& task);
+    void work(size_t self);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue{0};
+    // Tasks queued and not yet taken; idle workers sleep while it is zero
+    std::mutex mutex;
+    std::condition_variable ready;
+    size_t queued = 0;
+    bool stopping = false;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <iostream>
+
+#include "number.h"
+#include "value.h"
+
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+Value parseNumber(std::string_view text) {
+    NumberPrefix number = readNumber(text);
+    if (number.integral) {
+        return number.integer;
+    }
+    return number.real;
+}
+
+
+void appendTo(std::string& out, const Value& value) {
+    switch (value.index()) {
+        case 1:
+            appendInteger(out, std::get<int64_t>(value));
+            break;
+        case 2:
+            appendFloat(out, std::get<double>(value));
+            break;
+        case 3:
+            out += std::get<std::string>(value);
+            break;
+        default:
+            break;
+    }
+}
+
+
+std::string toString(const Value& value) {
+    if (auto text = std::get_if<std::string>(&value)) {
+        return *text;
+    }
+    std::string out;
+    appendTo(out, value);
+    return out;
+}
+
+
+std::string concatenate(Value* parts, size_t count) {
+    // Longest int or float text, such as "-1.7976931348623E+308"
+    static const size_t MAX_NUMBER_SIZE = 24;
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (auto text = std::get_if<std::string>(&parts[i])) {
+            size += text->size();
+        } else if (parts[i].index() != 0) {
+            size += MAX_NUMBER_SIZE;
+        }
+    }
+    std::string result;
+    size_t i = 0;
+    if (auto first = std::get_if<std::string>(&parts[0])) {
+        result = std::move(*first);
+        i = 1;
+    }
+    // Growing at least twofold keeps repeated appends to one string linear
+    if (size > result.capacity()) {
+        result.reserve(std::max(size, 2 * result.capacity()));
+    }
+    for (; i < count; ++i) {
+        appendTo(result, parts[i]);
+    }
+    return result;
+}
+
+
+// Numeric strings: optional leading whitespace, sign, digits with an
+// optional fraction and exponent, optional trailing whitespace. A numeric
+// prefix followed by garbage is used with a warning; anything else counts as 0.
+static Value stringToNumber(const std::string& text) {
+    NumberPrefix number = readNumber(text);
+    if (number.length == 0) {
+        std::cerr << "A non-numeric value encountered: " << text << std::endl;
+        return int64_t{0};
+    }
+    size_t end = number.length;
+    while (end < text.size() && isSpace(text[end])) {
+        end++;
+    }
+    if (end != text.size()) {
+        std::cerr << "A non-numeric value encountered: " << text << std::endl;
+    }
+    if (number.integral) {
+        return number.integer;
+    }
+    return number.real;
+}
+
+
+Value toNumber(const Value& value) {
+    switch (value.index()) {
+        case 1:
+        case 2:
+            return value;
+        case 3:
+            return stringToNumber(std::get<std::string>(value));
+        default:
+            return int64_t{0};
+    }
+}
+
+
+bool isNumericString(const std::string& text) {
+    NumberPrefix number = readNumber(text);
+    if (number.length == 0) {
+        return false;
+    }
+    size_t end = number.length;
+    while (end < text.size() && isSpace(text[end])) {
+        end++;
+    }
+    return end == text.size();
+}
+
+
+static double toDouble(const Value& number) {
+    if (auto integer = std::get_if<int64_t>(&number)) {
+        return static_cast<double>(*integer);
+    }
+    return std::get<double>(number);
+}
+
+
+// Integer arithmetic stays integral until it overflows, as in PHP
+Value integerOperation(char op, int64_t left, int64_t right) {
+    int64_t result;
+    switch (op) {
+        case '+':
+            if (!__builtin_add_overflow(left, right, &result)) return result;
+            return static_cast<double>(left) + static_cast<double>(right);
+        case '-':
+            if (!__builtin_sub_overflow(left, right, &result)) return result;
+            return static_cast<double>(left) - static_cast<double>(right);
+        case '*':
+            if (!__builtin_mul_overflow(left, right, &result)) return result;
+            return static_cast<double>(left) * static_cast<double>(right);
+        case '/':
+            if (right == 0) {
+                std::cerr << "Division by zero" << std::endl;
+            } else if (!(left == INT64_MIN && right == -1) && left % right == 0) {
+                return left / right;
+            }
+            return static_cast<double>(left) / static_cast<double>(right);
+    }
+    return int64_t{0};
+}
+
+
+Value floatOperation(char op, double left, double right) {
+    switch (op) {
+        case '+':
+            return left + right;
+        case '-':
+            return left - right;
+        case '*':
+            return left * right;
+        case '/':
+            if (right == 0) {
+                std::cerr << "Division by zero" << std::endl;
+            }
+            return left / right;
+    }
+    return int64_t{0};
+}
+
+
+Value binaryOperation(char op, const Value& left, const Value& right) {
+    if (op == '.') {
+        std::string result = toString(left);
+        appendTo(result, right);
+        return result;
+    }
+
+    // Fast path: both operands are already ints
+    const int64_t* leftInteger = std::get_if<int64_t>(&left);
+    const int64_t* rightInteger = std::get_if<int64_t>(&right);
+    if (leftInteger && rightInteger) {
+        return integerOperation(op, *leftInteger, *rightInteger);
+    }
+
+    Value leftNumber = toNumber(left);
+    Value rightNumber = toNumber(right);
+    leftInteger = std::get_if<int64_t>(&leftNumber);
+    rightInteger = std::get_if<int64_t>(&rightNumber);
+    if (leftInteger && rightInteger) {
+        return integerOperation(op, *leftInteger, *rightInteger);
+    }
+    return floatOperation(op, toDouble(leftNumber), toDouble(rightNumber));
+}
@@ -0,0 +1,38 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+
+
+// Runtime value: null, int, float or string, as in PHP
+using Value = std::variant<std::monostate, int64_t, double, std::string>;
+
+
+// Parse a numeric literal ("12", "2.5") into an int or float value
+Value parseNumber(std::string_view text);
+
+// String conversion used by echo and '.'
+std::string toString(const Value& value);
+void appendTo(std::string& out, const Value& value);
+
+// Concatenation of count parts with one allocation: the size is summed
+// first. A string first part is moved from and appended to in place.
+std::string concatenate(Value* parts, size_t count);
+
+// Numeric conversion used by arithmetic; strings are read as PHP numeric strings
+Value toNumber(const Value& value);
+// True when toNumber() converts the string without a warning
+bool isNumericString(const std::string& text);
+
+// Binary operators: '+', '-', '*', '/' and '.'
+Value binaryOperation(char op, const Value& left, const Value& right);
+// Arithmetic on operands already known to be ints or floats; ints that
+// overflow or do not divide evenly give a float
+Value integerOperation(char op, int64_t left, int64_t right);
+Value floatOperation(char op, double left, double right);
+
+#endif // VALUE_H
@@ -0,0 +1,150 @@
+#include <iterator>
+#include <vector>
+
+#include "interpret.h"
+
+
+void Interpreter::run(const ProgramView& program) {
+    Task<void> task = render(program);
+    task.start();
+}
+
+
+// Stack VM: one switch dispatch per instruction, operands on a value stack.
+// The loop checks are the only cost of the suspension points without one.
+Task<void> Interpreter::render(ProgramView program) {
+    const Instruction* code = program.code;
+    std::vector<Value> stack;
+    size_t pc = 0;
+
+    for (;;) {
+        const Instruction& instruction = code[pc++];
+        switch (instruction.op) {
+            case OP_TEXT:
+                out.writeStatic(program.string(instruction.arg));
+                if (outputBacklog()) {
+                    co_await asyncOutput->drain();
+                }
+                break;
+            case OP_PUSH:
+                stack.push_back(program.value(instruction.arg));
+                break;
+            case OP_LOAD:
+                if (loop && pending[instruction.arg]) {
+                    co_await httpResult(instruction.arg);
+                }
+                stack.push_back(loadVariable(instruction.arg));
+                break;
+            case OP_STORE:
+                storeVariable(instruction.arg, std::move(stack.back()));
+                stack.pop_back();
+                break;
+            case OP_TAKE:
+                if (loop && pending[instruction.arg]) {
+                    co_await httpResult(instruction.arg);
+                }
+                stack.push_back(takeVariable(instruction.arg));
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV: {
+                static const char operators[] = {'+', '-', '*', '/'};
+                Value right = std::move(stack.back());
+                stack.pop_back();
+                stack.back() = binaryOperation(operators[instruction.op - OP_ADD], stack.back(), right);
+                break;
+            }
+            case OP_CONCAT: {
+                size_t first = stack.size() - instruction.arg;
+                std::string result = concatenate(&stack[first], instruction.arg);
+                stack.resize(first + 1);
+                stack.back() = std::move(result);
+                break;
+            }
+            case OP_ECHO:
+                writeValue(stack.back());
+                out.write("\n");
+                stack.pop_back();
+                if (outputBacklog()) {
+                    co_await asyncOutput->drain();
+                }
+                break;
+            case OP_WRITE:
+                writeValue(stack.back());
+                stack.pop_back();
+                if (outputBacklog()) {
+                    co_await asyncOutput->drain();
+                }
+                break;
+            case OP_DB: {
+                int64_t slot = program.constants[instruction.arg + 1].integer;
+                size_t count = static_cast<size_t>(program.constants[instruction.arg + 2].integer);
+                std::vector<DbQuery> queries(1);
+                queries[0].query = std::string(program.string(instruction.arg));
+                queries[0].params.assign(std::make_move_iterator(stack.end() - count),
+                                         std::make_move_iterator(stack.end()));
+                stack.resize(stack.size() - count);
+                uint32_t target = slot < 0 ? NO_SLOT : static_cast<uint32_t>(slot);
+                if (loop) {
+                    co_await databaseQueriesAsync(queries, &target);
+                } else {
+                    databaseQueries(queries, &target);
+                }
+                break;
+            }
+            case OP_DB_BATCH: {
+                size_t count = static_cast<size_t>(program.constants[instruction.arg].integer);
+                std::vector<DbQuery> queries(count);
+                std::vector<uint32_t> slots(count);
+                size_t arguments = 0;
+                for (size_t i = 0; i < count; ++i) {
+                    arguments += static_cast<size_t>(program.constants[instruction.arg + 3 + 3 * i].integer);
+                }
+                auto argument = stack.end() - arguments;
+                for (size_t i = 0; i < count; ++i) {
+                    uint32_t block = instruction.arg + 1 + 3 * static_cast<uint32_t>(i);
+                    int64_t slot = program.constants[block + 1].integer;
+                    size_t argumentCount = static_cast<size_t>(program.constants[block + 2].integer);
+                    queries[i].query = std::string(program.string(block));
+                    queries[i].params.assign(std::make_move_iterator(argument),
+                                             std::make_move_iterator(argument + argumentCount));
+                    argument += argumentCount;
+                    slots[i] = slot < 0 ? NO_SLOT : static_cast<uint32_t>(slot);
+                }
+                stack.resize(stack.size() - arguments);
+                if (loop) {
+                    co_await databaseQueriesAsync(queries, slots.data());
+                } else {
+                    databaseQueries(queries, slots.data());
+                }
+                break;
+            }
+            case OP_HTTP:
+                if (loop) {
+                    co_await httpCapacity();
+                }
+                httpRequest(static_cast<uint32_t>(program.constants[instruction.arg].integer),
+                            std::string(program.string(instruction.arg + 1)),
+                            std::string(program.string(instruction.arg + 2)),
+                            std::string(program.string(instruction.arg + 3)),
+                            std::string(program.string(instruction.arg + 4)));
+                break;
+            case OP_HALT:
+                if (profiler) {
+                    profiler->endStatements();
+                }
+                if (loop) {
+                    co_await resolveAllAsync();
+                } else {
+                    resolveAll();
+                }
+                co_return;
+            case OP_PROFILE:
+                if (profiler) {
+                    profiler->statement(instruction.arg);
+                }
+                break;
+        }
+    }
+}